@@ -0,0 +1,494 @@
+/*
+ * Simple IO scheduler
+ *
+ * A deadline scheduler without sorting, for devices with no seek cost
+ * such as eMMC and SD cards.
+ *
+ * Requests are kept on a FIFO per sync class and data direction, and
+ * dispatched in arrival order.  Reads go ahead of writes, but writes
+ * are passed over for at most writes_starved read batches.  Within a
+ * direction, expired requests go first, then sync before async.
+ *
+ * Back merges are found by the elevator core; front merges by a walk
+ * of the matching FIFO.
+ *
+ * See Documentation/block/sio-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+
+#include <asm/div64.h>
+
+enum sio_data_dir {
+	ASYNC,
+	SYNC,
+};
+
+static const int sync_read_expire = HZ / 2;	/* max time before a sync read is submitted. */
+static const int sync_write_expire = 2 * HZ;	/* max time before a sync write is submitted. */
+static const int async_read_expire = 4 * HZ;	/* ditto for async, these limits are SOFT! */
+static const int async_write_expire = 16 * HZ;	/* ditto for async, these limits are SOFT! */
+static const int writes_starved = 2;		/* max times reads can starve a write */
+static const int fifo_batch = 1;		/* # of requests dispatched as one batch */
+
+/*
+ * Per data direction latency accounting, in jiffies.  wait is the time
+ * from a request's allocation until its dispatch to the driver, done
+ * the time until its completion.
+ */
+struct sio_stats {
+	unsigned long dispatched;
+	unsigned long completed;
+	unsigned long long wait_total;
+	unsigned long wait_max;
+	unsigned long long done_total;
+	unsigned long done_max;
+};
+
+struct sio_data {
+	/*
+	 * run time data
+	 */
+	struct list_head fifo_list[2][2];	/* [ASYNC/SYNC][READ/WRITE] */
+
+	unsigned int batched;		/* requests dispatched in this batch */
+	int batch_dir;			/* data direction of this batch */
+	unsigned int starved;		/* times reads have starved writes */
+
+	struct sio_stats stats[2];	/* [READ/WRITE], under queue_lock */
+	struct request_queue *queue;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[2][2];
+	int fifo_batch;
+	int writes_starved;
+};
+
+static inline struct sio_data *
+sio_get_data(struct request_queue *q)
+{
+	return q->elevator->elevator_data;
+}
+
+static void
+sio_add_request(struct request_queue *q, struct request *rq)
+{
+	struct sio_data *sd = sio_get_data(q);
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	/*
+	 * set expire time and add to fifo list
+	 */
+	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
+	list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+}
+
+static int
+sio_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct sio_data *sd = sio_get_data(q);
+	const int sync = rw_is_sync(bio->bi_rw);
+	const int data_dir = bio_data_dir(bio);
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+	struct request *__rq;
+
+	/*
+	 * check for front merge, newest requests first as they are the
+	 * likeliest to be contiguous with the bio
+	 */
+	list_for_each_entry_reverse(__rq, &sd->fifo_list[sync][data_dir],
+				    queuelist) {
+		if (blk_rq_pos(__rq) == sector && elv_rq_merge_ok(__rq, bio)) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void
+sio_merged_requests(struct request_queue *q, struct request *rq,
+		    struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq_set_fifo_time(rq, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	rq_fifo_clear(next);
+}
+
+/*
+ * move request from fifo to dispatch queue.
+ */
+static void
+sio_dispatch_request(struct sio_data *sd, struct request *rq)
+{
+	struct sio_stats *stats = &sd->stats[rq_data_dir(rq)];
+	unsigned long wait = jiffies - rq->start_time;
+
+	rq_fifo_clear(rq);
+	elv_dispatch_add_tail(rq->q, rq);
+
+	stats->dispatched++;
+	stats->wait_total += wait;
+	if (wait > stats->wait_max)
+		stats->wait_max = wait;
+
+	sd->batched++;
+}
+
+static void
+sio_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct sio_data *sd = sio_get_data(q);
+	struct sio_stats *stats = &sd->stats[rq_data_dir(rq)];
+	unsigned long done = jiffies - rq->start_time;
+
+	stats->completed++;
+	stats->done_total += done;
+	if (done > stats->done_max)
+		stats->done_max = done;
+}
+
+/*
+ * get the oldest request of sync class sync in direction data_dir, if
+ * it has expired
+ */
+static struct request *
+sio_expired_request(struct sio_data *sd, int sync, int data_dir)
+{
+	struct list_head *list = &sd->fifo_list[sync][data_dir];
+	struct request *rq;
+
+	if (list_empty(list))
+		return NULL;
+
+	rq = rq_entry_fifo(list->next);
+	if (time_after(jiffies, rq_fifo_time(rq)))
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+sio_choose_request(struct sio_data *sd, int data_dir)
+{
+	struct list_head *sync = sd->fifo_list[SYNC];
+	struct list_head *async = sd->fifo_list[ASYNC];
+	struct request *rq;
+
+	rq = sio_expired_request(sd, SYNC, data_dir);
+	if (rq)
+		return rq;
+	rq = sio_expired_request(sd, ASYNC, data_dir);
+	if (rq)
+		return rq;
+
+	if (!list_empty(&sync[data_dir]))
+		return rq_entry_fifo(sync[data_dir].next);
+	if (!list_empty(&async[data_dir]))
+		return rq_entry_fifo(async[data_dir].next);
+
+	return NULL;
+}
+
+static inline int
+sio_dir_pending(struct sio_data *sd, int data_dir)
+{
+	return !list_empty(&sd->fifo_list[SYNC][data_dir]) ||
+		!list_empty(&sd->fifo_list[ASYNC][data_dir]);
+}
+
+static int
+sio_dispatch_requests(struct request_queue *q, int force)
+{
+	struct sio_data *sd = sio_get_data(q);
+	const int reads = sio_dir_pending(sd, READ);
+	const int writes = sio_dir_pending(sd, WRITE);
+	int data_dir;
+
+	/*
+	 * keep going in the current direction until the batch is done
+	 */
+	if (sd->batched && sd->batched < sd->fifo_batch &&
+	    sio_dir_pending(sd, sd->batch_dir)) {
+		data_dir = sd->batch_dir;
+		goto dispatch;
+	}
+
+	if (reads && (!writes || sd->starved < sd->writes_starved)) {
+		if (writes)
+			sd->starved++;
+		data_dir = READ;
+	} else if (writes) {
+		sd->starved = 0;
+		data_dir = WRITE;
+	} else
+		return 0;
+
+	sd->batched = 0;
+	sd->batch_dir = data_dir;
+
+dispatch:
+	sio_dispatch_request(sd, sio_choose_request(sd, data_dir));
+	return 1;
+}
+
+static int
+sio_queue_empty(struct request_queue *q)
+{
+	struct sio_data *sd = sio_get_data(q);
+
+	return !sio_dir_pending(sd, READ) && !sio_dir_pending(sd, WRITE);
+}
+
+static struct request *
+sio_former_request(struct request_queue *q, struct request *rq)
+{
+	struct sio_data *sd = sio_get_data(q);
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	if (rq->queuelist.prev == &sd->fifo_list[sync][data_dir])
+		return NULL;
+
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+sio_latter_request(struct request_queue *q, struct request *rq)
+{
+	struct sio_data *sd = sio_get_data(q);
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	if (rq->queuelist.next == &sd->fifo_list[sync][data_dir])
+		return NULL;
+
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static void
+sio_exit_queue(struct elevator_queue *e)
+{
+	struct sio_data *sd = e->elevator_data;
+
+	BUG_ON(!list_empty(&sd->fifo_list[SYNC][READ]));
+	BUG_ON(!list_empty(&sd->fifo_list[SYNC][WRITE]));
+	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][READ]));
+	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][WRITE]));
+
+	kfree(sd);
+}
+
+/*
+ * initialize elevator private data (sio_data).
+ */
+static void *sio_init_queue(struct request_queue *q)
+{
+	struct sio_data *sd;
+
+	sd = kmalloc_node(sizeof(*sd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!sd)
+		return NULL;
+
+	INIT_LIST_HEAD(&sd->fifo_list[SYNC][READ]);
+	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
+	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
+	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
+	sd->fifo_expire[SYNC][READ] = sync_read_expire;
+	sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
+	sd->fifo_expire[ASYNC][READ] = async_read_expire;
+	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
+	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->queue = q;
+	return sd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+sio_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+sio_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct sio_data *sd = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return sio_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(sio_sync_read_expire_show, sd->fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(sio_sync_write_expire_show, sd->fifo_expire[SYNC][WRITE], 1);
+SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
+SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
+SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct sio_data *sd = e->elevator_data;				\
+	int __data;							\
+	int ret = sio_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(sio_sync_read_expire_store, &sd->fifo_expire[SYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_sync_write_expire_store, &sd->fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+/*
+ * "dispatched avg_wait max_wait completed avg_done max_done", times in
+ * msecs.  Writing anything resets the counters.
+ */
+static ssize_t
+sio_stats_show(struct sio_data *sd, int dir, char *page)
+{
+	struct sio_stats stats;
+	unsigned long long wait_avg, done_avg;
+
+	spin_lock_irq(sd->queue->queue_lock);
+	stats = sd->stats[dir];
+	spin_unlock_irq(sd->queue->queue_lock);
+
+	wait_avg = stats.wait_total;
+	done_avg = stats.done_total;
+	if (stats.dispatched)
+		do_div(wait_avg, stats.dispatched);
+	if (stats.completed)
+		do_div(done_avg, stats.completed);
+
+	return sprintf(page, "%lu %u %u %lu %u %u\n",
+		       stats.dispatched,
+		       jiffies_to_msecs((unsigned long) wait_avg),
+		       jiffies_to_msecs(stats.wait_max),
+		       stats.completed,
+		       jiffies_to_msecs((unsigned long) done_avg),
+		       jiffies_to_msecs(stats.done_max));
+}
+
+static void sio_stats_reset(struct sio_data *sd, int dir)
+{
+	spin_lock_irq(sd->queue->queue_lock);
+	memset(&sd->stats[dir], 0, sizeof(sd->stats[dir]));
+	spin_unlock_irq(sd->queue->queue_lock);
+}
+
+#define STATS_FUNCTION(__FUNC, __DIR)					\
+static ssize_t __FUNC##_show(struct elevator_queue *e, char *page)	\
+{									\
+	struct sio_data *sd = e->elevator_data;				\
+	return sio_stats_show(sd, __DIR, page);				\
+}									\
+static ssize_t __FUNC##_store(struct elevator_queue *e,			\
+			      const char *page, size_t count)		\
+{									\
+	struct sio_data *sd = e->elevator_data;				\
+	sio_stats_reset(sd, __DIR);					\
+	return count;							\
+}
+STATS_FUNCTION(sio_read_stats, READ);
+STATS_FUNCTION(sio_write_stats, WRITE);
+#undef STATS_FUNCTION
+
+#define DD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, sio_##name##_show, \
+				      sio_##name##_store)
+
+static struct elv_fs_entry sio_attrs[] = {
+	DD_ATTR(sync_read_expire),
+	DD_ATTR(sync_write_expire),
+	DD_ATTR(async_read_expire),
+	DD_ATTR(async_write_expire),
+	DD_ATTR(fifo_batch),
+	DD_ATTR(writes_starved),
+	DD_ATTR(read_stats),
+	DD_ATTR(write_stats),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_sio = {
+	.ops = {
+		.elevator_merge_fn =		sio_merge,
+		.elevator_merge_req_fn =	sio_merged_requests,
+		.elevator_dispatch_fn =		sio_dispatch_requests,
+		.elevator_add_req_fn =		sio_add_request,
+		.elevator_completed_req_fn =	sio_completed_request,
+		.elevator_queue_empty_fn =	sio_queue_empty,
+		.elevator_former_req_fn =	sio_former_request,
+		.elevator_latter_req_fn =	sio_latter_request,
+		.elevator_init_fn =		sio_init_queue,
+		.elevator_exit_fn =		sio_exit_queue,
+	},
+
+	.elevator_attrs = sio_attrs,
+	.elevator_name = "sio",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init sio_init(void)
+{
+	elv_register(&iosched_sio);
+
+	return 0;
+}
+
+static void __exit sio_exit(void)
+{
+	elv_unregister(&iosched_sio);
+}
+
+module_init(sio_init);
+module_exit(sio_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Simple IO scheduler");
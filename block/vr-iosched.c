@@ -15,6 +15,13 @@
  * Async and synch requests are not treated seperately.  Instead we
  * rely on deadlines to ensure fairness.
  *
+ * Flash mode (flash=1) is for devices with no seek cost, such as eMMC
+ * and SD cards.  Head position and rev_penalty are ignored.  Requests are
+ * issued in batches of one data direction, reads ahead of writes, a batch
+ * running on through sector order for as long as the next request has
+ * the same direction.  Writes are passed over for at most writes_starved
+ * read batches, and sync and async requests keep their own deadlines.
+ *
  */
 #include <linux/kernel.h>
 #include <linux/fs.h>
@@ -43,10 +50,11 @@ static const int sync_expire = HZ / 2;  /* max time before a sync is submitted.
 static const int async_expire = 5 * HZ; /* ditto for async, these limits are SOFT! */
 static const int fifo_batch = 16;
 static const int rev_penalty = 10;	/* penalty for reversing head direction */
+static const int writes_starved = 2;	/* max times reads can starve a write */
 
 struct vr_data {
 	struct rb_root sort_list;
-	struct list_head fifo_list[2];
+	struct list_head fifo_list[2][2];	/* [READ/WRITE][ASYNC/SYNC] */
 
 	struct request *next_rq;
 	struct request *prev_rq;
@@ -55,10 +63,15 @@ struct vr_data {
 	sector_t last_sector;		/* head position */
 	int head_dir;
 
+	int batch_dir;			/* flash mode: data direction of batch */
+	unsigned int starved;		/* flash mode: read batches since a write */
+
 	/* tunables */
 	int fifo_expire[2];
 	int fifo_batch;
 	int rev_penalty;
+	int flash;
+	int writes_starved;
 };
 
 static void vr_move_request(struct vr_data *, struct request *);
@@ -123,10 +136,8 @@ vr_add_request(struct request_queue *q, struct request *rq)
 
 	vr_add_rq_rb(vd, rq);
 
-	if (vd->fifo_expire[dir]) {
-		rq_set_fifo_time(rq, jiffies + vd->fifo_expire[dir]);
-		list_add_tail(&rq->queuelist, &vd->fifo_list[dir]);
-	}
+	rq_set_fifo_time(rq, jiffies + vd->fifo_expire[dir]);
+	list_add_tail(&rq->queuelist, &vd->fifo_list[rq_data_dir(rq)][dir]);
 }
 
 /*
@@ -211,19 +222,35 @@ vr_move_request(struct vr_data *vd, struct request *rq)
 	vd->nbatched++;
 }
 
+/*
+ * get the oldest request queued for data direction data_dir and sync
+ * class ddir
+ */
+static struct request *
+vr_fifo_first(struct vr_data *vd, int data_dir, int ddir)
+{
+	if (list_empty(&vd->fifo_list[data_dir][ddir]))
+		return NULL;
+
+	return rq_entry_fifo(vd->fifo_list[data_dir][ddir].next);
+}
+
 /*
  * get the first expired request in direction ddir
  */
 static struct request *
 vr_expired_request(struct vr_data *vd, int ddir)
 {
-	struct request *rq;
+	struct request *rq = vr_fifo_first(vd, READ, ddir);
+	struct request *wrq = vr_fifo_first(vd, WRITE, ddir);
 
-	if (list_empty(&vd->fifo_list[ddir]))
+	if (!vd->fifo_expire[ddir])
 		return NULL;
 
-	rq = rq_entry_fifo(vd->fifo_list[ddir].next);
-	if (time_after(jiffies, rq_fifo_time(rq)))
+	if (!rq || (wrq && time_before(rq_fifo_time(wrq), rq_fifo_time(rq))))
+		rq = wrq;
+
+	if (rq && time_after(jiffies, rq_fifo_time(rq)))
 		return rq;
 
 	return NULL;
@@ -282,12 +309,63 @@ vr_choose_request(struct vr_data *vd)
 	return prev;
 }
 
+/*
+ * Flash mode: carry on with the current batch, or start a new one.
+ */
+static struct request *
+vr_flash_choose_request(struct vr_data *vd)
+{
+	struct request *rq = vd->next_rq;
+	int reads, writes;
+
+	if (rq && rq_data_dir(rq) == vd->batch_dir &&
+	    vd->nbatched < vd->fifo_batch)
+		return rq;
+
+	vd->nbatched = 0;
+
+	rq = vr_check_fifo(vd);
+	if (rq)
+		goto out;
+
+	reads = !list_empty(&vd->fifo_list[READ][SYNC]) ||
+		!list_empty(&vd->fifo_list[READ][ASYNC]);
+	writes = !list_empty(&vd->fifo_list[WRITE][SYNC]) ||
+		 !list_empty(&vd->fifo_list[WRITE][ASYNC]);
+
+	if (reads && (!writes || vd->starved < vd->writes_starved)) {
+		if (writes)
+			vd->starved++;
+		rq = vr_fifo_first(vd, READ, SYNC) ? :
+			vr_fifo_first(vd, READ, ASYNC);
+	} else if (writes) {
+		vd->starved = 0;
+		rq = vr_fifo_first(vd, WRITE, SYNC) ? :
+			vr_fifo_first(vd, WRITE, ASYNC);
+	}
+
+	if (!rq)
+		return NULL;
+out:
+	vd->batch_dir = rq_data_dir(rq);
+	return rq;
+}
+
 static int
 vr_dispatch_requests(struct request_queue *q, int force)
 {
 	struct vr_data *vd = vr_get_data(q);
 	struct request *rq = NULL;
 
+	if (vd->flash) {
+		rq = vr_flash_choose_request(vd);
+		if (!rq)
+			return 0;
+
+		vr_move_request(vd, rq);
+		return 1;
+	}
+
 	/* Check for and issue expired requests */
 	if (vd->nbatched > vd->fifo_batch) {
 		vd->nbatched = 0;
@@ -331,13 +409,16 @@ static void *vr_init_queue(struct request_queue *q)
 	if (!vd)
 		return NULL;
 
-	INIT_LIST_HEAD(&vd->fifo_list[SYNC]);
-	INIT_LIST_HEAD(&vd->fifo_list[ASYNC]);
+	INIT_LIST_HEAD(&vd->fifo_list[READ][SYNC]);
+	INIT_LIST_HEAD(&vd->fifo_list[READ][ASYNC]);
+	INIT_LIST_HEAD(&vd->fifo_list[WRITE][SYNC]);
+	INIT_LIST_HEAD(&vd->fifo_list[WRITE][ASYNC]);
 	vd->sort_list = RB_ROOT;
 	vd->fifo_expire[SYNC] = sync_expire;
 	vd->fifo_expire[ASYNC] = async_expire;
 	vd->fifo_batch = fifo_batch;
 	vd->rev_penalty = rev_penalty;
+	vd->writes_starved = writes_starved;
 	return vd;
 }
 
@@ -371,6 +452,8 @@ SHOW_FUNCTION(vr_sync_expire_show, vd->fifo_expire[SYNC], 1);
 SHOW_FUNCTION(vr_async_expire_show, vd->fifo_expire[ASYNC], 1);
 SHOW_FUNCTION(vr_fifo_batch_show, vd->fifo_batch, 0);
 SHOW_FUNCTION(vr_rev_penalty_show, vd->rev_penalty, 0);
+SHOW_FUNCTION(vr_flash_show, vd->flash, 0);
+SHOW_FUNCTION(vr_writes_starved_show, vd->writes_starved, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -393,6 +476,8 @@ STORE_FUNCTION(vr_sync_expire_store, &vd->fifo_expire[SYNC], 0, INT_MAX, 1);
 STORE_FUNCTION(vr_async_expire_store, &vd->fifo_expire[ASYNC], 0, INT_MAX, 1);
 STORE_FUNCTION(vr_fifo_batch_store, &vd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(vr_rev_penalty_store, &vd->rev_penalty, 0, INT_MAX, 0);
+STORE_FUNCTION(vr_flash_store, &vd->flash, 0, 1, 0);
+STORE_FUNCTION(vr_writes_starved_store, &vd->writes_starved, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -404,6 +489,8 @@ static struct elv_fs_entry vr_attrs[] = {
 	DD_ATTR(async_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(rev_penalty),
+	DD_ATTR(flash),
+	DD_ATTR(writes_starved),
 	__ATTR_NULL
 };
 
@@ -28,6 +28,9 @@
 
 #include <asm/cputime.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_interactive.h>
+
 static void (*pm_idle_old)(void);
 static atomic_t active_count = ATOMIC_INIT(0);
 
@@ -40,6 +43,7 @@ struct cpufreq_interactive_cpuinfo {
 	int idling;
 	u64 freq_change_time;
 	u64 freq_change_time_in_idle;
+	u64 hispeed_validate_time;
 	struct cpufreq_policy *policy;
 	struct cpufreq_frequency_table *freq_table;
 	unsigned int target_freq;
@@ -57,10 +61,37 @@ static spinlock_t up_cpumask_lock;
 static cpumask_t down_cpumask;
 static spinlock_t down_cpumask_lock;
 
-/* Go to max speed when CPU load at or above this value. */
+/* Go to hispeed_freq when CPU load at or above this value. */
 #define DEFAULT_GO_MAXSPEED_LOAD 85
 static unsigned long go_maxspeed_load;
 
+/* Hi speed to bump to from lo speed when load bursts (0 = policy max). */
+static unsigned long hispeed_freq;
+
+/*
+ * Load, as a percentage of the current speed, the governor picks a speed
+ * to run at.
+ */
+#define DEFAULT_TARGET_LOAD 90
+static unsigned long target_load;
+
+/*
+ * The time load must have asked for more than hispeed_freq before we go
+ * above it.
+ */
+#define DEFAULT_ABOVE_HISPEED_DELAY 20000
+static unsigned long above_hispeed_delay;
+
+/*
+ * Keep at least hispeed_freq while boost is set, or for boostpulse_duration
+ * after a write to boostpulse.
+ */
+#define DEFAULT_BOOSTPULSE_DURATION 80000
+static unsigned long boost;
+static unsigned long boostpulse_duration;
+static u64 boostpulse_endtime;
+static spinlock_t boostpulse_lock;	/* 64-bit endtime, not atomic on ARM */
+
 /*
  * The minimum amount of time to spend at a frequency before we can ramp down.
  */
@@ -167,19 +198,80 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+/*
+ * Percentage of a sampling window the CPU spent busy.
+ */
+static inline int load_of(unsigned int delta_time, unsigned int delta_idle)
+{
+	if (delta_idle > delta_time)
+		return 0;
+
+	return 100 * (delta_time - delta_idle) / delta_time;
+}
+
+/*
+ * Map a load to a frequency from the table.  This depends on nothing but
+ * the load, the current target, the policy limits and the tunables.
+ * tools/android/interactive-replay.c replays busy/idle traces through a
+ * copy of this and of the timer and idle hook below; keep them in step.
+ * Returns 0 if the table lookup fails.
+ */
+static unsigned int choose_freq(struct cpufreq_interactive_cpuinfo *pcpu,
+				int cpu_load, int boosted)
+{
+	unsigned int new_freq;
+	unsigned int index;
+
+	/*
+	 * The load was measured at the current speed; pick the speed at
+	 * which the same amount of work would come to target_load.
+	 */
+	new_freq = pcpu->target_freq * cpu_load / target_load;
+
+	/*
+	 * On a burst, step up to hispeed_freq first; the timer only lets
+	 * us go higher once load has stayed up for above_hispeed_delay.
+	 */
+	if (cpu_load >= go_maxspeed_load || boosted) {
+		if (pcpu->target_freq < hispeed_freq ||
+		    new_freq < hispeed_freq)
+			new_freq = hispeed_freq;
+	}
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   new_freq, CPUFREQ_RELATION_H,
+					   &index))
+		return 0;
+
+	return pcpu->freq_table[index].frequency;
+}
+
+static int boostpulse_active(u64 now)
+{
+	int active;
+	unsigned long flags;
+
+	spin_lock_irqsave(&boostpulse_lock, flags);
+	active = now < boostpulse_endtime;
+	spin_unlock_irqrestore(&boostpulse_lock, flags);
+	return active;
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
 	unsigned int delta_time;
 	int cpu_load;
 	int load_since_change;
+	int boosted;
+	unsigned int change_idle;
+	unsigned int change_time;
 	u64 time_in_idle;
 	u64 idle_exit_time;
 	struct cpufreq_interactive_cpuinfo *pcpu =
 		&per_cpu(cpuinfo, data);
 	u64 now_idle;
 	unsigned int new_freq;
-	unsigned int index;
 	unsigned long flags;
 
 	smp_rmb();
@@ -226,21 +318,14 @@ static void cpufreq_interactive_timer(unsigned long data)
 		goto rearm;
 	}
 
-	if (delta_idle > delta_time)
-		cpu_load = 0;
-	else
-		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
-
-	delta_idle = (unsigned int) cputime64_sub(now_idle,
+	cpu_load = load_of(delta_time, delta_idle);
+	change_idle = (unsigned int) cputime64_sub(now_idle,
 						 pcpu->freq_change_time_in_idle);
-	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
+	change_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
 						  pcpu->freq_change_time);
-
-	if (delta_idle > delta_time)
-		load_since_change = 0;
-	else
-		load_since_change =
-			100 * (delta_time - delta_idle) / delta_time;
+	trace_cpufreq_interactive_sample(data, delta_time, delta_idle,
+					 change_time, change_idle);
+	load_since_change = load_of(change_time, change_idle);
 
 	/*
 	 * Choose greater of short-term load (since last idle timer
@@ -250,22 +335,30 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
-	if (cpu_load >= go_maxspeed_load)
-		new_freq = pcpu->policy->max;
-	else
-		new_freq = pcpu->policy->max * cpu_load / 100;
+	boosted = boost || boostpulse_active(pcpu->timer_run_time);
+	new_freq = choose_freq(pcpu, cpu_load, boosted);
 
-	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
-					   new_freq, CPUFREQ_RELATION_H,
-					   &index)) {
+	if (!new_freq) {
 		dbgpr("timer %d: cpufreq_frequency_table_target error\n", (int) data);
 		goto rearm;
 	}
 
-	new_freq = pcpu->freq_table[index].frequency;
+	if (new_freq <= hispeed_freq) {
+		pcpu->hispeed_validate_time = pcpu->timer_run_time;
+	} else if (pcpu->target_freq <= hispeed_freq &&
+		   cputime64_sub(pcpu->timer_run_time,
+				 pcpu->hispeed_validate_time) <
+		   above_hispeed_delay) {
+		trace_cpufreq_interactive_notyet(data, cpu_load,
+						 pcpu->target_freq, new_freq);
+		dbgpr("timer %d: load=%d cur=%d tgt=%d above hispeed not yet\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+		goto rearm;
+	}
 
 	if (pcpu->target_freq == new_freq)
 	{
+		trace_cpufreq_interactive_already(data, cpu_load,
+						  pcpu->target_freq, new_freq);
 		dbgpr("timer %d: load=%d, already at %d\n", (int) data, cpu_load, new_freq);
 		goto rearm_if_notmax;
 	}
@@ -277,11 +370,16 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (new_freq < pcpu->target_freq) {
 		if (cputime64_sub(pcpu->timer_run_time, pcpu->freq_change_time) <
 		    min_sample_time) {
+			trace_cpufreq_interactive_notyet(data, cpu_load,
+							 pcpu->target_freq,
+							 new_freq);
 			dbgpr("timer %d: load=%d cur=%d tgt=%d not yet\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
 			goto rearm;
 		}
 	}
 
+	trace_cpufreq_interactive_target(data, cpu_load, pcpu->target_freq,
+					 new_freq);
 	dbgpr("timer %d: load=%d cur=%d tgt=%d queue\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
 
 	if (new_freq < pcpu->target_freq) {
@@ -490,6 +588,8 @@ static int cpufreq_interactive_up_task(void *data)
 			pcpu->freq_change_time_in_idle =
 				get_cpu_idle_time_us(cpu,
 						     &pcpu->freq_change_time);
+			trace_cpufreq_interactive_up(cpu, pcpu->target_freq,
+						     pcpu->policy->cur);
 			dbgpr("up %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
 		}
 	}
@@ -523,10 +623,47 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 		pcpu->freq_change_time_in_idle =
 			get_cpu_idle_time_us(cpu,
 					     &pcpu->freq_change_time);
+		trace_cpufreq_interactive_down(cpu, pcpu->target_freq,
+					       pcpu->policy->cur);
 		dbgpr("down %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
 	}
 }
 
+/*
+ * Raise every CPU below hispeed_freq to it right away, rather than
+ * waiting for the next timer to see the load.
+ */
+static void cpufreq_interactive_boost(void)
+{
+	unsigned int cpu;
+	int anyboost = 0;
+	unsigned long flags;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+
+		if (!pcpu->governor_enabled)
+			continue;
+
+		if (pcpu->target_freq < hispeed_freq) {
+			pcpu->target_freq = hispeed_freq;
+			pcpu->hispeed_validate_time =
+				ktime_to_us(ktime_get());
+			cpumask_set_cpu(cpu, &up_cpumask);
+			anyboost = 1;
+			dbgpr("boost %d: tgt=%d\n", cpu, pcpu->target_freq);
+		}
+	}
+
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	if (anyboost)
+		wake_up_process(up_task);
+}
+
 static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
@@ -557,9 +694,147 @@ static ssize_t store_min_sample_time(struct kobject *kobj,
 static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
 		show_min_sample_time, store_min_sample_time);
 
+static ssize_t show_hispeed_freq(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", hispeed_freq);
+}
+
+static ssize_t store_hispeed_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	hispeed_freq = val;
+	return count;
+}
+
+static struct global_attr hispeed_freq_attr = __ATTR(hispeed_freq, 0644,
+		show_hispeed_freq, store_hispeed_freq);
+
+static ssize_t show_target_load(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", target_load);
+}
+
+static ssize_t store_target_load(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val < 1 || val > 100)
+		return -EINVAL;
+	target_load = val;
+	return count;
+}
+
+static struct global_attr target_load_attr = __ATTR(target_load, 0644,
+		show_target_load, store_target_load);
+
+static ssize_t show_above_hispeed_delay(struct kobject *kobj,
+					struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", above_hispeed_delay);
+}
+
+static ssize_t store_above_hispeed_delay(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	above_hispeed_delay = val;
+	return count;
+}
+
+static struct global_attr above_hispeed_delay_attr =
+	__ATTR(above_hispeed_delay, 0644,
+	       show_above_hispeed_delay, store_above_hispeed_delay);
+
+static ssize_t show_boost(struct kobject *kobj,
+			  struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boost);
+}
+
+static ssize_t store_boost(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	boost = val;
+	if (boost)
+		cpufreq_interactive_boost();
+	return count;
+}
+
+static struct global_attr boost_attr = __ATTR(boost, 0644,
+		show_boost, store_boost);
+
+/* Any write starts a pulse; what is written does not matter */
+static ssize_t store_boostpulse(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&boostpulse_lock, flags);
+	boostpulse_endtime = ktime_to_us(ktime_get()) + boostpulse_duration;
+	spin_unlock_irqrestore(&boostpulse_lock, flags);
+	cpufreq_interactive_boost();
+	return count;
+}
+
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
+
+static ssize_t show_boostpulse_duration(struct kobject *kobj,
+					struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boostpulse_duration);
+}
+
+static ssize_t store_boostpulse_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	boostpulse_duration = val;
+	return count;
+}
+
+static struct global_attr boostpulse_duration_attr =
+	__ATTR(boostpulse_duration, 0644,
+	       show_boostpulse_duration, store_boostpulse_duration);
+
 static struct attribute *interactive_attributes[] = {
 	&go_maxspeed_load_attr.attr,
 	&min_sample_time_attr.attr,
+	&hispeed_freq_attr.attr,
+	&target_load_attr.attr,
+	&above_hispeed_delay_attr.attr,
+	&boost_attr.attr,
+	&boostpulse_attr.attr,
+	&boostpulse_duration_attr.attr,
 	NULL,
 };
 
@@ -586,6 +861,11 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		pcpu->freq_change_time_in_idle =
 			get_cpu_idle_time_us(new_policy->cpu,
 					     &pcpu->freq_change_time);
+		pcpu->hispeed_validate_time = pcpu->freq_change_time;
+
+		if (!hispeed_freq)
+			hispeed_freq = new_policy->max;
+
 		pcpu->governor_enabled = 1;
 		smp_wmb();
 		/*
@@ -646,6 +926,9 @@ static int __init cpufreq_interactive_init(void)
 
 	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	target_load = DEFAULT_TARGET_LOAD;
+	above_hispeed_delay = DEFAULT_ABOVE_HISPEED_DELAY;
+	boostpulse_duration = DEFAULT_BOOSTPULSE_DURATION;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -675,6 +958,7 @@ static int __init cpufreq_interactive_init(void)
 
 	spin_lock_init(&up_cpumask_lock);
 	spin_lock_init(&down_cpumask_lock);
+	spin_lock_init(&boostpulse_lock);
 
 #if DEBUG
 	spin_lock_init(&dbgpr_lock);
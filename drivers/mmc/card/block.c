@@ -29,6 +29,8 @@
 #include <linux/kdev_t.h>
 #include <linux/blkdev.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
 #include <linux/smp_lock.h>
 #include <linux/scatterlist.h>
 #include <linux/string_helpers.h>
@@ -56,6 +58,10 @@ MODULE_ALIAS("mmc:block");
 #define INAND_CMD38_ARG_SECTRIM1 0x81
 #define INAND_CMD38_ARG_SECTRIM2 0x88
 
+/* Packed command header */
+#define MMC_PACKED_CMD_VER	0x01
+#define MMC_PACKED_CMD_WR	0x02
+
 /*
  * max 8 partitions per card
  */
@@ -150,13 +156,6 @@ static const struct block_device_operations mmc_bdops = {
 	.owner			= THIS_MODULE,
 };
 
-struct mmc_blk_request {
-	struct mmc_request	mrq;
-	struct mmc_command	cmd;
-	struct mmc_command	stop;
-	struct mmc_data		data;
-};
-
 static u32 mmc_sd_num_wr_blocks(struct mmc_card *card)
 {
 	int err;
@@ -248,6 +247,19 @@ static u32 get_card_status(struct mmc_card *card, struct request *req)
 	return cmd.resp[0];
 }
 
+/*
+ * An SD card that has been pulled out.  Hosts that can tell report it
+ * through get_cd, the others are read from the slot's detect gpio.
+ */
+static int mmc_blk_card_removed(struct mmc_card *card)
+{
+	if (!mmc_card_sd(card))
+		return 0;
+	if (card->host->ops->get_cd)
+		return card->host->ops->get_cd(card->host) == 0;
+	return gpio_get_value(SD_CARD_DETECT) == 1;
+}
+
 static int mmc_blk_issue_discard_rq(struct mmc_queue *mq, struct request *req)
 {
 	struct mmc_blk_data *md = mq->data;
@@ -343,187 +355,551 @@ out:
 	return err ? 0 : 1;
 }
 
-static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
+static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
+			       struct mmc_card *card,
+			       int disable_multi,
+			       struct mmc_queue *mq)
 {
-	struct mmc_blk_data *md = mq->data;
-	struct mmc_card *card = md->queue.card;
-	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+	u32 readcmd, writecmd;
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	brq->data.blocks = blk_rq_sectors(req);
 
-	mmc_claim_host(card->host);
+	/*
+	 * The block layer doesn't support all sector count
+	 * restrictions, so we need to be prepared for too big
+	 * requests.
+	 */
+	if (brq->data.blocks > card->host->max_blk_count)
+		brq->data.blocks = card->host->max_blk_count;
 
-	do {
-		if (mmc_card_sd(card) && gpio_get_value(SD_CARD_DETECT) == 1) {
-			MMC_DBG("No card, stop read or write");
-			goto cmd_err;
-		}
-		struct mmc_command cmd;
-		u32 readcmd, writecmd, status = 0;
-
-		memset(&brq, 0, sizeof(struct mmc_blk_request));
-		brq.mrq.cmd = &brq.cmd;
-		brq.mrq.data = &brq.data;
-
-		brq.cmd.arg = blk_rq_pos(req);
-		if (!mmc_card_blockaddr(card))
-			brq.cmd.arg <<= 9;
-		brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
-		brq.data.blksz = 512;
-		brq.stop.opcode = MMC_STOP_TRANSMISSION;
-		brq.stop.arg = 0;
-		brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-		brq.data.blocks = blk_rq_sectors(req);
+	/*
+	 * After a read error, we redo the request one sector at a time
+	 * in order to accurately determine which sectors can be read
+	 * successfully.
+	 */
+	if (disable_multi && brq->data.blocks > 1)
+		brq->data.blocks = 1;
 
-		/*
-		 * The block layer doesn't support all sector count
-		 * restrictions, so we need to be prepared for too big
-		 * requests.
+	if (brq->data.blocks > 1) {
+		/* SPI multiblock writes terminate using a special
+		 * token, not a STOP_TRANSMISSION request.
 		 */
-		if (brq.data.blocks > card->host->max_blk_count)
-			brq.data.blocks = card->host->max_blk_count;
+		if (!mmc_host_is_spi(card->host)
+				|| rq_data_dir(req) == READ)
+			brq->mrq.stop = &brq->stop;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else {
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_SINGLE_BLOCK;
+		writecmd = MMC_WRITE_BLOCK;
+	}
+
+	if (rq_data_dir(req) == READ) {
+		brq->cmd.opcode = readcmd;
+		brq->data.flags |= MMC_DATA_READ;
+	} else {
+		brq->cmd.opcode = writecmd;
+		brq->data.flags |= MMC_DATA_WRITE;
+	}
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	/*
+	 * Adjust the sg list so it is the same size as the
+	 * request.
+	 */
+	if (brq->data.blocks != blk_rq_sectors(req)) {
+		int i, data_size = brq->data.blocks << 9;
+		struct scatterlist *sg;
+
+		for_each_sg(brq->data.sg, sg, brq->data.sg_len, i) {
+			data_size -= sg->length;
+			if (data_size <= 0) {
+				sg->length += data_size;
+				i++;
+				break;
+			}
+		}
+		brq->data.sg_len = i;
+	}
+
+	mmc_queue_bounce_pre(mqrq);
+}
+
+/*
+ * Take the next request off the queue and get it ready to start while
+ * the current one is on the bus, so that mapping and bouncing it does
+ * not add to the gap between the two transfers.
+ */
+static void mmc_blk_prep_next(struct mmc_queue *mq, struct mmc_card *card)
+{
+	struct mmc_queue_req *mqrq = mq->mqrq_next;
+
+	if (!mmc_queue_fetch_next(mq))
+		return;
+
+	/* Discards are issued as they are */
+	if (mqrq->req->cmd_flags & REQ_DISCARD)
+		return;
+
+	mmc_blk_rw_rq_prep(mqrq, card, 0, mq);
+	mmc_pre_req(card->host, &mqrq->brq.mrq, false);
+	mqrq->prepared = 1;
+}
+
+/*
+ * First error of a finished request, for mmc_post_req().
+ */
+static int mmc_blk_rq_error(struct mmc_blk_request *brq)
+{
+	if (brq->cmd.error)
+		return brq->cmd.error;
+	if (brq->data.error)
+		return brq->data.error;
+	return brq->stop.error;
+}
 
+/*
+ * Account a transfer about to start: whether it was prepared while the
+ * one before it was on the bus, and how long the bus sat idle between
+ * the two when the queue did not run dry in between.
+ */
+static void mmc_blk_pipeline_start(struct mmc_queue *mq, int prepared)
+{
+	struct mmc_pipeline_stats *stats = &mq->pipeline_stats;
+	unsigned long gap;
+
+	stats->issued++;
+	if (prepared)
+		stats->prepared++;
+
+	if (!mq->last_done.tv64)
+		return;
+
+	gap = ktime_us_delta(ktime_get(), mq->last_done);
+	stats->gaps++;
+	stats->gap_total_us += gap;
+	if (gap > stats->gap_max_us)
+		stats->gap_max_us = gap;
+	mq->last_done.tv64 = 0;
+}
+
+/*
+ * Wait for the card to finish programming after a write.
+ */
+static int mmc_blk_wait_for_ready(struct mmc_card *card, struct request *req)
+{
+	struct mmc_command cmd;
+	int err;
+
+	do {
+		cmd.opcode = MMC_SEND_STATUS;
+		cmd.arg = card->rca << 16;
+		cmd.flags = MMC_RSP_R1 | MMC_CMD_AC;
+		err = mmc_wait_for_cmd(card->host, &cmd, 5);
+		if (err) {
+			printk(KERN_ERR "%s: error %d requesting status\n",
+			       req->rq_disk->disk_name, err);
+			return err;
+		}
 		/*
-		 * After a read error, we redo the request one sector at a time
-		 * in order to accurately determine which sectors can be read
-		 * successfully.
+		 * Some cards mishandle the status bits,
+		 * so make sure to check both the busy
+		 * indication and the card state.
 		 */
-		if (disable_multi && brq.data.blocks > 1)
-			brq.data.blocks = 1;
-
-		if (brq.data.blocks > 1) {
-			/* SPI multiblock writes terminate using a special
-			 * token, not a STOP_TRANSMISSION request.
-			 */
-			if (!mmc_host_is_spi(card->host)
-					|| rq_data_dir(req) == READ)
-				brq.mrq.stop = &brq.stop;
-			readcmd = MMC_READ_MULTIPLE_BLOCK;
-			writecmd = MMC_WRITE_MULTIPLE_BLOCK;
-		} else {
-			brq.mrq.stop = NULL;
-			readcmd = MMC_READ_SINGLE_BLOCK;
-			writecmd = MMC_WRITE_BLOCK;
+	} while (!(cmd.resp[0] & R1_READY_FOR_DATA) ||
+		(R1_CURRENT_STATE(cmd.resp[0]) == 7));
+
+#if 0
+	if (cmd.resp[0] & ~0x00000900)
+		printk(KERN_ERR "%s: status = %08x\n",
+		       req->rq_disk->disk_name, cmd.resp[0]);
+	if (mmc_decode_status(cmd.resp))
+		return -EIO;
+#endif
+	return 0;
+}
+
+static inline int mmc_blk_packable(struct request *req)
+{
+	return req->cmd_type == REQ_TYPE_FS && rq_data_dir(req) == WRITE &&
+		!(req->cmd_flags & (REQ_DISCARD | REQ_FUA | REQ_HARDBARRIER));
+}
+
+/*
+ * If the card takes packed writes, take the writes queued behind the
+ * current one off the queue to send along with it.  Only whole requests
+ * go into a packed write, so all of them, and the header block, must fit
+ * in one transfer.  Returns the number of requests to pack, the current
+ * one included, or 0 to issue it on its own.
+ */
+static unsigned int mmc_blk_packed_fetch(struct mmc_queue *mq,
+					 struct mmc_queue_req *mqrq)
+{
+	struct mmc_card *card = mq->card;
+	struct mmc_host *host = card->host;
+	struct request_queue *q = mq->queue;
+	struct request *req = mqrq->req, *next;
+	unsigned int max_blocks, max_segs, blocks, segs, nr = 1;
+
+	if (!mqrq->packed_hdr || mq->packed_disabled || !mmc_blk_packable(req))
+		return 0;
+
+	max_blocks = min(host->max_blk_count, host->max_req_size / 512);
+	max_segs = min(host->max_hw_segs, host->max_phys_segs);
+
+	blocks = 1 + blk_rq_sectors(req);
+	segs = 1 + req->nr_phys_segments;
+	if (blocks > max_blocks || segs > max_segs)
+		return 0;
+
+	spin_lock_irq(q->queue_lock);
+	while (nr < card->ext_csd.max_packed_writes && !blk_queue_plugged(q)) {
+		next = blk_peek_request(q);
+		if (!next || !mmc_blk_packable(next))
+			break;
+		if (blocks + blk_rq_sectors(next) > max_blocks ||
+		    segs + next->nr_phys_segments > max_segs)
+			break;
+
+		blk_start_request(next);
+		list_add_tail(&next->queuelist, &mqrq->packed_list);
+		blocks += blk_rq_sectors(next);
+		segs += next->nr_phys_segments;
+		nr++;
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	if (nr == 1)
+		return 0;
+
+	mqrq->packed_nr = nr;
+	mqrq->packed_blocks = blocks;
+	return nr;
+}
+
+static void mmc_blk_packed_rq_prep(struct mmc_queue *mq,
+				   struct mmc_queue_req *mqrq)
+{
+	struct mmc_card *card = mq->card;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req, *prq;
+	u32 *hdr = mqrq->packed_hdr;
+	unsigned int i, sg_len;
+
+	/*
+	 * The header block: version, direction and number of entries, then
+	 * the CMD23 and CMD25 arguments of each request in the order their
+	 * data follows.
+	 */
+	memset(hdr, 0, 512);
+	hdr[0] = cpu_to_le32((mqrq->packed_nr << 16) |
+			     (MMC_PACKED_CMD_WR << 8) | MMC_PACKED_CMD_VER);
+	hdr[2] = cpu_to_le32(blk_rq_sectors(req));
+	hdr[3] = cpu_to_le32(mmc_card_blockaddr(card) ? blk_rq_pos(req) :
+			     blk_rq_pos(req) << 9);
+	i = 2;
+	list_for_each_entry(prq, &mqrq->packed_list, queuelist) {
+		hdr[i * 2] = cpu_to_le32(blk_rq_sectors(prq));
+		hdr[i * 2 + 1] = cpu_to_le32(mmc_card_blockaddr(card) ?
+			blk_rq_pos(prq) : blk_rq_pos(prq) << 9);
+		i++;
+	}
+
+	sg_set_buf(mqrq->sg, hdr, 512);
+	sg_unmark_end(mqrq->sg);
+	sg_len = 1 + blk_rq_map_sg(mq->queue, req, mqrq->sg + 1);
+	list_for_each_entry(prq, &mqrq->packed_list, queuelist) {
+		sg_unmark_end(mqrq->sg + sg_len - 1);
+		sg_len += blk_rq_map_sg(mq->queue, prq, mqrq->sg + sg_len);
+	}
+
+	/* The block count set by CMD23 ends the transfer, no stop */
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+
+	brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->data.blocks = mqrq->packed_blocks;
+	brq->data.flags |= MMC_DATA_WRITE;
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = sg_len;
+}
+
+/*
+ * A packed write that failed part way leaves the card in rcv state,
+ * waiting for the rest of the blocks CMD23 announced.  Stop it and wait
+ * for it to get back to tran before anything else is sent.
+ */
+static int mmc_blk_packed_recover(struct mmc_card *card, struct request *req)
+{
+	struct mmc_command cmd;
+	int retries = 100, state, err;
+
+	do {
+		memset(&cmd, 0, sizeof(struct mmc_command));
+		cmd.opcode = MMC_SEND_STATUS;
+		cmd.arg = card->rca << 16;
+		cmd.flags = MMC_RSP_R1 | MMC_CMD_AC;
+		err = mmc_wait_for_cmd(card->host, &cmd, 5);
+		if (err) {
+			printk(KERN_ERR "%s: error %d requesting status\n",
+			       req->rq_disk->disk_name, err);
+			return err;
 		}
 
-		if (rq_data_dir(req) == READ) {
-			brq.cmd.opcode = readcmd;
-			brq.data.flags |= MMC_DATA_READ;
-		} else {
-			brq.cmd.opcode = writecmd;
-			brq.data.flags |= MMC_DATA_WRITE;
+		state = R1_CURRENT_STATE(cmd.resp[0]);
+		if (state == 4 && (cmd.resp[0] & R1_READY_FOR_DATA))
+			return 0;	/* tran */
+
+		if (state == 5 || state == 6) {
+			/* data or rcv */
+			memset(&cmd, 0, sizeof(struct mmc_command));
+			cmd.opcode = MMC_STOP_TRANSMISSION;
+			cmd.flags = MMC_RSP_R1B | MMC_CMD_AC;
+			err = mmc_wait_for_cmd(card->host, &cmd, 5);
+			if (err) {
+				printk(KERN_ERR "%s: error %d sending stop "
+				       "command\n", req->rq_disk->disk_name,
+				       err);
+				return err;
+			}
+			continue;
 		}
 
-		mmc_set_data_timeout(&brq.data, card);
+		msleep(10);
+	} while (--retries);
+
+	printk(KERN_ERR "%s: card stuck in state %d after packed write\n",
+	       req->rq_disk->disk_name, state);
+	return -ETIMEDOUT;
+}
+
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req);
+
+static int mmc_blk_issue_packed_rq(struct mmc_queue *mq,
+				   struct mmc_queue_req *mqrq)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req, *prq, *tmp;
+	struct mmc_command cmd;
+	struct completion done;
+	int err, ret;
+
+	mmc_claim_host(card->host);
+
+	/* Drop a preparation made for sending req on its own */
+	if (mqrq->prepared) {
+		mmc_post_req(card->host, &brq->mrq, 0);
+		mqrq->prepared = 0;
+	}
+
+	mmc_blk_packed_rq_prep(mq, mqrq);
+
+	memset(&cmd, 0, sizeof(struct mmc_command));
+	cmd.opcode = MMC_SET_BLOCK_COUNT;
+	cmd.arg = MMC_CMD23_ARG_PACKED | mqrq->packed_blocks;
+	cmd.flags = MMC_RSP_R1 | MMC_CMD_AC;
+	err = mmc_wait_for_cmd(card->host, &cmd, 0);
+	if (err)
+		goto fallback;
 
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+	mmc_pre_req(card->host, &brq->mrq, true);
+	init_completion(&done);
+	mmc_blk_pipeline_start(mq, 0);
+	mmc_start_req(card->host, &brq->mrq, &done);
+
+	mmc_blk_prep_next(mq, card);
+
+	wait_for_completion(&done);
+	mq->last_done = ktime_get();
+	err = mmc_blk_rq_error(brq);
+	mmc_post_req(card->host, &brq->mrq, err);
+	if (err) {
+		mmc_blk_packed_recover(card, req);
+		goto fallback;
+	}
+
+	err = mmc_blk_wait_for_ready(card, req);
+	if (err)
+		goto fallback;
+
+	mq->packed_stats.packed++;
+	mq->packed_stats.packed_reqs += mqrq->packed_nr;
+
+	spin_lock_irq(&md->lock);
+	__blk_end_request_all(req, 0);
+	list_for_each_entry_safe(prq, tmp, &mqrq->packed_list, queuelist) {
+		list_del_init(&prq->queuelist);
+		__blk_end_request_all(prq, 0);
+	}
+	spin_unlock_irq(&md->lock);
+
+	mmc_release_host(card->host);
+
+	return 1;
+
+ fallback:
+	/*
+	 * We can't tell which of the packed requests made it, but writing
+	 * them again does no harm: redo each one on its own, and don't pack
+	 * for this card any more.
+	 */
+	printk(KERN_WARNING "%s: packed write failed (%d), "
+	       "falling back to single writes\n",
+	       req->rq_disk->disk_name, err);
+	mq->packed_disabled = 1;
+	mq->packed_stats.fallbacks++;
+
+	mmc_release_host(card->host);
+
+	ret = mmc_blk_issue_rw_rq(mq, req);
+	list_for_each_entry_safe(prq, tmp, &mqrq->packed_list, queuelist) {
+		list_del_init(&prq->queuelist);
+		mqrq->req = prq;
+		mqrq->prepared = 0;
+		if (!mmc_blk_issue_rw_rq(mq, prq))
+			ret = 0;
+	}
+	mqrq->req = req;
+
+	return ret;
+}
+
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct completion done;
+	int ret = 1, disable_multi = 0, prepared;
+
+	if (mmc_blk_packed_fetch(mq, mqrq))
+		return mmc_blk_issue_packed_rq(mq, mqrq);
+
+	if (rq_data_dir(req) == WRITE)
+		mq->packed_stats.single++;
+
+	mmc_claim_host(card->host);
+
+	do {
+		if (mmc_blk_card_removed(card)) {
+			MMC_DBG("No card, stop read or write");
+			if (mqrq->prepared)
+				mmc_post_req(card->host, &brq->mrq, -ENOMEDIUM);
+			goto cmd_err;
+		}
+		u32 status = 0;
 
 		/*
-		 * Adjust the sg list so it is the same size as the
-		 * request.
+		 * The request may have been prepared while the one before
+		 * it was transferred.  Retries are always prepared afresh.
 		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
-			int i, data_size = brq.data.blocks << 9;
-			struct scatterlist *sg;
-
-			for_each_sg(brq.data.sg, sg, brq.data.sg_len, i) {
-				data_size -= sg->length;
-				if (data_size <= 0) {
-					sg->length += data_size;
-					i++;
-					break;
-				}
-			}
-			brq.data.sg_len = i;
+		prepared = mqrq->prepared;
+		if (!prepared) {
+			mmc_blk_rw_rq_prep(mqrq, card, disable_multi, mq);
+			mmc_pre_req(card->host, &brq->mrq, true);
 		}
+		mqrq->prepared = 0;
 
-		mmc_queue_bounce_pre(mq);
-
-		if (mmc_card_sd(card) && gpio_get_value(SD_CARD_DETECT) == 1)
+		if (mmc_blk_card_removed(card)) {
+			mmc_post_req(card->host, &brq->mrq, -ENOMEDIUM);
 			goto cmd_err;
+		}
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+		init_completion(&done);
+		mmc_blk_pipeline_start(mq, prepared);
+		mmc_start_req(card->host, &brq->mrq, &done);
 
-		mmc_queue_bounce_post(mq);
+		mmc_blk_prep_next(mq, card);
+
+		wait_for_completion(&done);
+		mq->last_done = ktime_get();
+		mmc_post_req(card->host, &brq->mrq, mmc_blk_rq_error(brq));
+
+		mmc_queue_bounce_post(mqrq);
 
 		/*
 		 * Check for errors here, but don't jump to cmd_err
 		 * until later as we need to wait for the card to leave
 		 * programming mode even when things go wrong.
 		 */
-		if (brq.cmd.error || brq.data.error || brq.stop.error) {
+		if (brq->cmd.error || brq->data.error || brq->stop.error) {
 			MMC_DBG("%s:cmd_type %d, clock %uHZ, Vdd %u, powermode %u", mmc_hostname(card->host), rq_data_dir(req), (card->host->ios).clock, (card->host->ios).vdd, (card->host->ios).power_mode);
 
-			if (brq.data.blocks > 1 && rq_data_dir(req) == READ) {
+			if (brq->data.blocks > 1 && rq_data_dir(req) == READ) {
 				/* Redo read one sector at a time */
 				printk(KERN_WARNING "%s: retrying using single "
 				       "block read\n", req->rq_disk->disk_name);
 				disable_multi = 1;
 				continue;
 			}
-			if (mmc_card_sd(card) && gpio_get_value(SD_CARD_DETECT) == 1)
+			if (mmc_blk_card_removed(card))
 				goto cmd_err;
 			status = get_card_status(card, req);
 		} else if (disable_multi == 1) {
 			disable_multi = 0;
 		}
 
-		if (brq.cmd.error) {
+		if (brq->cmd.error) {
 			printk(KERN_ERR "%s: error %d sending read/write "
 			       "command, response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.cmd.error,
-			       brq.cmd.resp[0], status);
+			       req->rq_disk->disk_name, brq->cmd.error,
+			       brq->cmd.resp[0], status);
 		}
 
-		if (brq.data.error) {
-			if (brq.data.error == -ETIMEDOUT && brq.mrq.stop)
+		if (brq->data.error) {
+			if (brq->data.error == -ETIMEDOUT && brq->mrq.stop)
 				/* 'Stop' response contains card status */
-				status = brq.mrq.stop->resp[0];
+				status = brq->mrq.stop->resp[0];
 			printk(KERN_ERR "%s: error %d transferring data,"
 			       " sector %u, nr %u, card status %#x\n",
-			       req->rq_disk->disk_name, brq.data.error,
+			       req->rq_disk->disk_name, brq->data.error,
 			       (unsigned)blk_rq_pos(req),
 			       (unsigned)blk_rq_sectors(req), status);
 		}
 
-		if (brq.stop.error) {
+		if (brq->stop.error) {
 			printk(KERN_ERR "%s: error %d sending stop command, "
 			       "response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.stop.error,
-			       brq.stop.resp[0], status);
+			       req->rq_disk->disk_name, brq->stop.error,
+			       brq->stop.resp[0], status);
 		}
 
 		if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
-			do {
-				int err;
-
-				cmd.opcode = MMC_SEND_STATUS;
-				cmd.arg = card->rca << 16;
-				cmd.flags = MMC_RSP_R1 | MMC_CMD_AC;
-				err = mmc_wait_for_cmd(card->host, &cmd, 5);
-				if (err) {
-					printk(KERN_ERR "%s: error %d requesting status\n",
-					       req->rq_disk->disk_name, err);
-					goto cmd_err;
-				}
-				/*
-				 * Some cards mishandle the status bits,
-				 * so make sure to check both the busy
-				 * indication and the card state.
-				 */
-			} while (!(cmd.resp[0] & R1_READY_FOR_DATA) ||
-				(R1_CURRENT_STATE(cmd.resp[0]) == 7));
-
-#if 0
-			if (cmd.resp[0] & ~0x00000900)
-				printk(KERN_ERR "%s: status = %08x\n",
-				       req->rq_disk->disk_name, cmd.resp[0]);
-			if (mmc_decode_status(cmd.resp))
+			if (mmc_blk_wait_for_ready(card, req))
 				goto cmd_err;
-#endif
 		}
 
-		if (brq.cmd.error || brq.stop.error || brq.data.error) {
+		if (brq->cmd.error || brq->stop.error || brq->data.error) {
 			if (rq_data_dir(req) == READ) {
 				/*
 				 * After an error, we redo I/O one sector at a
@@ -531,7 +907,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 				 * read a single sector.
 				 */
 				spin_lock_irq(&md->lock);
-				ret = __blk_end_request(req, -EIO, brq.data.blksz);
+				ret = __blk_end_request(req, -EIO, brq->data.blksz);
 				spin_unlock_irq(&md->lock);
 				continue;
 			}
@@ -542,7 +918,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		 * A block was successfully transferred.
 		 */
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	} while (ret);
 
@@ -570,7 +946,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		}
 	} else {
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	}
 
@@ -736,6 +1112,69 @@ static const struct mmc_fixup blk_fixups[] =
 	END_FIXUP
 };
 
+/*
+ * Packed write accounting: packed writes issued, requests sent in them,
+ * writes issued on their own and packed writes that had to be redone
+ * one request at a time.  Writing anything resets the counters.
+ */
+static ssize_t mmc_blk_packed_stats_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct mmc_blk_data *md = dev_to_disk(dev)->private_data;
+	struct mmc_packed_stats *stats = &md->queue.packed_stats;
+
+	return sprintf(buf, "%lu %lu %lu %lu\n", stats->packed,
+		       stats->packed_reqs, stats->single, stats->fallbacks);
+}
+
+static ssize_t mmc_blk_packed_stats_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct mmc_blk_data *md = dev_to_disk(dev)->private_data;
+
+	memset(&md->queue.packed_stats, 0, sizeof(struct mmc_packed_stats));
+	return count;
+}
+
+static DEVICE_ATTR(packed_stats, S_IRUGO | S_IWUSR,
+		   mmc_blk_packed_stats_show, mmc_blk_packed_stats_store);
+
+/*
+ * Request pipelining: transfers started, how many of them were prepared
+ * while the one before was on the bus, and the average and worst idle
+ * time between back-to-back transfers in microseconds.  Writing
+ * anything resets the counters.
+ */
+static ssize_t mmc_blk_pipeline_stats_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct mmc_blk_data *md = dev_to_disk(dev)->private_data;
+	struct mmc_pipeline_stats *stats = &md->queue.pipeline_stats;
+	unsigned long gaps = stats->gaps;
+
+	return sprintf(buf, "%lu %lu %lu %lu\n", stats->issued,
+		       stats->prepared,
+		       gaps ? stats->gap_total_us / gaps : 0,
+		       stats->gap_max_us);
+}
+
+static ssize_t mmc_blk_pipeline_stats_store(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct mmc_blk_data *md = dev_to_disk(dev)->private_data;
+
+	memset(&md->queue.pipeline_stats, 0,
+	       sizeof(struct mmc_pipeline_stats));
+	return count;
+}
+
+static DEVICE_ATTR(pipeline_stats, S_IRUGO | S_IWUSR,
+		   mmc_blk_pipeline_stats_show, mmc_blk_pipeline_stats_store);
+
 static int mmc_blk_probe(struct mmc_card *card)
 {
 	struct mmc_blk_data *md;
@@ -772,6 +1211,14 @@ static int mmc_blk_probe(struct mmc_card *card)
 #endif
 	MMC_printk("%s: bus_resume_flags %x", mmc_hostname(card->host), card->host->bus_resume_flags);
 	add_disk(md->disk);
+
+	if (md->queue.mqrq_cur->packed_hdr &&
+	    device_create_file(disk_to_dev(md->disk), &dev_attr_packed_stats))
+		printk(KERN_WARNING "%s: unable to create packed_stats\n",
+		       md->disk->disk_name);
+	if (device_create_file(disk_to_dev(md->disk), &dev_attr_pipeline_stats))
+		printk(KERN_WARNING "%s: unable to create pipeline_stats\n",
+		       md->disk->disk_name);
 	return 0;
 
  out:
@@ -786,6 +1233,12 @@ static void mmc_blk_remove(struct mmc_card *card)
 	struct mmc_blk_data *md = mmc_get_drvdata(card);
 
 	if (md) {
+		if (md->queue.mqrq_cur->packed_hdr)
+			device_remove_file(disk_to_dev(md->disk),
+					   &dev_attr_packed_stats);
+		device_remove_file(disk_to_dev(md->disk),
+				   &dev_attr_pipeline_stats);
+
 		/* Stop new requests from getting into the queue */
 		del_gendisk(md->disk);
 
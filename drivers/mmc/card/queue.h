@@ -4,6 +4,48 @@
 struct request;
 struct task_struct;
 
+struct mmc_blk_request {
+	struct mmc_request	mrq;
+	struct mmc_command	cmd;
+	struct mmc_command	stop;
+	struct mmc_data		data;
+};
+
+/*
+ * Everything needed to issue one block request.  There are two of these
+ * so that the next request can be mapped and bounced while the current
+ * one is on the bus.
+ */
+struct mmc_queue_req {
+	struct request		*req;
+	struct mmc_blk_request	brq;
+	struct scatterlist	*sg;
+	char			*bounce_buf;
+	struct scatterlist	*bounce_sg;
+	unsigned int		bounce_sg_len;
+	int			prepared;	/* brq is ready to start */
+	/* packed write of req and the requests on packed_list */
+	u32			*packed_hdr;
+	struct list_head	packed_list;
+	unsigned int		packed_nr;	/* requests, req included */
+	unsigned int		packed_blocks;	/* header included */
+};
+
+struct mmc_packed_stats {
+	unsigned long		packed;		/* packed writes issued */
+	unsigned long		packed_reqs;	/* requests sent in them */
+	unsigned long		single;		/* writes issued on their own */
+	unsigned long		fallbacks;	/* packed writes redone singly */
+};
+
+struct mmc_pipeline_stats {
+	unsigned long		issued;		/* transfers started */
+	unsigned long		prepared;	/* ... prepared ahead of time */
+	unsigned long		gaps;		/* back-to-back transfers */
+	unsigned long		gap_total_us;	/* idle bus time between them */
+	unsigned long		gap_max_us;
+};
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
@@ -13,10 +55,13 @@ struct mmc_queue {
 	int			(*issue_fn)(struct mmc_queue *, struct request *);
 	void			*data;
 	struct request_queue	*queue;
-	struct scatterlist	*sg;
-	char			*bounce_buf;
-	struct scatterlist	*bounce_sg;
-	unsigned int		bounce_sg_len;
+	struct mmc_queue_req	mqrq[2];
+	struct mmc_queue_req	*mqrq_cur;	/* request being issued */
+	struct mmc_queue_req	*mqrq_next;	/* request fetched ahead */
+	int			packed_disabled;
+	struct mmc_packed_stats	packed_stats;
+	struct mmc_pipeline_stats pipeline_stats;
+	ktime_t			last_done;	/* 0 once the queue went idle */
 };
 
 struct mmc_blk_data {
@@ -33,8 +78,10 @@ extern void mmc_cleanup_queue(struct mmc_queue *);
 extern void mmc_queue_suspend(struct mmc_queue *);
 extern void mmc_queue_resume(struct mmc_queue *);
 
-extern unsigned int mmc_queue_map_sg(struct mmc_queue *);
-extern void mmc_queue_bounce_pre(struct mmc_queue *);
-extern void mmc_queue_bounce_post(struct mmc_queue *);
+extern struct request *mmc_queue_fetch_next(struct mmc_queue *);
+extern unsigned int mmc_queue_map_sg(struct mmc_queue *,
+				     struct mmc_queue_req *);
+extern void mmc_queue_bounce_pre(struct mmc_queue_req *);
+extern void mmc_queue_bounce_post(struct mmc_queue_req *);
 
 #endif
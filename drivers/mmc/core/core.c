@@ -217,29 +217,78 @@ static void mmc_wait_done(struct mmc_request *mrq)
 }
 
 /**
- *	mmc_wait_for_req - start a request and wait for completion
+ *	mmc_pre_req - prepare a request ahead of starting it
+ *	@host: MMC host the request will be started on
+ *	@mrq: MMC request to prepare
+ *	@is_first_req: true if no other request is in flight
+ *
+ *	Give the host driver the chance to prepare @mrq, e.g. DMA map
+ *	its data, while the previous request is still being transferred.
+ *	Every mmc_pre_req() must be followed by mmc_post_req() once the
+ *	request is done with.
+ */
+void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq,
+		 bool is_first_req)
+{
+	if (host->ops->pre_req)
+		host->ops->pre_req(host, mrq, is_first_req);
+}
+EXPORT_SYMBOL(mmc_pre_req);
+
+/**
+ *	mmc_post_req - undo mmc_pre_req once a request is done
+ *	@host: MMC host the request was started on
+ *	@mrq: MMC request that completed
+ *	@err: error, if any, the request completed with
+ */
+void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq, int err)
+{
+	if (host->ops->post_req)
+		host->ops->post_req(host, mrq, err);
+}
+EXPORT_SYMBOL(mmc_post_req);
+
+/**
+ *	mmc_start_req - start a request without waiting for it
  *	@host: MMC host to start command
  *	@mrq: MMC request to start
+ *	@done: completion to signal when the request is done
  *
- *	Start a new MMC custom command request for a host, and wait
- *	for the command to complete. Does not attempt to parse the
- *	response.
+ *	Start a new MMC request for a host and return at once.  The
+ *	caller can prepare its next request before waiting on @done.
  */
-void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
+void mmc_start_req(struct mmc_host *host, struct mmc_request *mrq,
+		   struct completion *done)
 {
-	DECLARE_COMPLETION_ONSTACK(complete);
-
-	mrq->done_data = &complete;
+	mrq->done_data = done;
 	mrq->done = mmc_wait_done;
 	host->opcode = mrq->cmd->opcode;
 
 	if (!strcmp(mmc_hostname(host), SDHOST_STRING) && gpio_get_value(SD_CARD_DETECT) == 1) {
 		MMC_DBG("%s:removed, CMD%u stop", mmc_hostname(host), mrq->cmd->opcode);
 		mrq->cmd->error = -ENOMEDIUM;
+		complete(done);
 		return;
 	}
 
 	mmc_start_request(host, mrq);
+}
+EXPORT_SYMBOL(mmc_start_req);
+
+/**
+ *	mmc_wait_for_req - start a request and wait for completion
+ *	@host: MMC host to start command
+ *	@mrq: MMC request to start
+ *
+ *	Start a new MMC custom command request for a host, and wait
+ *	for the command to complete. Does not attempt to parse the
+ *	response.
+ */
+void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+	DECLARE_COMPLETION_ONSTACK(complete);
+
+	mmc_start_req(host, mrq, &complete);
 
 	wait_for_completion(&complete);
 }
@@ -1494,7 +1543,7 @@ void mmc_rescan(struct work_struct *work)
 	int extend_wakelock = 0;
 
        if(host != NULL)
-              MMC_printk("%s: gpio_%d:%d, rescan_disable %d bus_resume_flags %d card_present %d", mmc_hostname(host), SD_CARD_DETECT, gpio_get_value(SD_CARD_DETECT), host->rescan_disable, host->bus_resume_flags, ((struct tegra_sdhci_host *)sdhci_priv(mmc_priv(host)))->card_present);
+              MMC_printk("%s: gpio_%d:%d, rescan_disable %d bus_resume_flags %d", mmc_hostname(host), SD_CARD_DETECT, gpio_get_value(SD_CARD_DETECT), host->rescan_disable, host->bus_resume_flags);
 
 	spin_lock_irqsave(&host->lock, flags);
 
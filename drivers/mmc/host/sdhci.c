@@ -441,8 +441,12 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 		goto fail;
 	BUG_ON(host->align_addr & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
+	/* sdhci_pre_req() may have mapped the data already */
+	if (data->host_cookie)
+		host->sg_count = data->host_cookie;
+	else
+		host->sg_count = dma_map_sg(mmc_dev(host->mmc),
+			data->sg, data->sg_len, direction);
 	if (host->sg_count == 0)
 		goto unmap_align;
 
@@ -532,8 +536,10 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	return 0;
 
 unmap_entries:
+	/* The caller falls back to PIO, so the data must not stay mapped */
 	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 		data->sg_len, direction);
+	data->host_cookie = 0;
 unmap_align:
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
 		128 * 4, direction);
@@ -583,8 +589,9 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_data *data)
@@ -647,6 +654,74 @@ static void sdhci_set_transfer_irqs(struct sdhci_host *host)
 		sdhci_clear_set_irqs(host, dma_irqs, pio_irqs);
 }
 
+/*
+ * Whether the data can be transferred by DMA given the host's quirks.
+ * Shared by sdhci_prepare_data() and sdhci_pre_req() so that data is
+ * never premapped for a transfer that would then fall back to PIO.
+ */
+static int sdhci_data_can_dma(struct sdhci_host *host, struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	int broken, i;
+
+	if (!(host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)))
+		return 0;
+
+	/*
+	 * FIXME: This doesn't account for merging when mapping the
+	 * scatterlist.
+	 */
+	broken = 0;
+	if (host->flags & SDHCI_USE_ADMA) {
+		if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
+			broken = 1;
+	} else {
+		if (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)
+			broken = 1;
+	}
+
+	if (unlikely(broken)) {
+		for_each_sg(data->sg, sg, data->sg_len, i) {
+			if (sg->length & 0x3) {
+				DBG("Reverting to PIO because of "
+					"transfer size (%d)\n",
+					sg->length);
+				return 0;
+			}
+		}
+	}
+
+	/*
+	 * The assumption here being that alignment is the same after
+	 * translation to device address space.
+	 */
+	broken = 0;
+	if (host->flags & SDHCI_USE_ADMA) {
+		/*
+		 * As we use 3 byte chunks to work around
+		 * alignment problems, we need to check this
+		 * quirk.
+		 */
+		if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
+			broken = 1;
+	} else {
+		if (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)
+			broken = 1;
+	}
+
+	if (unlikely(broken)) {
+		for_each_sg(data->sg, sg, data->sg_len, i) {
+			if (sg->offset & 0x3) {
+				DBG("Reverting to PIO because of "
+					"bad alignment\n");
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
 static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 {
 	u8 count;
@@ -669,72 +744,10 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 	count = sdhci_calc_timeout(host, data);
 	sdhci_writeb(host, count, SDHCI_TIMEOUT_CONTROL);
 
-	if (host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA))
+	if (sdhci_data_can_dma(host, data))
 		host->flags |= SDHCI_REQ_USE_DMA;
-
-	/*
-	 * FIXME: This doesn't account for merging when mapping the
-	 * scatterlist.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->length & 0x3) {
-					DBG("Reverting to PIO because of "
-						"transfer size (%d)\n",
-						sg->length);
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
-
-	/*
-	 * The assumption here being that alignment is the same after
-	 * translation to device address space.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			/*
-			 * As we use 3 byte chunks to work around
-			 * alignment problems, we need to check this
-			 * quirk.
-			 */
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->offset & 0x3) {
-					DBG("Reverting to PIO because of "
-						"bad alignment\n");
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
+	else
+		host->flags &= ~SDHCI_REQ_USE_DMA;
 
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA) {
@@ -753,7 +766,10 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 		} else {
 			int sg_cnt;
 
-			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
+			if (data->host_cookie)
+				sg_cnt = data->host_cookie;
+			else
+				sg_cnt = dma_map_sg(mmc_dev(host->mmc),
 					data->sg, data->sg_len,
 					(data->flags & MMC_DATA_READ) ?
 						DMA_FROM_DEVICE :
@@ -845,7 +861,7 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
+		else if (!data->host_cookie) {
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 				data->sg_len, (data->flags & MMC_DATA_READ) ?
 					DMA_FROM_DEVICE : DMA_TO_DEVICE);
@@ -1100,6 +1116,41 @@ static void sdhci_set_power(struct sdhci_host *host, unsigned short power)
  *                                                                           *
 \*****************************************************************************/
 
+/*
+ * Map the data for DMA while the previous request is still on the bus.
+ * host_cookie holds the number of mapped entries, 0 if not premapped.
+ */
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+	bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || data->host_cookie)
+		return;
+
+	if (!sdhci_data_can_dma(host, data))
+		return;
+
+	data->host_cookie = dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		(data->flags & MMC_DATA_READ) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+	int err)
+{
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		(data->flags & MMC_DATA_READ) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	data->host_cookie = 0;
+}
+
 static void sdhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 {
 	struct sdhci_host *host;
@@ -1291,6 +1342,8 @@ int sdhci_disable(struct mmc_host *mmc, int lazy)
 }
 
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.request	= sdhci_request,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
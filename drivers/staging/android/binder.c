@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -28,6 +29,7 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
@@ -35,9 +37,29 @@
 #include <linux/vmalloc.h>
 
 #include "binder.h"
+#include "binder_trace.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * binder_lock is taken for reading by every binder call and for writing
+ * only to free threads and procs, to set the context manager and to dump
+ * state. A reader may use any proc or thread it reaches, and node->proc,
+ * without taking further locks to keep them alive.
+ *
+ * Everything else is protected per proc:
+ *  - refs_lock: refs_by_desc, refs_by_node and the refs in them.
+ *  - buffer_lock: the buffer allocator and the binder_buffers.
+ *  - lock: the todo lists, threads, looper counts, transaction stacks and
+ *    return errors of the threads, and the proc's nodes. Nodes of dead
+ *    procs are protected by binder_dead_nodes_lock instead; see
+ *    binder_node_lock().
+ * refs_lock nests outside lock and binder_dead_nodes_lock; buffer_lock
+ * nests outside mmap_sem. No two locks of the same kind are ever held.
+ */
+static DECLARE_RWSEM(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_MUTEX(binder_procs_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -47,7 +69,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -80,6 +102,17 @@ BINDER_DEBUG_ENTRY(proc);
 
 #define BINDER_SMALL_BUF_SIZE (PAGE_SIZE * 64)
 
+/*
+ * Small buffers are rounded up to a power of two size class, from
+ * BINDER_MIN_CLASS_SIZE up, and kept on a per class cache when freed so
+ * that the next buffer of that class needs neither the free tree nor
+ * new pages.
+ */
+#define BINDER_MIN_CLASS_SIZE	64
+#define BINDER_SIZE_CLASSES	6
+#define BINDER_MAX_CLASS_SIZE	(BINDER_MIN_CLASS_SIZE << (BINDER_SIZE_CLASSES - 1))
+#define BINDER_CACHED_BUFFERS	4
+
 enum {
 	BINDER_DEBUG_USER_ERROR             = 1U << 0,
 	BINDER_DEBUG_FAILED_TRANSACTION     = 1U << 1,
@@ -105,6 +138,11 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/* freed buffer pages each proc keeps mapped for reuse */
+static int binder_max_retained_pages = 8;
+module_param_named(max_retained_pages, binder_max_retained_pages, int,
+		   S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -146,22 +184,22 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -188,6 +226,8 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -195,6 +235,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -210,6 +251,28 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * Latency histogram in microseconds, bucket i counts latencies below
+ * 1 << i us, the last bucket everything slower.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+struct binder_latency_hist {
+	unsigned long count[BINDER_LATENCY_BUCKETS];
+	s64 max_us;
+};
+
+static void binder_latency_add(struct binder_latency_hist *hist, s64 us)
+{
+	int i = 0;
+
+	while (i < BINDER_LATENCY_BUCKETS - 1 && us >= (1LL << i))
+		i++;
+	hist->count[i]++;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -231,7 +294,10 @@ struct binder_node {
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
+	int tmp_refs;	/* held across unlocked use, see binder_get_node() */
 	struct list_head async_todo;
+	struct binder_latency_hist queue_latency;
+	struct binder_latency_hist handler_latency;
 };
 
 struct binder_ref_death {
@@ -302,6 +368,14 @@ struct binder_proc {
 	struct page **pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	struct binder_buffer *cached_buffers[BINDER_SIZE_CLASSES]
+					    [BINDER_CACHED_BUFFERS];
+	int cached_buffer_count[BINDER_SIZE_CLASSES];
+	int pages_retained;
+	unsigned long pages_mapped;	/* page range churn */
+	unsigned long pages_unmapped;
+	unsigned long pages_reused;
+	unsigned long buffer_cache_hits;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
@@ -312,6 +386,13 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	struct mutex refs_lock;
+	struct mutex buffer_lock;
+	spinlock_t lock;
+	/* send to wakeup, wakeup to reply, and send to reply of own calls */
+	struct binder_latency_hist queue_latency;
+	struct binder_latency_hist handler_latency;
+	struct binder_latency_hist reply_latency;
 };
 
 enum {
@@ -355,6 +436,9 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	send_time;
+	ktime_t	wakeup_time;	/* when the target thread picked it up */
+	ktime_t	call_time;	/* send_time of the call a reply answers */
 };
 
 static void
@@ -621,6 +705,31 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
 		     allocate ? "allocate" : "free", start, end);
 
+	/*
+	 * Freed pages are kept mapped, up to binder_max_retained_pages, and
+	 * picked up again here when a buffer needs them.
+	 */
+	if (allocate) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			if (!proc->pages[(page_addr - proc->buffer) / PAGE_SIZE])
+				break;
+		if (page_addr >= end) {
+			/* all retained, no need for mmap_sem */
+			for (page_addr = start; page_addr < end;
+			     page_addr += PAGE_SIZE) {
+				proc->pages_retained--;
+				proc->pages_reused++;
+			}
+			return 0;
+		}
+	} else {
+		while (start < end &&
+		       proc->pages_retained < binder_max_retained_pages) {
+			proc->pages_retained++;
+			start += PAGE_SIZE;
+		}
+	}
+
 	if (end <= start)
 		return 0;
 
@@ -648,7 +757,11 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
+		if (*page) {
+			proc->pages_retained--;
+			proc->pages_reused++;
+			continue;
+		}
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -675,6 +788,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
+		proc->pages_mapped++;
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -686,6 +800,7 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		proc->pages_unmapped++;
 		if (vma)
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
@@ -705,17 +820,51 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static int binder_buffer_size_class(size_t size)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
+	int size_class = 0;
+
+	if (size > BINDER_MAX_CLASS_SIZE)
+		return -1;
+	while ((BINDER_MIN_CLASS_SIZE << size_class) < size)
+		size_class++;
+	return size_class;
+}
+
+static void binder_return_buffer(struct binder_proc *proc,
+				 struct binder_buffer *buffer);
+
+/* Gives the cached buffers back to the free tree, returns how many */
+static int binder_flush_buffer_cache(struct binder_proc *proc)
+{
+	int size_class;
+	int count = 0;
+
+	for (size_class = 0; size_class < BINDER_SIZE_CLASSES; size_class++) {
+		while (proc->cached_buffer_count[size_class]) {
+			int i = --proc->cached_buffer_count[size_class];
+
+			binder_return_buffer(proc,
+				proc->cached_buffers[size_class][i]);
+			count++;
+		}
+	}
+	return count;
+}
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
+{
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
+	struct rb_node *best_fit;
 	void *has_page_addr;
 	void *end_page_addr;
-	size_t size;
+	size_t size, alloc_size;
+	int size_class;
 
 	if (proc->vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
@@ -740,15 +889,34 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	size_class = binder_buffer_size_class(size);
+	if (size_class >= 0) {
+		alloc_size = BINDER_MIN_CLASS_SIZE << size_class;
+		if (proc->cached_buffer_count[size_class]) {
+			int i = --proc->cached_buffer_count[size_class];
+
+			buffer = proc->cached_buffers[size_class][i];
+			proc->buffer_cache_hits++;
+			binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+				     "binder: %d: binder_alloc_buf size %zd "
+				     "got cached %p\n", proc->pid, size, buffer);
+			goto got_buffer;
+		}
+	} else
+		alloc_size = size;
+
+retry:
+	n = proc->free_buffers.rb_node;
+	best_fit = NULL;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
 		buffer_size = binder_buffer_size(proc, buffer);
 
-		if (size < buffer_size) {
+		if (alloc_size < buffer_size) {
 			best_fit = n;
 			n = n->rb_left;
-		} else if (size > buffer_size)
+		} else if (alloc_size > buffer_size)
 			n = n->rb_right;
 		else {
 			best_fit = n;
@@ -756,6 +924,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		}
 	}
 	if (best_fit == NULL) {
+		if (binder_flush_buffer_cache(proc))
+			goto retry;
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
@@ -767,15 +937,16 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
-		     "er %p size %zd\n", proc->pid, size, buffer, buffer_size);
+		     "er %p size %zd\n", proc->pid, alloc_size, buffer,
+		     buffer_size);
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
 	if (n == NULL) {
-		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
-			buffer_size = size; /* no room for other buffers */
+		if (alloc_size + sizeof(struct binder_buffer) + 4 >= buffer_size)
+			buffer_size = alloc_size; /* no room for other buffers */
 		else
-			buffer_size = size + sizeof(struct binder_buffer);
+			buffer_size = alloc_size + sizeof(struct binder_buffer);
 	}
 	end_page_addr =
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
@@ -787,16 +958,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
-	binder_insert_allocated_buffer(proc, buffer);
-	if (buffer_size != size) {
-		struct binder_buffer *new_buffer = (void *)buffer->data + size;
+	if (buffer_size != alloc_size) {
+		struct binder_buffer *new_buffer = (void *)buffer->data +
+						   alloc_size;
 		list_add(&new_buffer->entry, &buffer->entry);
 		new_buffer->free = 1;
 		binder_insert_free_buffer(proc, new_buffer);
 	}
+got_buffer:
+	binder_insert_allocated_buffer(proc, buffer);
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
+	buffer->allow_user_free = 0;
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
@@ -811,6 +985,18 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->buffer_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	mutex_unlock(&proc->buffer_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -868,8 +1054,58 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+/* Returns an unused buffer's space and pages to the free tree */
+static void binder_return_buffer(struct binder_proc *proc,
+				 struct binder_buffer *buffer)
+{
+	size_t buffer_size = binder_buffer_size(proc, buffer);
+
+	binder_update_page_range(proc, 0,
+		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
+		NULL);
+	buffer->free = 1;
+	if (!list_is_last(&buffer->entry, &proc->buffers)) {
+		struct binder_buffer *next = list_entry(buffer->entry.next,
+						struct binder_buffer, entry);
+		if (next->free) {
+			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_delete_free_buffer(proc, next);
+		}
+	}
+	if (proc->buffers.next != &buffer->entry) {
+		struct binder_buffer *prev = list_entry(buffer->entry.prev,
+						struct binder_buffer, entry);
+		if (prev->free) {
+			binder_delete_free_buffer(proc, buffer);
+			rb_erase(&prev->rb_node, &proc->free_buffers);
+			buffer = prev;
+		}
+	}
+	binder_insert_free_buffer(proc, buffer);
+}
+
+/* Keeps a freed small buffer for reuse, returns 0 if it should go back */
+static int binder_cache_buffer(struct binder_proc *proc,
+			       struct binder_buffer *buffer, size_t buffer_size)
+{
+	int size_class;
+
+	if (buffer_size < BINDER_MIN_CLASS_SIZE ||
+	    buffer_size >= 2 * BINDER_MAX_CLASS_SIZE)
+		return 0;
+	size_class = BINDER_SIZE_CLASSES - 1;
+	while ((BINDER_MIN_CLASS_SIZE << size_class) > buffer_size)
+		size_class--;
+	if (proc->cached_buffer_count[size_class] == BINDER_CACHED_BUFFERS)
+		return 0;
+	proc->cached_buffers[size_class]
+			    [proc->cached_buffer_count[size_class]++] = buffer;
+	return 1;
+}
+
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -895,36 +1131,40 @@ static void binder_free_buf(struct binder_proc *proc,
 			     "binder: %d: binder_free_buf size %zd "
 			     "async free %zd\n", proc->pid, size,
 			     proc->free_async_space);
+		buffer->async_transaction = 0;
 	}
 
-	binder_update_page_range(proc, 0,
-		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
-	buffer->free = 1;
-	if (!list_is_last(&buffer->entry, &proc->buffers)) {
-		struct binder_buffer *next = list_entry(buffer->entry.next,
-						struct binder_buffer, entry);
-		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
-			binder_delete_free_buffer(proc, next);
-		}
-	}
-	if (proc->buffers.next != &buffer->entry) {
-		struct binder_buffer *prev = list_entry(buffer->entry.prev,
-						struct binder_buffer, entry);
-		if (prev->free) {
-			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
-			buffer = prev;
-		}
-	}
-	binder_insert_free_buffer(proc, buffer);
+	if (!binder_cache_buffer(proc, buffer, buffer_size))
+		binder_return_buffer(proc, buffer);
 }
 
-static struct binder_node *binder_get_node(struct binder_proc *proc,
-					   void __user *ptr)
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->buffer_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->buffer_lock);
+}
+
+static void binder_node_lock(struct binder_node *node)
+{
+	if (node->proc)
+		spin_lock(&node->proc->lock);
+	else
+		spin_lock(&binder_dead_nodes_lock);
+}
+
+static void binder_node_unlock(struct binder_node *node)
+{
+	if (node->proc)
+		spin_unlock(&node->proc->lock);
+	else
+		spin_unlock(&binder_dead_nodes_lock);
+}
+
+static struct binder_node *__binder_get_node(struct binder_proc *proc,
+					     void __user *ptr)
 {
 	struct rb_node *n = proc->nodes.rb_node;
 	struct binder_node *node;
@@ -942,14 +1182,38 @@ static struct binder_node *binder_get_node(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * Nodes returned by binder_get_node() and binder_new_node() hold a
+ * temporary reference so that they cannot be freed once proc->lock is
+ * dropped. Release it with binder_dec_node_tmpref().
+ */
+static struct binder_node *binder_get_node(struct binder_proc *proc,
+					   void __user *ptr)
+{
+	struct binder_node *node;
+
+	spin_lock(&proc->lock);
+	node = __binder_get_node(proc, ptr);
+	if (node)
+		node->tmp_refs++;
+	spin_unlock(&proc->lock);
+	return node;
+}
+
 static struct binder_node *binder_new_node(struct binder_proc *proc,
 					   void __user *ptr,
-					   void __user *cookie)
+					   void __user *cookie,
+					   unsigned long flags)
 {
 	struct rb_node **p = &proc->nodes.rb_node;
 	struct rb_node *parent = NULL;
-	struct binder_node *node;
+	struct binder_node *node, *new_node;
+
+	new_node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (new_node == NULL)
+		return NULL;
 
+	spin_lock(&proc->lock);
 	while (*p) {
 		parent = *p;
 		node = rb_entry(parent, struct binder_node, rb_node);
@@ -958,23 +1222,29 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 			p = &(*p)->rb_left;
 		else if (ptr > node->ptr)
 			p = &(*p)->rb_right;
-		else
-			return NULL;
+		else {
+			/* lost a race with another thread of this proc */
+			node->tmp_refs++;
+			spin_unlock(&proc->lock);
+			kfree(new_node);
+			return node;
+		}
 	}
-
-	node = kzalloc(sizeof(*node), GFP_KERNEL);
-	if (node == NULL)
-		return NULL;
-	binder_stats_created(BINDER_STAT_NODE);
+	node = new_node;
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
+	node->min_priority = flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+	node->accept_fds = !!(flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
+	node->tmp_refs = 1;
 	node->work.type = BINDER_WORK_NODE;
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
+	spin_unlock(&proc->lock);
+	binder_stats_created(BINDER_STAT_NODE);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d:%d node %d u%p c%p created\n",
 		     proc->pid, current->pid, node->debug_id,
@@ -985,6 +1255,9 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			   struct list_head *target_list)
 {
+	int ret = 0;
+
+	binder_node_lock(node);
 	if (strong) {
 		if (internal) {
 			if (target_list == NULL &&
@@ -993,7 +1266,8 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			    node->has_strong_ref)) {
 				printk(KERN_ERR "binder: invalid inc strong "
 					"node for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			node->internal_strong_refs++;
 		} else
@@ -1009,15 +1283,20 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			if (target_list == NULL) {
 				printk(KERN_ERR "binder: invalid inc weak node "
 					"for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			list_add_tail(&node->work.entry, target_list);
 		}
 	}
-	return 0;
+out:
+	binder_node_unlock(node);
+	return ret;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+/* Called with the node lock held; may free the node */
+static int __binder_dec_node(struct binder_node *node, int strong,
+			     int internal)
 {
 	if (strong) {
 		if (internal)
@@ -1039,7 +1318,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 		}
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
-		    !node->local_weak_refs) {
+		    !node->local_weak_refs && !node->tmp_refs) {
 			list_del_init(&node->work.entry);
 			if (node->proc) {
 				rb_erase(&node->rb_node, &node->proc->nodes);
@@ -1060,7 +1339,40 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	return 0;
 }
 
+static int binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	spinlock_t *lock;
+	int ret;
+
+	/* the node may be gone after __binder_dec_node() */
+	lock = node->proc ? &node->proc->lock : &binder_dead_nodes_lock;
+	spin_lock(lock);
+	ret = __binder_dec_node(node, strong, internal);
+	spin_unlock(lock);
+	return ret;
+}
+
+static void binder_inc_node_tmpref(struct binder_node *node)
+{
+	binder_node_lock(node);
+	node->tmp_refs++;
+	binder_node_unlock(node);
+}
+
+static void binder_dec_node_tmpref(struct binder_node *node)
+{
+	spinlock_t *lock;
+
+	lock = node->proc ? &node->proc->lock : &binder_dead_nodes_lock;
+	spin_lock(lock);
+	node->tmp_refs--;
+	BUG_ON(node->tmp_refs < 0);
+	/* frees the node if nothing else references it */
+	__binder_dec_node(node, 0, 1);
+	spin_unlock(lock);
+}
 
+/* binder_get_ref() and binder_get_ref_for_node() need proc->refs_lock */
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
 {
@@ -1103,7 +1415,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1132,7 +1444,9 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		binder_node_lock(node);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		binder_node_unlock(node);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1149,6 +1463,8 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	spinlock_t *lock;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
@@ -1156,16 +1472,22 @@ static void binder_delete_ref(struct binder_ref *ref)
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	lock = ref->node->proc ? &ref->node->proc->lock :
+		&binder_dead_nodes_lock;
+	spin_lock(lock);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		__binder_dec_node(ref->node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	__binder_dec_node(ref->node, 0, 1);
+	spin_unlock(lock);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1173,6 +1495,7 @@ static void binder_delete_ref(struct binder_ref *ref)
 	binder_stats_deleted(BINDER_STAT_REF);
 }
 
+/* binder_inc_ref() and binder_dec_ref() need ref->proc->refs_lock */
 static int binder_inc_ref(struct binder_ref *ref, int strong,
 			  struct list_head *target_list)
 {
@@ -1228,19 +1551,70 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+/* Called with target_thread->proc->lock held */
 static void binder_pop_transaction(struct binder_thread *target_thread,
 				   struct binder_transaction *t)
 {
-	if (target_thread) {
-		BUG_ON(target_thread->transaction_stack != t);
-		BUG_ON(target_thread->transaction_stack->from != target_thread);
-		target_thread->transaction_stack =
-			target_thread->transaction_stack->from_parent;
-		t->from = NULL;
-	}
+	BUG_ON(target_thread->transaction_stack != t);
+	BUG_ON(target_thread->transaction_stack->from != target_thread);
+	target_thread->transaction_stack =
+		target_thread->transaction_stack->from_parent;
+	t->from = NULL;
 	t->need_reply = 0;
+}
+
+/* Accounts the time the handler of t took, now that it has replied */
+static void binder_transaction_handled(struct binder_proc *proc,
+				       struct binder_transaction *t,
+				       ktime_t now)
+{
+	s64 handler_us = ktime_us_delta(now, t->wakeup_time);
+	s64 total_us = ktime_us_delta(now, t->send_time);
+	struct binder_node *node = NULL;
+
+	trace_binder_transaction_handled(t, handler_us, total_us);
+	mutex_lock(&proc->buffer_lock);
+	spin_lock(&proc->lock);
+	binder_latency_add(&proc->handler_latency, handler_us);
+	/* the node is only known while the handler still holds the buffer */
 	if (t->buffer)
-		t->buffer->transaction = NULL;
+		node = t->buffer->target_node;
+	if (node)
+		binder_latency_add(&node->handler_latency, handler_us);
+	spin_unlock(&proc->lock);
+	mutex_unlock(&proc->buffer_lock);
+}
+
+/* Accounts the queueing delay of t, or the round trip if it is a reply */
+static void binder_transaction_received(struct binder_proc *proc,
+					struct binder_transaction *t)
+{
+	struct binder_node *node = t->buffer->target_node;
+	s64 queue_us;
+
+	t->wakeup_time = ktime_get();
+	queue_us = ktime_us_delta(t->wakeup_time, t->send_time);
+	trace_binder_transaction_received(t, queue_us);
+	spin_lock(&proc->lock);
+	binder_latency_add(&proc->queue_latency, queue_us);
+	if (node)
+		binder_latency_add(&node->queue_latency, queue_us);
+	else
+		binder_latency_add(&proc->reply_latency,
+			ktime_us_delta(t->wakeup_time, t->call_time));
+	spin_unlock(&proc->lock);
+}
+
+static void binder_free_transaction(struct binder_transaction *t)
+{
+	struct binder_proc *target_proc = t->to_proc;
+
+	if (target_proc) {
+		mutex_lock(&target_proc->buffer_lock);
+		if (t->buffer)
+			t->buffer->transaction = NULL;
+		mutex_unlock(&target_proc->buffer_lock);
+	}
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
@@ -1253,28 +1627,35 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	while (1) {
 		target_thread = t->from;
 		if (target_thread) {
+			uint32_t return_error;
+
+			spin_lock(&target_thread->proc->lock);
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
 				target_thread->return_error2 =
 					target_thread->return_error;
 				target_thread->return_error = BR_OK;
 			}
-			if (target_thread->return_error == BR_OK) {
+			return_error = target_thread->return_error;
+			if (return_error == BR_OK) {
+				binder_pop_transaction(target_thread, t);
+				target_thread->return_error = error_code;
+				wake_up_interruptible(&target_thread->wait);
+			}
+			spin_unlock(&target_thread->proc->lock);
+
+			if (return_error == BR_OK) {
 				binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 					     "binder: send failed reply for "
 					     "transaction %d to %d:%d\n",
 					      t->debug_id, target_thread->proc->pid,
 					      target_thread->pid);
-
-				binder_pop_transaction(target_thread, t);
-				target_thread->return_error = error_code;
-				wake_up_interruptible(&target_thread->wait);
+				binder_free_transaction(t);
 			} else {
 				printk(KERN_ERR "binder: reply failed, target "
 					"thread, %d:%d, has error code %d "
 					"already\n", target_thread->proc->pid,
-					target_thread->pid,
-					target_thread->return_error);
+					target_thread->pid, return_error);
 			}
 			return;
 		} else {
@@ -1285,7 +1666,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 				     "for transaction %d, target dead\n",
 				     t->debug_id);
 
-			binder_pop_transaction(target_thread, t);
+			binder_free_transaction(t);
 			if (next == NULL) {
 				binder_debug(BINDER_DEBUG_DEAD_BINDER,
 					     "binder: reply failed,"
@@ -1344,11 +1725,16 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        node %d u%p\n",
 				     node->debug_id, node->ptr);
 			binder_dec_node(node, fp->type == BINDER_TYPE_BINDER, 0);
+			binder_dec_node_tmpref(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+
+			mutex_lock(&proc->refs_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->refs_lock);
 				printk(KERN_ERR "binder: transaction release %d"
 				       " bad handle %ld\n", debug_id,
 				       fp->handle);
@@ -1358,6 +1744,7 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        ref %d desc %d (node %d)\n",
 				     ref->debug_id, ref->desc, ref->node->debug_id);
 			binder_dec_ref(ref, fp->type == BINDER_TYPE_HANDLE);
+			mutex_unlock(&proc->refs_lock);
 		} break;
 
 		case BINDER_TYPE_FD:
@@ -1400,7 +1787,11 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		spin_lock(&proc->lock);
 		in_reply_to = thread->transaction_stack;
+		if (in_reply_to && in_reply_to->to_thread == thread)
+			thread->transaction_stack = in_reply_to->to_parent;
+		spin_unlock(&proc->lock);
 		if (in_reply_to == NULL) {
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
@@ -1422,12 +1813,13 @@ static void binder_transaction(struct binder_proc *proc,
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
-		thread->transaction_stack = in_reply_to->to_parent;
 		target_thread = in_reply_to->from;
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		target_proc = target_thread->proc;
+		spin_lock(&target_proc->lock);
 		if (target_thread->transaction_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad target transaction stack %d, "
@@ -1436,30 +1828,38 @@ static void binder_transaction(struct binder_proc *proc,
 				target_thread->transaction_stack ?
 				target_thread->transaction_stack->debug_id : 0,
 				in_reply_to->debug_id);
+			spin_unlock(&target_proc->lock);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			target_thread = NULL;
 			goto err_dead_binder;
 		}
-		target_proc = target_thread->proc;
+		spin_unlock(&target_proc->lock);
 	} else {
 		if (tr->target.handle) {
 			struct binder_ref *ref;
+
+			mutex_lock(&proc->refs_lock);
 			ref = binder_get_ref(proc, tr->target.handle);
-			if (ref == NULL) {
+			if (ref) {
+				target_node = ref->node;
+				binder_inc_node_tmpref(target_node);
+			}
+			mutex_unlock(&proc->refs_lock);
+			if (target_node == NULL) {
 				binder_user_error("binder: %d:%d got "
 					"transaction to invalid handle\n",
 					proc->pid, thread->pid);
 				return_error = BR_FAILED_REPLY;
 				goto err_invalid_target_handle;
 			}
-			target_node = ref->node;
 		} else {
 			target_node = binder_context_mgr_node;
 			if (target_node == NULL) {
 				return_error = BR_DEAD_REPLY;
 				goto err_no_context_mgr_node;
 			}
+			binder_inc_node_tmpref(target_node);
 		}
 		e->to_node = target_node->debug_id;
 		target_proc = target_node->proc;
@@ -1467,6 +1867,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		spin_lock(&proc->lock);
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
@@ -1478,6 +1879,7 @@ static void binder_transaction(struct binder_proc *proc,
 					tmp->to_proc ? tmp->to_proc->pid : 0,
 					tmp->to_thread ?
 					tmp->to_thread->pid : 0);
+				spin_unlock(&proc->lock);
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
@@ -1487,6 +1889,7 @@ static void binder_transaction(struct binder_proc *proc,
 				tmp = tmp->from_parent;
 			}
 		}
+		spin_unlock(&proc->lock);
 	}
 	if (target_thread) {
 		e->to_thread = target_thread->pid;
@@ -1513,7 +1916,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1549,7 +1952,6 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
@@ -1596,13 +1998,12 @@ static void binder_transaction(struct binder_proc *proc,
 			struct binder_ref *ref;
 			struct binder_node *node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
-				node = binder_new_node(proc, fp->binder, fp->cookie);
+				node = binder_new_node(proc, fp->binder,
+						       fp->cookie, fp->flags);
 				if (node == NULL) {
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
-				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
 				binder_user_error("binder: %d:%d sending u%p "
@@ -1610,10 +2011,15 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				binder_dec_node_tmpref(node);
+				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
+			mutex_lock(&target_proc->refs_lock);
 			ref = binder_get_ref_for_node(target_proc, node);
 			if (ref == NULL) {
+				mutex_unlock(&target_proc->refs_lock);
+				binder_dec_node_tmpref(node);
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
@@ -1629,11 +2035,24 @@ static void binder_transaction(struct binder_proc *proc,
 				     "        node %d u%p -> ref %d desc %d\n",
 				     node->debug_id, node->ptr, ref->debug_id,
 				     ref->desc);
+			mutex_unlock(&target_proc->refs_lock);
+			binder_dec_node_tmpref(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
-			if (ref == NULL) {
+			struct binder_ref *ref;
+			struct binder_node *node = NULL;
+			int ref_debug_id = 0;
+
+			mutex_lock(&proc->refs_lock);
+			ref = binder_get_ref(proc, fp->handle);
+			if (ref) {
+				node = ref->node;
+				ref_debug_id = ref->debug_id;
+				binder_inc_node_tmpref(node);
+			}
+			mutex_unlock(&proc->refs_lock);
+			if (node == NULL) {
 				binder_user_error("binder: %d:%d got "
 					"transaction with invalid "
 					"handle, %ld\n", proc->pid,
@@ -1641,32 +2060,38 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_failed;
 			}
-			if (ref->node->proc == target_proc) {
+			if (node->proc == target_proc) {
 				if (fp->type == BINDER_TYPE_HANDLE)
 					fp->type = BINDER_TYPE_BINDER;
 				else
 					fp->type = BINDER_TYPE_WEAK_BINDER;
-				fp->binder = ref->node->ptr;
-				fp->cookie = ref->node->cookie;
-				binder_inc_node(ref->node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
 				binder_debug(BINDER_DEBUG_TRANSACTION,
-					     "        ref %d desc %d -> node %d u%p\n",
-					     ref->debug_id, ref->desc, ref->node->debug_id,
-					     ref->node->ptr);
+					     "        ref %d desc %ld -> node %d u%p\n",
+					     ref_debug_id, fp->handle, node->debug_id,
+					     node->ptr);
+				fp->binder = node->ptr;
+				fp->cookie = node->cookie;
+				binder_inc_node(node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
 			} else {
 				struct binder_ref *new_ref;
-				new_ref = binder_get_ref_for_node(target_proc, ref->node);
+
+				mutex_lock(&target_proc->refs_lock);
+				new_ref = binder_get_ref_for_node(target_proc, node);
 				if (new_ref == NULL) {
+					mutex_unlock(&target_proc->refs_lock);
+					binder_dec_node_tmpref(node);
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_get_ref_for_node_failed;
 				}
+				binder_debug(BINDER_DEBUG_TRANSACTION,
+					     "        ref %d desc %ld -> ref %d desc %d (node %d)\n",
+					     ref_debug_id, fp->handle, new_ref->debug_id,
+					     new_ref->desc, node->debug_id);
 				fp->handle = new_ref->desc;
 				binder_inc_ref(new_ref, fp->type == BINDER_TYPE_HANDLE, NULL);
-				binder_debug(BINDER_DEBUG_TRANSACTION,
-					     "        ref %d desc %d -> ref %d desc %d (node %d)\n",
-					     ref->debug_id, ref->desc, new_ref->debug_id,
-					     new_ref->desc, ref->node->debug_id);
+				mutex_unlock(&target_proc->refs_lock);
 			}
+			binder_dec_node_tmpref(node);
 		} break;
 
 		case BINDER_TYPE_FD: {
@@ -1715,15 +2140,32 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
-	if (reply) {
-		BUG_ON(t->buffer->async_transaction != 0);
-		binder_pop_transaction(target_thread, in_reply_to);
-	} else if (!(t->flags & TF_ONE_WAY)) {
+	t->work.type = BINDER_WORK_TRANSACTION;
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	t->send_time = ktime_get();
+	if (reply)
+		t->call_time = in_reply_to->send_time;
+	trace_binder_transaction(reply, t, target_node);
+
+	/*
+	 * Queue our BR_TRANSACTION_COMPLETE before the target can see the
+	 * transaction, so that it always precedes the matching reply.
+	 */
+	spin_lock(&proc->lock);
+	if (!reply && !(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
 		t->need_reply = 1;
 		t->from_parent = thread->transaction_stack;
 		thread->transaction_stack = t;
-	} else {
+	}
+	list_add_tail(&tcomplete->entry, &thread->todo);
+	spin_unlock(&proc->lock);
+
+	spin_lock(&target_proc->lock);
+	if (reply) {
+		BUG_ON(t->buffer->async_transaction != 0);
+		binder_pop_transaction(target_thread, in_reply_to);
+	} else if (t->flags & TF_ONE_WAY) {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
 		if (target_node->has_async_transaction) {
@@ -1732,12 +2174,17 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	spin_unlock(&target_proc->lock);
+
+	if (reply) {
+		binder_transaction_handled(proc, in_reply_to, t->send_time);
+		binder_free_transaction(in_reply_to);
+	}
+	if (target_node)
+		binder_dec_node_tmpref(target_node);
 	return;
 
 err_get_unused_fd_failed:
@@ -1764,6 +2211,9 @@ err_empty_call_stack:
 err_dead_binder:
 err_invalid_target_handle:
 err_no_context_mgr_node:
+	if (target_node)
+		binder_dec_node_tmpref(target_node);
+
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 		     "binder: %d:%d transaction failed %d, size %zd-%zd\n",
 		     proc->pid, thread->pid, return_error,
@@ -1775,12 +2225,22 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
-	BUG_ON(thread->return_error != BR_OK);
+	spin_lock(&proc->lock);
+	/* a transaction we are waiting on may have failed meanwhile */
+	if (thread->return_error != BR_OK &&
+	    thread->return_error2 == BR_OK) {
+		thread->return_error2 = thread->return_error;
+		thread->return_error = BR_OK;
+	}
+	WARN_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
+		spin_unlock(&proc->lock);
 		binder_send_failed_reply(in_reply_to, return_error);
-	} else
+	} else {
 		thread->return_error = return_error;
+		spin_unlock(&proc->lock);
+	}
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1795,9 +2255,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1811,11 +2271,12 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
+			mutex_lock(&proc->refs_lock);
 			if (target == 0 && binder_context_mgr_node &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
 				ref = binder_get_ref_for_node(proc,
 					       binder_context_mgr_node);
-				if (ref->desc != target) {
+				if (ref && ref->desc != target) {
 					binder_user_error("binder: %d:"
 						"%d tried to acquire "
 						"reference to desc 0, "
@@ -1826,6 +2287,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			} else
 				ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->refs_lock);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1854,6 +2316,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			mutex_unlock(&proc->refs_lock);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1879,6 +2342,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					node_ptr);
 				break;
 			}
+			spin_lock(&proc->lock);
 			if (cookie != node->cookie) {
 				binder_user_error("binder: %d:%d %s u%p node %d"
 					" cookie mismatch %p != %p\n",
@@ -1887,7 +2351,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 					node_ptr, node->debug_id,
 					cookie, node->cookie);
-				break;
+				goto increfs_done_out;
 			}
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
@@ -1896,7 +2360,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending acquire request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
-					break;
+					goto increfs_done_out;
 				}
 				node->pending_strong_ref = 0;
 			} else {
@@ -1906,16 +2370,19 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending increfs request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
-					break;
+					goto increfs_done_out;
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			__binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
 				     cmd == BC_INCREFS_DONE ? "BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 				     node->debug_id, node->local_strong_refs, node->local_weak_refs);
+increfs_done_out:
+			spin_unlock(&proc->lock);
+			binder_dec_node_tmpref(node);
 			break;
 		}
 		case BC_ATTEMPT_ACQUIRE:
@@ -1933,20 +2400,25 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->buffer_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->buffer_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->buffer_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* the buffer is ours now, a second free will fail */
+			buffer->allow_user_free = 0;
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
@@ -1956,12 +2428,17 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction->buffer = NULL;
 				buffer->transaction = NULL;
 			}
+			mutex_unlock(&proc->buffer_lock);
 			if (buffer->async_transaction && buffer->target_node) {
-				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
+				struct binder_node *node = buffer->target_node;
+
+				spin_lock(&proc->lock);
+				BUG_ON(!node->has_async_transaction);
+				if (list_empty(&node->async_todo))
+					node->has_async_transaction = 0;
 				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+					list_move_tail(node->async_todo.next, &thread->todo);
+				spin_unlock(&proc->lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -1989,15 +2466,20 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					" BC_REGISTER_LOOPER called "
 					"after BC_ENTER_LOOPER\n",
 					proc->pid, thread->pid);
-			} else if (proc->requested_threads == 0) {
-				thread->looper |= BINDER_LOOPER_STATE_INVALID;
-				binder_user_error("binder: %d:%d ERROR:"
-					" BC_REGISTER_LOOPER called "
-					"without request\n",
-					proc->pid, thread->pid);
 			} else {
-				proc->requested_threads--;
-				proc->requested_threads_started++;
+				spin_lock(&proc->lock);
+				if (proc->requested_threads == 0) {
+					spin_unlock(&proc->lock);
+					thread->looper |= BINDER_LOOPER_STATE_INVALID;
+					binder_user_error("binder: %d:%d ERROR:"
+						" BC_REGISTER_LOOPER called "
+						"without request\n",
+						proc->pid, thread->pid);
+				} else {
+					proc->requested_threads--;
+					proc->requested_threads_started++;
+					spin_unlock(&proc->lock);
+				}
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
 			break;
@@ -2034,8 +2516,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void __user * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			mutex_lock(&proc->refs_lock);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->refs_lock);
 				binder_user_error("binder: %d:%d %s "
 					"invalid ref %d\n",
 					proc->pid, thread->pid,
@@ -2057,6 +2541,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 
 			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
 				if (ref->death) {
+					mutex_unlock(&proc->refs_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_REQUEST_DEATH_NOTI"
 						"FICATION death notific"
@@ -2066,7 +2551,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				death = kzalloc(sizeof(*death), GFP_KERNEL);
 				if (death == NULL) {
+					mutex_unlock(&proc->refs_lock);
+					spin_lock(&proc->lock);
 					thread->return_error = BR_ERROR;
+					spin_unlock(&proc->lock);
 					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 						     "binder: %d:%d "
 						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
@@ -2079,15 +2567,18 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->lock);
 				}
 			} else {
 				if (ref->death == NULL) {
+					mutex_unlock(&proc->refs_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_CLEAR_DEATH_NOTIFI"
 						"CATION death notificat"
@@ -2097,6 +2588,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				death = ref->death;
 				if (death->cookie != cookie) {
+					mutex_unlock(&proc->refs_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_CLEAR_DEATH_NOTIFI"
 						"CATION death notificat"
@@ -2107,6 +2599,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2119,7 +2612,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->lock);
 			}
+			mutex_unlock(&proc->refs_lock);
 		} break;
 		case BC_DEAD_BINDER_DONE: {
 			struct binder_work *w;
@@ -2129,6 +2624,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			spin_lock(&proc->lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2140,6 +2636,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
 			if (death == NULL) {
+				spin_unlock(&proc->lock);
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
@@ -2156,6 +2653,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->lock);
 		} break;
 
 		default:
@@ -2172,9 +2670,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2201,6 +2699,7 @@ static int binder_thread_read(struct binder_proc *proc,
 
 	int ret = 0;
 	int wait_for_proc_work;
+	int spawn_looper;
 
 	if (*consumed == 0) {
 		if (put_user(BR_NOOP, (uint32_t __user *)ptr))
@@ -2209,22 +2708,32 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	spin_lock(&proc->lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
 
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		uint32_t return_error = thread->return_error;
+		uint32_t return_error2 = thread->return_error2;
+
+		thread->return_error2 = BR_OK;
+		if (return_error2 == BR_OK ||
+		    end - ptr >= 2 * sizeof(uint32_t))
+			thread->return_error = BR_OK;
+		else
+			return_error = BR_OK;	/* no room, return it next time */
+		spin_unlock(&proc->lock);
+
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
+				return -EFAULT;
+			ptr += sizeof(uint32_t);
+		}
+		if (return_error != BR_OK) {
+			if (put_user(return_error, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (ptr == end)
-				goto done;
-			thread->return_error2 = BR_OK;
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
-			return -EFAULT;
-		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
 		goto done;
 	}
 
@@ -2232,7 +2741,8 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->lock);
+	up_read(&binder_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2256,10 +2766,12 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	down_read(&binder_lock);
+	spin_lock(&proc->lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
+	spin_unlock(&proc->lock);
 
 	if (ret)
 		return ret;
@@ -2268,26 +2780,43 @@ retry:
 		uint32_t cmd;
 		struct binder_transaction_data tr;
 		struct binder_work *w;
+		struct list_head *list;
 		struct binder_transaction *t = NULL;
 
+		spin_lock(&proc->lock);
 		if (!list_empty(&thread->todo))
-			w = list_first_entry(&thread->todo, struct binder_work, entry);
+			list = &thread->todo;
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
-			w = list_first_entry(&proc->todo, struct binder_work, entry);
+			list = &proc->todo;
 		else {
+			spin_unlock(&proc->lock);
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
 		}
 
-		if (end - ptr < sizeof(tr) + 4)
+		if (end - ptr < sizeof(tr) + 4) {
+			spin_unlock(&proc->lock);
 			break;
+		}
+		w = list_first_entry(list, struct binder_work, entry);
 
+		/*
+		 * Take the work off the list before copying it out, other
+		 * threads of this proc may be looking at proc->todo too.
+		 */
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
+			list_del_init(&w->entry);
+			spin_unlock(&proc->lock);
 			t = container_of(w, struct binder_transaction, work);
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
+			list_del(&w->entry);
+			spin_unlock(&proc->lock);
+			kfree(w);
+			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
+
 			cmd = BR_TRANSACTION_COMPLETE;
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
@@ -2297,10 +2826,6 @@ retry:
 			binder_debug(BINDER_DEBUG_TRANSACTION_COMPLETE,
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
-
-			list_del(&w->entry);
-			kfree(w);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
 		case BINDER_WORK_NODE: {
 			struct binder_node *node = container_of(w, struct binder_node, work);
@@ -2308,6 +2833,11 @@ retry:
 			const char *cmd_name;
 			int strong = node->internal_strong_refs || node->local_strong_refs;
 			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			void __user *node_ptr = node->ptr;
+			void __user *node_cookie = node->cookie;
+			int node_debug_id = node->debug_id;
+			int free_node = 0;
+
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2329,36 +2859,43 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP) {
+				list_del_init(&w->entry);
+				if (!weak && !strong && !node->tmp_refs) {
+					rb_erase(&node->rb_node, &proc->nodes);
+					free_node = 1;
+				}
+			}
+			spin_unlock(&proc->lock);
+
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(uint32_t);
-				if (put_user(node->ptr, (void * __user *)ptr))
+				if (put_user(node_ptr, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
-				if (put_user(node->cookie, (void * __user *)ptr))
+				if (put_user(node_cookie, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
 				binder_debug(BINDER_DEBUG_USER_REFS,
 					     "binder: %d:%d %s %d u%p c%p\n",
-					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
+					     proc->pid, thread->pid, cmd_name, node_debug_id, node_ptr, node_cookie);
 			} else {
-				list_del_init(&w->entry);
-				if (!weak && !strong) {
+				if (free_node) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
-						     proc->pid, thread->pid, node->debug_id,
-						     node->ptr, node->cookie);
-					rb_erase(&node->rb_node, &proc->nodes);
+						     proc->pid, thread->pid, node_debug_id,
+						     node_ptr, node_cookie);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p state unchanged\n",
-						     proc->pid, thread->pid, node->debug_id, node->ptr,
-						     node->cookie);
+						     proc->pid, thread->pid, node_debug_id, node_ptr,
+						     node_cookie);
 				}
 			}
 		} break;
@@ -2366,17 +2903,28 @@ retry:
 		case BINDER_WORK_DEAD_BINDER_AND_CLEAR:
 		case BINDER_WORK_CLEAR_DEATH_NOTIFICATION: {
 			struct binder_ref_death *death;
+			void __user *cookie;
 			uint32_t cmd;
 
 			death = container_of(w, struct binder_ref_death, work);
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION)
+			cookie = death->cookie;
+			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				cmd = BR_CLEAR_DEATH_NOTIFICATION_DONE;
-			else
+				list_del(&w->entry);
+			} else {
 				cmd = BR_DEAD_BINDER;
+				list_move(&w->entry, &proc->delivered_death);
+			}
+			spin_unlock(&proc->lock);
+			if (cmd == BR_CLEAR_DEATH_NOTIFICATION_DONE) {
+				kfree(death);
+				binder_stats_deleted(BINDER_STAT_DEATH);
+			}
+
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (put_user(death->cookie, (void * __user *)ptr))
+			if (put_user(cookie, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
 			binder_debug(BINDER_DEBUG_DEATH_NOTIFICATION,
@@ -2385,17 +2933,14 @@ retry:
 				      cmd == BR_DEAD_BINDER ?
 				      "BR_DEAD_BINDER" :
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-				      death->cookie);
+				      cookie);
 
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
-				list_del(&w->entry);
-				kfree(death);
-				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
-				list_move(&w->entry, &proc->delivered_death);
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
+		default:
+			spin_unlock(&proc->lock);
+			break;
 		}
 
 		if (!t)
@@ -2439,13 +2984,18 @@ retry:
 					ALIGN(t->buffer->data_size,
 					    sizeof(void *));
 
-		if (put_user(cmd, (uint32_t __user *)ptr))
+		if (put_user(cmd, (uint32_t __user *)ptr) ||
+		    copy_to_user(ptr + sizeof(uint32_t), &tr, sizeof(tr))) {
+			/* leave the transaction for the next read */
+			spin_lock(&proc->lock);
+			list_add(&t->work.entry, list);
+			spin_unlock(&proc->lock);
 			return -EFAULT;
+		}
 		ptr += sizeof(uint32_t);
-		if (copy_to_user(ptr, &tr, sizeof(tr)))
-			return -EFAULT;
 		ptr += sizeof(tr);
 
+		binder_transaction_received(proc, t);
 		binder_stat_br(proc, thread, cmd);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
@@ -2458,14 +3008,18 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
-		list_del(&t->work.entry);
+		mutex_lock(&proc->buffer_lock);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
+			mutex_unlock(&proc->buffer_lock);
+			spin_lock(&proc->lock);
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
 			thread->transaction_stack = t;
+			spin_unlock(&proc->lock);
 		} else {
 			t->buffer->transaction = NULL;
+			mutex_unlock(&proc->buffer_lock);
 			kfree(t);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION);
 		}
@@ -2475,12 +3029,16 @@ retry:
 done:
 
 	*consumed = ptr - buffer;
-	if (proc->requested_threads + proc->ready_threads == 0 &&
-	    proc->requested_threads_started < proc->max_threads &&
-	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
-	     BINDER_LOOPER_STATE_ENTERED)) /* the user-space code fails to */
-	     /*spawn a new thread if we leave this out */) {
+	spin_lock(&proc->lock);
+	spawn_looper = proc->requested_threads + proc->ready_threads == 0 &&
+		proc->requested_threads_started < proc->max_threads &&
+		(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
+		 BINDER_LOOPER_STATE_ENTERED)); /* the user-space code fails to */
+		 /*spawn a new thread if we leave this out */
+	if (spawn_looper)
 		proc->requested_threads++;
+	spin_unlock(&proc->lock);
+	if (spawn_looper) {
 		binder_debug(BINDER_DEBUG_THREADS,
 			     "binder: %d:%d BR_SPAWN_LOOPER\n",
 			     proc->pid, thread->pid);
@@ -2515,7 +3073,9 @@ static void binder_release_work(struct list_head *list)
 
 }
 
-static struct binder_thread *binder_get_thread(struct binder_proc *proc)
+/* Called with proc->lock held, inserts new_thread if current has none */
+static struct binder_thread *__binder_get_thread(struct binder_proc *proc,
+					struct binder_thread *new_thread)
 {
 	struct binder_thread *thread = NULL;
 	struct rb_node *parent = NULL;
@@ -2530,23 +3090,44 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		else if (current->pid > thread->pid)
 			p = &(*p)->rb_right;
 		else
-			break;
+			return thread;
 	}
-	if (*p == NULL) {
-		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
-			return NULL;
+	if (new_thread == NULL)
+		return NULL;
+	thread = new_thread;
+	thread->proc = proc;
+	thread->pid = current->pid;
+	init_waitqueue_head(&thread->wait);
+	INIT_LIST_HEAD(&thread->todo);
+	rb_link_node(&thread->rb_node, parent, p);
+	rb_insert_color(&thread->rb_node, &proc->threads);
+	thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
+	thread->return_error = BR_OK;
+	thread->return_error2 = BR_OK;
+	return thread;
+}
+
+static struct binder_thread *binder_get_thread(struct binder_proc *proc)
+{
+	struct binder_thread *thread;
+	struct binder_thread *new_thread;
+
+	spin_lock(&proc->lock);
+	thread = __binder_get_thread(proc, NULL);
+	spin_unlock(&proc->lock);
+	if (thread)
+		return thread;
+
+	new_thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+	if (new_thread == NULL)
+		return NULL;
+	spin_lock(&proc->lock);
+	thread = __binder_get_thread(proc, new_thread);
+	spin_unlock(&proc->lock);
+	if (thread != new_thread)
+		kfree(new_thread);
+	else
 		binder_stats_created(BINDER_STAT_THREAD);
-		thread->proc = proc;
-		thread->pid = current->pid;
-		init_waitqueue_head(&thread->wait);
-		INIT_LIST_HEAD(&thread->todo);
-		rb_link_node(&thread->rb_node, parent, p);
-		rb_insert_color(&thread->rb_node, &proc->threads);
-		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
-		thread->return_error = BR_OK;
-		thread->return_error2 = BR_OK;
-	}
 	return thread;
 }
 
@@ -2598,12 +3179,18 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_lock);
 	thread = binder_get_thread(proc);
+	if (thread == NULL) {
+		up_read(&binder_lock);
+		return POLLERR;
+	}
 
+	spin_lock(&proc->lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->lock);
+	up_read(&binder_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2628,6 +3215,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	int exclusive;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2635,7 +3223,12 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	/* these change state other binder calls rely on being stable */
+	exclusive = cmd == BINDER_SET_CONTEXT_MGR || cmd == BINDER_THREAD_EXIT;
+	if (exclusive)
+		down_write(&binder_lock);
+	else
+		down_read(&binder_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2710,7 +3303,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			}
 		} else
 			binder_context_mgr_uid = current->cred->euid;
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
+		binder_context_mgr_node = binder_new_node(proc, NULL, NULL, 0);
 		if (binder_context_mgr_node == NULL) {
 			ret = -ENOMEM;
 			goto err;
@@ -2719,6 +3312,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		binder_context_mgr_node->local_strong_refs++;
 		binder_context_mgr_node->has_strong_ref = 1;
 		binder_context_mgr_node->has_weak_ref = 1;
+		binder_dec_node_tmpref(binder_context_mgr_node);
 		break;
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
@@ -2744,7 +3338,10 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	if (exclusive)
+		up_write(&binder_lock);
+	else
+		up_read(&binder_lock);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2884,14 +3481,17 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->refs_lock);
+	mutex_init(&proc->buffer_lock);
+	spin_lock_init(&proc->lock);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
-	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	mutex_lock(&binder_procs_lock);
+	binder_stats_created(BINDER_STAT_PROC);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2950,7 +3550,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
@@ -2983,7 +3585,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 			node->proc = NULL;
 			node->local_strong_refs = 0;
 			node->local_weak_refs = 0;
+			spin_lock(&binder_dead_nodes_lock);
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+			spin_unlock(&binder_dead_nodes_lock);
 
 			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
 				incoming_refs++;
@@ -3018,6 +3622,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 							rb_node);
 		t = buffer->transaction;
 		if (t) {
+			t->to_proc = NULL;
 			t->buffer = NULL;
 			buffer->transaction = NULL;
 			printk(KERN_ERR "binder: release proc %d, "
@@ -3071,7 +3676,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		down_write(&binder_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3098,7 +3703,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		up_write(&binder_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3218,6 +3823,26 @@ static void print_binder_thread(struct seq_file *m,
 		m->count = start_pos;
 }
 
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency_hist *hist)
+{
+	int i;
+
+	if (!hist->max_us && !hist->count[0])
+		return;
+	seq_printf(m, "%s (us):", prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (!hist->count[i])
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, " >=%lld:%lu", 1LL << (i - 1),
+				   hist->count[i]);
+		else
+			seq_printf(m, " <%lld:%lu", 1LL << i, hist->count[i]);
+	}
+	seq_printf(m, " max %lld\n", hist->max_us);
+}
+
 static void print_binder_node(struct seq_file *m, struct binder_node *node)
 {
 	struct binder_ref *ref;
@@ -3243,6 +3868,8 @@ static void print_binder_node(struct seq_file *m, struct binder_node *node)
 	list_for_each_entry(w, &node->async_todo, entry)
 		print_binder_work(m, "    ",
 				  "    pending async transaction", w);
+	print_binder_latency(m, "    queue latency", &node->queue_latency);
+	print_binder_latency(m, "    handler latency", &node->handler_latency);
 }
 
 static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
@@ -3351,17 +3978,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3369,11 +4000,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3383,6 +4016,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	int i;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3414,6 +4048,17 @@ static void print_binder_proc_stats(struct seq_file *m,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	count = 0;
+	for (i = 0; i < BINDER_SIZE_CLASSES; i++)
+		count += proc->cached_buffer_count[i];
+	seq_printf(m, "  cached buffers: %d hits %lu\n", count,
+		   proc->buffer_cache_hits);
+	seq_printf(m, "  pages mapped: %lu unmapped %lu reused %lu "
+		   "retained %d\n", proc->pages_mapped, proc->pages_unmapped,
+		   proc->pages_reused, proc->pages_retained);
+	print_binder_latency(m, "  queue latency", &proc->queue_latency);
+	print_binder_latency(m, "  handler latency", &proc->handler_latency);
+	print_binder_latency(m, "  reply latency", &proc->reply_latency);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3438,8 +4083,10 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	struct binder_node *node;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder state:\n");
 
@@ -3450,8 +4097,10 @@ static int binder_state_show(struct seq_file *m, void *unused)
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_lock);
+	}
 	return 0;
 }
 
@@ -3461,8 +4110,10 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3470,8 +4121,10 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_lock);
+	}
 	return 0;
 }
 
@@ -3481,14 +4134,18 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_lock);
+	}
 	return 0;
 }
 
@@ -3498,11 +4155,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_lock);
 	return 0;
 }
 
@@ -3597,4 +4254,7 @@ static int __init binder_init(void)
 
 device_initcall(binder_init);
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
 MODULE_LICENSE("GPL v2");
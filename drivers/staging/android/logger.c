@@ -25,25 +25,40 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_writer - the entry a cpu is writing to a log, if any
+ *
+ * Writers run with preemption disabled from reserving their entry until it
+ * is committed, so each cpu has at most one entry in flight per log.
+ */
+struct logger_writer {
+	__u32			start;	/* start of the entry being written */
+	int			active;	/* 'start' is in flight */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. Writers do not lock it: they claim
+ * space by moving header->reserve with cmpxchg and publish it by moving
+ * header->commit once every entry before theirs is complete, see
+ * do_write_log(). The positions in 'header' count bytes since the log was
+ * created and wrap at 2^32.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	struct logger_writer __percpu *writers; /* entries in flight */
+	struct logger_mmap_header *header; /* positions, first page of mmap */
 	size_t			size;	/* size of the log */
 };
 
@@ -51,17 +66,21 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by the mutex 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes reads of this reader */
+	__u32			r_off;	/* current read position */
+	int			batch;	/* read many entries at once */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* pos_before - is position 'a' older than position 'b'? */
+#define pos_before(a, b)	((__s32)((a) - (b)) < 0)
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -86,47 +105,103 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
+ * ring_peek - copies 'len' bytes starting at position 'pos' out of 'log'.
+ */
+static void ring_peek(struct logger_log *log, __u32 pos, void *buf,
+		      size_t len)
+{
+	size_t off = logger_offset(pos);
+	size_t n = min(len, log->size - off);
+
+	memcpy(buf, log->buffer + off, n);
+	if (len != n)
+		memcpy(buf + n, log->buffer, len - n);
+}
+
+/*
+ * get_entry_len - Grabs the length of the entry starting at position 'pos',
+ * header included.
  *
- * Caller needs to hold log->mutex.
+ * The result is only meaningful if the entry is still in the log afterwards,
+ * see reader_lapped().
  */
-static __u32 get_entry_len(struct logger_log *log, size_t off)
+static __u32 get_entry_len(struct logger_log *log, __u32 pos)
 {
 	__u16 val;
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
-	}
+	ring_peek(log, pos, &val, sizeof(val));
 
 	return sizeof(struct logger_entry) + val;
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * reader_pos - returns the reader's position, after pulling it forward to
+ * the oldest entry still in the log if it was lapped by the writers and to
+ * the head if the log was flushed.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex.
+ */
+static __u32 reader_pos(struct logger_reader *reader)
+{
+	struct logger_mmap_header *header = reader->log->header;
+	__u32 commit = ACCESS_ONCE(header->commit);
+	__u32 tail = ACCESS_ONCE(header->tail);
+	__u32 head = ACCESS_ONCE(header->head);
+	__u32 r_off = reader->r_off;
+
+	if (pos_before(r_off, tail) || pos_before(commit, r_off))
+		r_off = tail;
+	if (pos_before(r_off, head))
+		r_off = head;
+
+	reader->r_off = r_off;
+
+	/* the entries up to 'commit' are complete, read them only now */
+	smp_rmb();
+
+	return r_off;
+}
+
+/*
+ * reader_lapped - were the contents at position 'pos' overwritten since the
+ * reader found them in the log?
+ */
+static inline int reader_lapped(struct logger_reader *reader, __u32 pos)
+{
+	/* check the tail only after being done with the contents */
+	smp_rmb();
+
+	return pos_before(pos, ACCESS_ONCE(reader->log->header->tail));
+}
+
+/*
+ * reader_empty - has the reader caught up with the writers?
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static inline int reader_empty(struct logger_reader *reader)
 {
+	return reader_pos(reader) == ACCESS_ONCE(reader->log->header->commit);
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes from position 'pos' of
+ * 'log' into the user-space buffer 'buf'. Returns 'count' on success.
+ *
+ * The caller must check with reader_lapped() that the bytes it got were not
+ * overwritten meanwhile.
+ */
+static ssize_t do_read_log_to_user(struct logger_log *log, __u32 pos,
+				   char __user *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
 	size_t len;
 
 	/*
 	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
+	 * the position's offset up to 'count' bytes or to the end of the log,
+	 * whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,8 +212,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -150,6 +223,7 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
  * 	- Atomically reads exactly one log entry
+ * 	- After LOGGER_SET_BATCH_READ, reads as many whole entries as fit
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -162,15 +236,16 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
+	mutex_lock(&reader->mutex);
+
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
+		if (!reader_empty(reader)) {
+			ret = 0;
 			break;
+		}
 
 		if (file->f_flags & O_NONBLOCK) {
 			ret = -EAGAIN;
@@ -182,152 +257,188 @@ start:
 			break;
 		}
 
+		mutex_unlock(&reader->mutex);
 		schedule();
+		mutex_lock(&reader->mutex);
 	}
 
 	finish_wait(&log->wq, &wait);
 	if (ret)
-		return ret;
+		goto out;
 
-	mutex_lock(&log->mutex);
+	while (!ret || reader->batch) {
+		__u32 r_off = reader_pos(reader);
+		ssize_t len;
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
+		if (r_off == ACCESS_ONCE(log->header->commit))
+			break;
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+		/* get the size of the next entry */
+		len = get_entry_len(log, r_off);
+		if (reader_lapped(reader, r_off))
+			continue;
+		if (count - ret < len) {
+			if (!ret)
+				ret = -EINVAL;
+			break;
+		}
+
+		/* get exactly one entry from the log */
+		len = do_read_log_to_user(log, r_off, buf + ret, len);
+		if (len < 0) {
+			if (!ret)
+				ret = len;
+			break;
+		}
+
+		/* if a writer got there first, what we copied is garbage */
+		if (reader_lapped(reader, r_off))
+			continue;
+
+		reader->r_off = r_off + len;
+		ret += len;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* the log was flushed under our feet, wait for the next entry */
+	if (!ret)
+		goto start;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * advance_commit - moves the commit position up to the oldest entry still
+ * being written, or to the reserve position if there is none.
  *
- * Caller must hold log->mutex.
+ * Every writer calls this once its entry is complete, so the last one to
+ * finish publishes everybody's entries.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void advance_commit(struct logger_log *log)
 {
-	size_t count = 0;
+	struct logger_mmap_header *header = log->header;
+	__u32 commit, new;
+	int cpu;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	new = ACCESS_ONCE(header->reserve);
 
-	return off;
-}
+	/* pairs with the barrier between 'active' and 'reserve' below */
+	smp_mb();
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	for_each_possible_cpu(cpu) {
+		struct logger_writer *w = per_cpu_ptr(log->writers, cpu);
+
+		if (!ACCESS_ONCE(w->active))
+			continue;
+		smp_rmb();
+		if (pos_before(ACCESS_ONCE(w->start), new))
+			new = ACCESS_ONCE(w->start);
 	}
 
-	return 0;
+	do {
+		commit = ACCESS_ONCE(header->commit);
+		if (!pos_before(commit, new))
+			return;
+	} while (cmpxchg(&header->commit, commit, new) != commit);
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * do_write_log - writes the entry 'header' with the payload 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * Never sleeps and never waits for readers. Writers on other cpus only hold
+ * it up when the whole log is taken by entries still being written.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void do_write_log(struct logger_log *log, struct logger_entry *header,
+			 const void *buf)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	struct logger_mmap_header *mh = log->header;
+	struct logger_writer *w;
+	__u32 len = sizeof(struct logger_entry) + header->len;
+	__u32 start, tail;
+	size_t off, n;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	preempt_disable();
+	w = this_cpu_ptr(log->writers);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
-}
-
-/*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
- */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
-{
-	size_t len;
+	/*
+	 * Reserve the space for the entry. Readers and the writers that move
+	 * the tail only look at complete entries, so the entry may only take
+	 * the place of entries that are already committed.
+	 */
+	while (1) {
+		start = ACCESS_ONCE(mh->reserve);
+		if (pos_before(ACCESS_ONCE(mh->commit), start + len - log->size)) {
+			/*
+			 * A writer that lost the race for 'reserve' may
+			 * have held back the commit of the last finished
+			 * entry, so do not leave it to the others.
+			 */
+			advance_commit(log);
+			cpu_relax();
+			continue;
+		}
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+		w->start = start;
+		smp_wmb();
+		w->active = 1;
+		smp_mb();
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+		if (cmpxchg(&mh->reserve, start, start + len) == start)
+			break;
 
-	log->w_off = logger_offset(log->w_off + count);
+		w->active = 0;
+	}
 
+	/*
+	 * Drop the entries the new one overwrites. Readers notice the tail
+	 * moving past them and throw away what they copied.
+	 */
+	while (pos_before(tail = ACCESS_ONCE(mh->tail), start + len - log->size))
+		cmpxchg(&mh->tail, tail, tail + get_entry_len(log, tail));
+
+	off = logger_offset(start);
+	n = min_t(size_t, sizeof(struct logger_entry), log->size - off);
+	memcpy(log->buffer + off, header, n);
+	if (n != sizeof(struct logger_entry))
+		memcpy(log->buffer, (void *)header + n,
+		       sizeof(struct logger_entry) - n);
+
+	off = logger_offset(start + sizeof(struct logger_entry));
+	n = min_t(size_t, header->len, log->size - off);
+	memcpy(log->buffer + off, buf, n);
+	if (n != header->len)
+		memcpy(log->buffer, buf + n, header->len - n);
+
+	/* the entry is complete before it can be committed */
+	smp_wmb();
+	w->active = 0;
+	smp_mb();
+	advance_commit(log);
+
+	preempt_enable();
 }
 
-/*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
- */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
-}
+/* payloads up to this size are gathered on the stack rather than kmalloced */
+#define LOGGER_STACK_PAYLOAD	256
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is gathered from user-space before any space is reserved, so
+ * a fault leaves no trace in the log and the copy into the log cannot sleep.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	char stack_payload[LOGGER_STACK_PAYLOAD];
 	struct logger_entry header;
 	struct timespec now;
+	char *payload;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -337,46 +448,47 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	payload = stack_payload;
+	if (header.len > LOGGER_STACK_PAYLOAD) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (!payload)
+			return -ENOMEM;
+	}
 
 	while (nr_segs-- > 0) {
 		size_t len;
-		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (len && copy_from_user(payload + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
 
-	mutex_unlock(&log->mutex);
+	do_write_log(log, &header, payload);
+
+	/*
+	 * wake up any blocked readers, the barrier pairs with the one in
+	 * prepare_to_wait() in logger_read()
+	 */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+out:
+	if (payload != stack_payload)
+		kfree(payload);
 
 	return ret;
 }
@@ -409,12 +521,11 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
+		mutex_init(&reader->mutex);
+		reader->batch = 0;
 
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		/* pulled forward to the tail by reader_pos() if need be */
+		reader->r_off = ACCESS_ONCE(log->header->head);
 
 		file->private_data = reader;
 	} else
@@ -432,17 +543,35 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log;
-		log = reader->log;
-		mutex_lock(&log->mutex);
-		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
 		kfree(reader);
 	}
 
 	return 0;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the header page with the log's positions, followed by the ring,
+ * read-only. Only readers may map the log. Both live in one vmalloc_user()
+ * area, which works whether or not the driver is a module.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	if (vma->vm_pgoff || size > PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, log->header, 0);
+}
+
 /*
  * logger_poll - the log's poll file operation, for poll/select/epoll
  *
@@ -466,10 +595,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (!reader_empty(reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -477,11 +606,11 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
+	struct logger_mmap_header *header = log->header;
 	struct logger_reader *reader;
+	__u32 r_off, head, commit;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -492,10 +621,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		r_off = reader_pos(reader);
+		ret = ACCESS_ONCE(header->commit) - r_off;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -503,25 +632,41 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
+		mutex_lock(&reader->mutex);
+		do {
 			ret = 0;
+			r_off = reader_pos(reader);
+			if (r_off == ACCESS_ONCE(header->commit))
+				break;
+			ret = get_entry_len(log, r_off);
+		} while (reader_lapped(reader, r_off));
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers behind the new head catch up in reader_pos() */
+		commit = ACCESS_ONCE(header->commit);
+		do {
+			head = ACCESS_ONCE(header->head);
+			if (!pos_before(head, commit))
+				break;
+		} while (cmpxchg(&header->head, head, commit) != head);
+		ret = 0;
+		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -530,6 +675,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -542,9 +688,7 @@ static const struct file_operations logger_fops = {
  * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -552,10 +696,6 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
-	.head = 0, \
 	.size = SIZE, \
 };
 
@@ -581,10 +721,25 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->writers = alloc_percpu(struct logger_writer);
+	if (!log->writers)
+		return -ENOMEM;
+
+	/* the header page and the ring, in the layout of the mmap */
+	log->header = vmalloc_user(PAGE_SIZE + log->size);
+	if (!log->header) {
+		free_percpu(log->writers);
+		return -ENOMEM;
+	}
+	log->header->size = log->size;
+	log->buffer = (unsigned char *)log->header + PAGE_SIZE;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(log->header);
+		free_percpu(log->writers);
 		return ret;
 	}
 
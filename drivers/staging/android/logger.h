@@ -35,6 +35,22 @@ struct logger_entry {
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
 #define LOGGER_LOG_MAIN		"log_main"	/* everything else */
 
+/*
+ * The first page of a log's read-only mmap, followed by the ring itself.
+ * Positions count bytes since the log was created and wrap at 2^32, the
+ * offset of a position in the ring is the position modulo 'size'. Entries
+ * between 'tail' and 'commit' are complete. Readers that map the log start
+ * at 'head' or 'tail', whichever is later, read 'commit' before the entries
+ * and 'tail' after them, and drop whatever 'tail' has moved past meanwhile.
+ */
+struct logger_mmap_header {
+	__u32		size;		/* size of the ring, a power of two */
+	__u32		head;		/* readers start here after a flush */
+	__u32		tail;		/* oldest entry in the ring */
+	__u32		commit;		/* end of the last complete entry */
+	__u32		reserve;	/* end of the last entry begun */
+};
+
 #define LOGGER_ENTRY_MAX_LEN		(4*1024)
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
@@ -45,5 +61,6 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* many per read */
 
 #endif /* _LINUX_LOGGER_H */
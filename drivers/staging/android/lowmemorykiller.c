@@ -12,6 +12,19 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Candidates are looked up in the oom_adj index kept by the core kernel,
+ * highest oom_adj first, so only the processes in the highest populated
+ * oom_adj above the threshold are looked at.
+ *
+ * To let user-space trim caches before processes have to be killed, the
+ * reclaim pressure reported by the vm is turned into a level that can be
+ * read and polled from /dev/lowmemorykiller. Pressure at or above the
+ * pressure_medium and pressure_critical parameters (percentage of
+ * scanned pages that could not be reclaimed) reports "medium" and
+ * "critical", any other reclaim "low". poll() signals a new level since
+ * the last read. The events parameter counts the events of each level,
+ * the kills parameter the processes killed.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -35,6 +48,11 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/swap.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,6 +73,28 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+enum {
+	LOWMEM_PRESSURE_NONE,
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+	LOWMEM_PRESSURE_LEVELS
+};
+
+static const char *lowmem_pressure_names[LOWMEM_PRESSURE_LEVELS] = {
+	"none", "low", "medium", "critical"
+};
+
+static uint32_t lowmem_pressure_medium = 60;
+static uint32_t lowmem_pressure_critical = 95;
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+static int lowmem_pressure_level;
+static unsigned long lowmem_pressure_seq;	/* bumped on every event */
+static uint32_t lowmem_pressure_events[LOWMEM_PRESSURE_LEVELS];
+static unsigned int lowmem_pressure_events_size = LOWMEM_PRESSURE_LEVELS;
+static uint32_t lowmem_kills;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -79,13 +119,100 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+static int
+vmpressure_notify_func(struct notifier_block *self, unsigned long pressure,
+		       void *data)
+{
+	int level = LOWMEM_PRESSURE_LOW;
+
+	if (pressure >= lowmem_pressure_critical)
+		level = LOWMEM_PRESSURE_CRITICAL;
+	else if (pressure >= lowmem_pressure_medium)
+		level = LOWMEM_PRESSURE_MEDIUM;
+
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_pressure_level = level;
+	lowmem_pressure_seq++;
+	lowmem_pressure_events[level]++;
+	spin_unlock(&lowmem_pressure_lock);
+	wake_up_interruptible(&lowmem_pressure_wait);
+
+	lowmem_print(4, "vmpressure %lu, level %s\n", pressure,
+		     lowmem_pressure_names[level]);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block vmpressure_nb = {
+	.notifier_call	= vmpressure_notify_func,
+};
+
+/*
+ * file->private_data holds the event sequence number this reader has
+ * seen, so poll() only fires for events after the last read.
+ */
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	spin_lock(&lowmem_pressure_lock);
+	file->private_data = (void *)lowmem_pressure_seq;
+	spin_unlock(&lowmem_pressure_lock);
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	char level[16];
+	int len;
+
+	spin_lock(&lowmem_pressure_lock);
+	len = snprintf(level, sizeof(level), "%s\n",
+		       lowmem_pressure_names[lowmem_pressure_level]);
+	file->private_data = (void *)lowmem_pressure_seq;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, level, len))
+		return -EFAULT;
+	return len;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	unsigned int mask = 0;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	spin_lock(&lowmem_pressure_lock);
+	if (file->private_data != (void *)lowmem_pressure_seq)
+		mask = POLLIN | POLLRDNORM;
+	spin_unlock(&lowmem_pressure_lock);
+	return mask;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmemorykiller",
+	.fops = &lowmem_pressure_fops,
+};
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
+	struct hlist_node *pos;
 	struct task_struct *selected = NULL;
+	unsigned long flags;
 	int rem = 0;
 	int tasksize;
 	int i;
+	int oom_adj;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
@@ -129,55 +256,61 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
 	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	/*
+	 * A higher oom_adj always wins over a larger size, so the first
+	 * populated list with a live process holds the victim.
+	 */
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		hlist_for_each_entry(p, pos, oom_adj_index_head(oom_adj),
+				     oom_adj_node) {
+			struct mm_struct *mm;
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	if (selected)
+		get_task_struct(selected);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
+		read_lock(&tasklist_lock);
+		if (pid_alive(selected))
+			force_sig(SIGKILL, selected);
+		read_unlock(&tasklist_lock);
+		lowmem_kills++;
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,6 +321,12 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	int ret;
+
+	ret = misc_register(&lowmem_pressure_misc);
+	if (ret)
+		return ret;
+	vmpressure_register_notifier(&vmpressure_nb);
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
@@ -197,6 +336,8 @@ static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
+	vmpressure_unregister_notifier(&vmpressure_nb);
+	misc_deregister(&lowmem_pressure_misc);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +346,13 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_array_named(events, lowmem_pressure_events, uint,
+			 &lowmem_pressure_events_size, S_IRUGO);
+module_param_named(kills, lowmem_kills, uint, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -284,9 +284,9 @@ static int grow_pool(struct xv_pool *pool, gfp_t flags)
 	if (unlikely(!page))
 		return -ENOMEM;
 
-	stat_inc(&pool->total_pages);
-
 	spin_lock(&pool->lock);
+	stat_inc(&pool->total_pages);
+	list_add_tail(&page->lru, &pool->page_list);
 	block = get_ptr_atomic(page, 0, KM_USER0);
 
 	block->size = PAGE_SIZE - XV_ALIGN;
@@ -317,6 +317,7 @@ struct xv_pool *xv_create_pool(void)
 		return NULL;
 
 	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->page_list);
 
 	return pool;
 }
@@ -326,53 +327,23 @@ void xv_destroy_pool(struct xv_pool *pool)
 	kfree(pool);
 }
 
-/**
- * xv_malloc - Allocate block of given size from pool.
- * @pool: pool to allocate from
- * @size: size of block to allocate
- * @page: page no. that holds the object
- * @offset: location of object within page
- *
- * On success, <page, offset> identifies block allocated
- * and 0 is returned. On failure, <page, offset> is set to
- * 0 and -ENOMEM is returned.
- *
- * Allocation requests with size > XV_MAX_ALLOC_SIZE will fail.
+/*
+ * Allocate block of given size from the free lists, without growing
+ * the pool. Called with pool->lock held.
  */
-int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
-		u32 *offset, gfp_t flags)
+static int __xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
+		u32 *offset)
 {
-	int error;
 	u32 index, tmpsize, origsize, tmpoffset;
 	struct block_header *block, *tmpblock;
 
-	*page = NULL;
-	*offset = 0;
 	origsize = size;
-
-	if (unlikely(!size || size > XV_MAX_ALLOC_SIZE))
-		return -ENOMEM;
-
 	size = ALIGN(size, XV_ALIGN);
 
-	spin_lock(&pool->lock);
-
+	*page = NULL;
 	index = find_block(pool, size, page, offset);
-
 	if (!*page) {
-		spin_unlock(&pool->lock);
-		if (flags & GFP_NOWAIT)
-			return -ENOMEM;
-		error = grow_pool(pool, flags);
-		if (unlikely(error))
-			return error;
-
-		spin_lock(&pool->lock);
-		index = find_block(pool, size, page, offset);
-	}
-
-	if (!*page) {
-		spin_unlock(&pool->lock);
+		*offset = 0;
 		return -ENOMEM;
 	}
 
@@ -407,25 +378,66 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 	clear_flag(block, BLOCK_FREE);
 
 	put_ptr_atomic(block, KM_USER0);
-	spin_unlock(&pool->lock);
 
+	pool->used_bytes += size + XV_ALIGN;
 	*offset += XV_ALIGN;
 
 	return 0;
 }
 
+/**
+ * xv_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @page: page no. that holds the object
+ * @offset: location of object within page
+ *
+ * On success, <page, offset> identifies block allocated
+ * and 0 is returned. On failure, <page, offset> is set to
+ * 0 and -ENOMEM is returned.
+ *
+ * Allocation requests with size > XV_MAX_ALLOC_SIZE will fail.
+ */
+int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
+		u32 *offset, gfp_t flags)
+{
+	int error;
+
+	*page = NULL;
+	*offset = 0;
+
+	if (unlikely(!size || size > XV_MAX_ALLOC_SIZE))
+		return -ENOMEM;
+
+	spin_lock(&pool->lock);
+	error = __xv_malloc(pool, size, page, offset);
+	spin_unlock(&pool->lock);
+
+	if (!error || (flags & GFP_NOWAIT))
+		return error;
+
+	error = grow_pool(pool, flags);
+	if (unlikely(error))
+		return error;
+
+	spin_lock(&pool->lock);
+	error = __xv_malloc(pool, size, page, offset);
+	spin_unlock(&pool->lock);
+
+	return error;
+}
+
 /*
- * Free block identified with <page, offset>
+ * Free block identified with <page, offset>.
+ * Called with pool->lock held.
  */
-void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
+static void __xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 {
 	void *page_start;
 	struct block_header *block, *tmpblock;
 
 	offset -= XV_ALIGN;
 
-	spin_lock(&pool->lock);
-
 	page_start = get_ptr_atomic(page, 0, KM_USER0);
 	block = (struct block_header *)((char *)page_start + offset);
 
@@ -433,6 +445,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	BUG_ON(test_flag(block, BLOCK_FREE));
 
 	block->size = ALIGN(block->size, XV_ALIGN);
+	pool->used_bytes -= block->size + XV_ALIGN;
 
 	tmpblock = BLOCK_NEXT(block);
 	if (offset + block->size + XV_ALIGN == PAGE_SIZE)
@@ -469,10 +482,10 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	/* No used objects in this page. Free it. */
 	if (block->size == PAGE_SIZE - XV_ALIGN) {
 		put_ptr_atomic(page_start, KM_USER0);
-		spin_unlock(&pool->lock);
+		stat_dec(&pool->total_pages);
+		list_del(&page->lru);
 
 		__free_page(page);
-		stat_dec(&pool->total_pages);
 		return;
 	}
 
@@ -487,6 +500,12 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	}
 
 	put_ptr_atomic(page_start, KM_USER0);
+}
+
+void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
+{
+	spin_lock(&pool->lock);
+	__xv_free(pool, page, offset);
 	spin_unlock(&pool->lock);
 }
 
@@ -505,3 +524,208 @@ u64 xv_get_total_size_bytes(struct xv_pool *pool)
 {
 	return pool->total_pages << PAGE_SHIFT;
 }
+
+/*
+ * Returns memory taken by allocated blocks, including their headers
+ */
+u64 xv_get_used_size_bytes(struct xv_pool *pool)
+{
+	return pool->used_bytes;
+}
+
+/*
+ * Compaction support: objects are moved out of sparsely used pages
+ * into free blocks of other pages so that the emptied pages can be
+ * returned to the system.
+ */
+
+/*
+ * Returns bytes taken by allocated blocks in the given page.
+ * Called with pool->lock held.
+ */
+static u32 page_used_bytes(struct page *page)
+{
+	u32 offset = 0, used = 0;
+	char *page_start;
+	struct block_header *block;
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+	while (offset < PAGE_SIZE) {
+		block = (struct block_header *)(page_start + offset);
+		if (!test_flag(block, BLOCK_FREE))
+			used += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+	}
+	put_ptr_atomic(page_start, KM_USER0);
+
+	return used;
+}
+
+/*
+ * Take free blocks of the page off (detach) or put them back on
+ * (attach) the free lists. While detached, no allocation can be
+ * satisfied from the page. Called with pool->lock held.
+ */
+static void detach_page(struct xv_pool *pool, struct page *page, int attach)
+{
+	u32 offset = 0;
+	char *page_start;
+	struct block_header *block;
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+	while (offset < PAGE_SIZE) {
+		block = (struct block_header *)(page_start + offset);
+		if (test_flag(block, BLOCK_FREE) &&
+				block->size >= XV_MIN_ALLOC_SIZE) {
+			if (attach)
+				insert_block(pool, page, offset, block);
+			else
+				remove_block(pool, page, offset, block,
+					get_index_for_insert(block->size));
+		}
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+	}
+	put_ptr_atomic(page_start, KM_USER0);
+}
+
+/*
+ * Free block at 'offset' (block header) in a detached page, merging
+ * it with free neighbours but leaving the free lists alone. Returns
+ * offset of the resulting free block.
+ */
+static u32 free_detached_block(struct xv_pool *pool, char *page_start,
+			u32 offset)
+{
+	struct block_header *block, *tmpblock;
+
+	block = (struct block_header *)(page_start + offset);
+	block->size = ALIGN(block->size, XV_ALIGN);
+	pool->used_bytes -= block->size + XV_ALIGN;
+
+	/* Merge next block if its free */
+	if (offset + block->size + XV_ALIGN != PAGE_SIZE) {
+		tmpblock = BLOCK_NEXT(block);
+		if (test_flag(tmpblock, BLOCK_FREE))
+			block->size += tmpblock->size + XV_ALIGN;
+	}
+
+	/* Merge previous block if its free */
+	if (test_flag(block, PREV_FREE)) {
+		offset = get_blockprev(block);
+		tmpblock = (struct block_header *)(page_start + offset);
+		tmpblock->size += block->size + XV_ALIGN;
+		block = tmpblock;
+	}
+
+	set_flag(block, BLOCK_FREE);
+	if (offset + block->size + XV_ALIGN != PAGE_SIZE) {
+		tmpblock = BLOCK_NEXT(block);
+		set_flag(tmpblock, PREV_FREE);
+		set_blockprev(tmpblock, offset);
+	}
+
+	return offset;
+}
+
+/*
+ * Move all objects out of the given page. Returns 1 if the page
+ * could be emptied and was freed, 0 otherwise.
+ * Called with pool->lock held.
+ */
+static int compact_page(struct xv_pool *pool, struct page *page,
+			xv_move_fn move, void *priv)
+{
+	int ret, is_free;
+	u32 offset, size, new_offset;
+	char *page_start;
+	unsigned char *src, *dst;
+	struct page *new_page;
+	struct block_header *block;
+
+	detach_page(pool, page, 0);
+
+	offset = 0;
+	while (offset < PAGE_SIZE) {
+		page_start = get_ptr_atomic(page, 0, KM_USER0);
+		block = (struct block_header *)(page_start + offset);
+		size = block->size;
+		is_free = test_flag(block, BLOCK_FREE);
+		put_ptr_atomic(page_start, KM_USER0);
+
+		if (is_free) {
+			offset += size + XV_ALIGN;
+			continue;
+		}
+
+		if (__xv_malloc(pool, size, &new_page, &new_offset))
+			break;
+
+		src = get_ptr_atomic(page, offset + XV_ALIGN, KM_USER0);
+		dst = get_ptr_atomic(new_page, new_offset, KM_USER1);
+		memcpy(dst, src, size);
+		ret = move(dst, page, offset + XV_ALIGN,
+				new_page, new_offset, priv);
+		put_ptr_atomic(dst, KM_USER1);
+		put_ptr_atomic(src, KM_USER0);
+
+		/* Owner could not let go of this object: leave it here */
+		if (ret) {
+			__xv_free(pool, new_page, new_offset);
+			break;
+		}
+
+		page_start = get_ptr_atomic(page, 0, KM_USER0);
+		offset = free_detached_block(pool, page_start, offset);
+		block = (struct block_header *)(page_start + offset);
+		size = block->size;
+		put_ptr_atomic(page_start, KM_USER0);
+
+		offset += size + XV_ALIGN;
+	}
+
+	if (offset < PAGE_SIZE) {
+		detach_page(pool, page, 1);
+		return 0;
+	}
+
+	stat_dec(&pool->total_pages);
+	list_del(&page->lru);
+	__free_page(page);
+
+	return 1;
+}
+
+/**
+ * xv_compact - Free sparsely used pages by moving their objects.
+ * @pool: pool to compact
+ * @nr_pages: no. of pool pages to examine
+ * @move: called for each object moved, see xv_move_fn
+ * @priv: passed to @move
+ *
+ * Pages less than half full are emptied when the free blocks of the
+ * rest of the pool can hold their objects; the pool is never grown.
+ * Pages are examined in round-robin order so that successive calls
+ * with small @nr_pages eventually cover the whole pool.
+ *
+ * Returns no. of pages freed.
+ */
+u32 xv_compact(struct xv_pool *pool, u32 nr_pages,
+			xv_move_fn move, void *priv)
+{
+	u32 freed = 0;
+	struct page *page;
+
+	spin_lock(&pool->lock);
+	while (nr_pages-- && !list_empty(&pool->page_list)) {
+		page = list_first_entry(&pool->page_list, struct page, lru);
+		list_move_tail(&page->lru, &pool->page_list);
+
+		if (page_used_bytes(page) > PAGE_SIZE / 2)
+			continue;
+
+		freed += compact_page(pool, page, move, priv);
+	}
+	spin_unlock(&pool->lock);
+
+	return freed;
+}
@@ -26,5 +26,19 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset);
 
 u32 xv_get_object_size(void *obj);
 u64 xv_get_total_size_bytes(struct xv_pool *pool);
+u64 xv_get_used_size_bytes(struct xv_pool *pool);
+
+/*
+ * Called by xv_compact() once an object has been copied to
+ * <new_page, new_offset>; obj points to the new copy. Must return 0
+ * after updating all references to the object, or nonzero to keep it
+ * at <old_page, old_offset>. Called under the pool lock with atomic
+ * kmaps held: must not sleep or use KM_USER0/KM_USER1.
+ */
+typedef int (*xv_move_fn)(void *obj, struct page *old_page, u32 old_offset,
+			struct page *new_page, u32 new_offset, void *priv);
+
+u32 xv_compact(struct xv_pool *pool, u32 nr_pages,
+			xv_move_fn move, void *priv);
 
 #endif
@@ -14,6 +14,7 @@
 #define _XV_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/list.h>
 #include <linux/types.h>
 
 /* User configurable params */
@@ -79,8 +80,12 @@ struct xv_pool {
 
 	struct freelist_entry freelist[NUM_FREE_LISTS];
 
+	/* all pages of the pool, linked through page->lru */
+	struct list_head page_list;
+
 	/* stats */
 	u64 total_pages;
+	u64 used_bytes;
 };
 
 #endif
@@ -22,18 +22,24 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
+#include <linux/uaccess.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
 /* Globals */
 static int zram_major;
 static struct zram *devices;
+static struct kmem_cache *zram_dedup_cache;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
@@ -71,6 +77,89 @@ static int page_zero_filled(void *ptr)
 	return 1;
 }
 
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_strm *zstrm, *tmp;
+
+	list_for_each_entry_safe(zstrm, tmp, &zram->idle_strm, list) {
+		list_del(&zstrm->list);
+		crypto_free_comp(zstrm->tfm);
+		free_pages((unsigned long)zstrm->buffer, 1);
+		kfree(zstrm);
+	}
+}
+
+/*
+ * Allocate one compression stream per online CPU. Each stream has its
+ * own transform of the selected compressor and a 2-page output buffer
+ * (compressed output of an incompressible page can exceed PAGE_SIZE).
+ */
+static int zram_create_streams(struct zram *zram)
+{
+	int i;
+	struct zram_strm *zstrm;
+
+	for (i = 0; i < num_online_cpus(); i++) {
+		zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+		if (!zstrm)
+			goto fail;
+
+		zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(zstrm->tfm)) {
+			kfree(zstrm);
+			goto fail;
+		}
+
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->buffer) {
+			crypto_free_comp(zstrm->tfm);
+			kfree(zstrm);
+			goto fail;
+		}
+
+		list_add(&zstrm->list, &zram->idle_strm);
+	}
+
+	return 0;
+
+fail:
+	zram_destroy_streams(zram);
+	return -ENOMEM;
+}
+
+/*
+ * Get an idle compression stream, sleeping until one is released
+ * if all of them are busy.
+ */
+static struct zram_strm *zram_stream_get(struct zram *zram)
+{
+	struct zram_strm *zstrm;
+
+	while (1) {
+		spin_lock(&zram->strm_lock);
+		if (!list_empty(&zram->idle_strm)) {
+			zstrm = list_entry(zram->idle_strm.next,
+					struct zram_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&zram->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&zram->strm_lock);
+
+		wait_event(zram->strm_wait, !list_empty(&zram->idle_strm));
+	}
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_strm *zstrm)
+{
+	spin_lock(&zram->strm_lock);
+	list_add(&zstrm->list, &zram->idle_strm);
+	spin_unlock(&zram->strm_lock);
+
+	if (waitqueue_active(&zram->strm_wait))
+		wake_up(&zram->strm_wait);
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -143,14 +232,422 @@ static void zram_ioctl_get_stats(struct zram *zram,
 #endif /* CONFIG_ZRAM_STATS */
 }
 
+static void zram_ioctl_get_ext_stats(struct zram *zram,
+			struct zram_ioctl_ext_stats *s)
+{
+#if defined(CONFIG_ZRAM_STATS)
+	struct zram_stats *rs = &zram->stats;
+
+	s->dedup_hits = zram_stat64_read(zram, &rs->dedup_hits);
+	s->pages_dedup = rs->pages_dedup;
+	s->pages_compacted = zram_stat64_read(zram, &rs->pages_compacted);
+	s->compact_before = rs->compact_before;
+	s->compact_after = rs->compact_after;
+	s->pages_wb = rs->pages_wb;
+	s->bd_reads = zram_stat64_read(zram, &rs->bd_reads);
+	s->bd_writes = zram_stat64_read(zram, &rs->bd_writes);
+#endif /* CONFIG_ZRAM_STATS */
+}
+
+static u32 zram_checksum(void *mem)
+{
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[hash_32(checksum, zram->dedup_hash_bits)];
+}
+
+/*
+ * Look for a stored object holding the same data as user_mem and, if
+ * found, take a reference on it. Candidates with a matching checksum
+ * are decompressed into the stream buffer and compared byte by byte.
+ * Called with zram->tb_lock held for reading: writers look up in
+ * parallel and the reference taken keeps the object alive until the
+ * caller links it into the table under the write lock.
+ */
+static int zram_dedup_get(struct zram *zram, struct zram_strm *zstrm,
+			void *user_mem, u32 checksum,
+			struct page **page, u32 *offset, unsigned int *clen)
+{
+	int ret;
+	unsigned int dlen;
+	unsigned char *cmem;
+	struct zram_dedup *zd;
+	struct hlist_node *pos;
+	struct zobj_header *zheader;
+
+	hlist_for_each_entry(zd, pos, zram_dedup_bucket(zram, checksum), node) {
+		if (zd->checksum != checksum)
+			continue;
+
+		cmem = kmap_atomic(zd->page, KM_USER1) + zd->offset;
+		zheader = (struct zobj_header *)cmem;
+		*clen = xv_get_object_size(cmem) - sizeof(*zheader);
+		dlen = PAGE_SIZE;
+
+		ret = crypto_comp_decompress(zstrm->tfm,
+			cmem + sizeof(*zheader), *clen,
+			zstrm->buffer, &dlen);
+
+		if (!ret && dlen == PAGE_SIZE &&
+		    !memcmp(zstrm->buffer, user_mem, PAGE_SIZE)) {
+			atomic_inc(&zheader->count);
+			kunmap_atomic(cmem, KM_USER1);
+
+			*page = zd->page;
+			*offset = zd->offset;
+			return 1;
+		}
+		kunmap_atomic(cmem, KM_USER1);
+	}
+
+	return 0;
+}
+
+/* Called with zram->tb_lock held for writing */
+static void zram_dedup_add(struct zram *zram, struct zram_dedup *zd,
+			struct page *page, u32 offset, u32 checksum)
+{
+	zd->page = page;
+	zd->offset = offset;
+	zd->checksum = checksum;
+	hlist_add_head(&zd->node, zram_dedup_bucket(zram, checksum));
+}
+
+/* Called with zram->tb_lock held for writing */
+static void zram_dedup_del(struct zram *zram, struct page *page,
+			u32 offset, u32 checksum)
+{
+	struct zram_dedup *zd;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(zd, pos, zram_dedup_bucket(zram, checksum), node) {
+		if (zd->page == page && zd->offset == offset) {
+			hlist_del(&zd->node);
+			kmem_cache_free(zram_dedup_cache, zd);
+			return;
+		}
+	}
+}
+
+/* Called with zram->tb_lock held for writing */
+static void zram_dedup_move(struct zram *zram, u32 checksum,
+			struct page *old_page, u32 old_offset,
+			struct page *new_page, u32 new_offset)
+{
+	struct zram_dedup *zd;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(zd, pos, zram_dedup_bucket(zram, checksum), node) {
+		if (zd->page == old_page && zd->offset == old_offset) {
+			zd->page = new_page;
+			zd->offset = new_offset;
+			return;
+		}
+	}
+}
+
+/*
+ * xv_compact() callback: point the table entry owning the object at
+ * its new location. Objects that are shared, or still being written
+ * (not yet published in the table), are left where they are.
+ * Called with zram->tb_lock held for writing.
+ */
+static int zram_move_object(void *obj, struct page *old_page, u32 old_offset,
+			struct page *new_page, u32 new_offset, void *priv)
+{
+	struct zram *zram = priv;
+	struct zobj_header *zheader = obj;
+	u32 index = zheader->table_idx;
+
+	if (index >= zram->disksize >> PAGE_SHIFT ||
+	    zram->table[index].page != old_page ||
+	    zram->table[index].offset != old_offset ||
+	    zram_test_flag(zram, index, ZRAM_UNCOMPRESSED) ||
+	    zram_test_flag(zram, index, ZRAM_WB))
+		return -EBUSY;
+
+	if (atomic_read(&zheader->count) != 1)
+		return -EBUSY;
+
+	zram->table[index].page = new_page;
+	zram->table[index].offset = new_offset;
+	zram_dedup_move(zram, zheader->checksum, old_page, old_offset,
+			new_page, new_offset);
+
+	return 0;
+}
+
+/*
+ * Examine nr_pages pages of the xvmalloc pool, moving objects out of
+ * sparsely used ones so they can be freed. Returns no. of pages freed.
+ */
+static u32 zram_compact(struct zram *zram, u32 nr_pages)
+{
+	u32 batch, freed = 0;
+
+	while (nr_pages) {
+		batch = min(nr_pages, compact_batch_pages);
+
+		write_lock(&zram->tb_lock);
+		freed += xv_compact(zram->mem_pool, batch,
+					zram_move_object, zram);
+		write_unlock(&zram->tb_lock);
+
+		nr_pages -= batch;
+		cond_resched();
+	}
+
+	zram_stat64_add(zram, &zram->stats.pages_compacted, freed);
+	return freed;
+}
+
+/* No. of pool pages compaction could free at best */
+static int zram_compactable_pages(struct zram *zram)
+{
+	u64 total, used;
+
+	total = xv_get_total_size_bytes(zram->mem_pool) >> PAGE_SHIFT;
+	used = DIV_ROUND_UP(xv_get_used_size_bytes(zram->mem_pool),
+				PAGE_SIZE);
+
+	return total > used ? total - used : 0;
+}
+
+/*
+ * Compact the pool on memory pressure. Never waits for zram->tb_lock:
+ * if I/O is in progress, reclaim moves on to other caches.
+ */
+static int zram_shrink(struct shrinker *shrinker, int nr_to_scan,
+			gfp_t gfp_mask)
+{
+	u32 freed;
+	struct zram *zram = container_of(shrinker, struct zram, shrinker);
+
+	if (nr_to_scan) {
+		if (!write_trylock(&zram->tb_lock))
+			return -1;
+		freed = xv_compact(zram->mem_pool, nr_to_scan,
+					zram_move_object, zram);
+		write_unlock(&zram->tb_lock);
+
+		zram_stat64_add(zram, &zram->stats.pages_compacted, freed);
+	}
+
+	return zram_compactable_pages(zram);
+}
+
+static void zram_release_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_file)
+		return;
+
+	if (zram->backing_bdev) {
+		bd_release(zram->backing_bdev);
+		zram->backing_bdev = NULL;
+	}
+	fput(zram->backing_file);
+	zram->backing_file = NULL;
+	vfree(zram->wb_bitmap);
+	zram->wb_bitmap = NULL;
+	zram->wb_nr_blks = 0;
+}
+
+/*
+ * Use the given file or block device to store pages moved out of
+ * memory by ZRAMIO_WRITEBACK. Only allowed before the device is
+ * initialized. A block device is claimed for exclusive use.
+ */
+static int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	struct file *file;
+	struct inode *inode;
+	struct block_device *bdev = NULL;
+	unsigned long nr_blks, *bitmap;
+
+	file = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file)) {
+		pr_info("Unable to open backing device %s\n", path);
+		return PTR_ERR(file);
+	}
+
+	inode = file->f_path.dentry->d_inode;
+	if (!S_ISBLK(inode->i_mode) && !S_ISREG(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto fail;
+	}
+
+	/* Block 0 is never used, see zram_alloc_blk() */
+	nr_blks = i_size_read(file->f_mapping->host) >> PAGE_SHIFT;
+	if (nr_blks < 2) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	if (S_ISBLK(inode->i_mode)) {
+		bdev = I_BDEV(inode);
+		if (bdev->bd_disk == zram->disk) {
+			ret = -EINVAL;
+			goto fail;
+		}
+		ret = bd_claim(bdev, zram);
+		if (ret) {
+			pr_info("Backing device %s is busy\n", path);
+			goto fail;
+		}
+	}
+
+	bitmap = vmalloc(BITS_TO_LONGS(nr_blks) * sizeof(long));
+	if (!bitmap) {
+		if (bdev)
+			bd_release(bdev);
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(bitmap, 0, BITS_TO_LONGS(nr_blks) * sizeof(long));
+
+	zram_release_backing_dev(zram);
+	zram->backing_file = file;
+	zram->backing_bdev = bdev;
+	zram->wb_bitmap = bitmap;
+	zram->wb_nr_blks = nr_blks;
+
+	pr_info("Backing device set to %s (%lu pages)\n", path, nr_blks);
+	return 0;
+
+fail:
+	filp_close(file, NULL);
+	return ret;
+}
+
+/*
+ * Allocate a free page-sized block on the backing device. Block 0 is
+ * reserved so that a written back table entry never has a zero blk.
+ * Returns 0 if the backing device is full.
+ */
+static unsigned long zram_alloc_blk(struct zram *zram)
+{
+	unsigned long blk;
+
+	do {
+		blk = find_next_zero_bit(zram->wb_bitmap, zram->wb_nr_blks, 1);
+		if (blk >= zram->wb_nr_blks)
+			return 0;
+	} while (test_and_set_bit(blk, zram->wb_bitmap));
+
+	return blk;
+}
+
+static void zram_free_blk(struct zram *zram, unsigned long blk)
+{
+	clear_bit(blk, zram->wb_bitmap);
+}
+
+static int zram_backing_rw(struct zram *zram, struct page *page,
+			unsigned long blk, int rw)
+{
+	ssize_t ret;
+	void *mem;
+	mm_segment_t old_fs;
+	loff_t pos = (loff_t)blk << PAGE_SHIFT;
+
+	mem = kmap(page);
+	old_fs = get_fs();
+	set_fs(get_ds());
+	if (rw == READ)
+		ret = vfs_read(zram->backing_file, (char __user *)mem,
+				PAGE_SIZE, &pos);
+	else
+		ret = vfs_write(zram->backing_file, (const char __user *)mem,
+				PAGE_SIZE, &pos);
+	set_fs(old_fs);
+	kunmap(page);
+
+	/* The data is in page now, do not keep a second copy cached */
+	if (rw == READ)
+		invalidate_mapping_pages(zram->backing_file->f_mapping,
+					blk, blk);
+
+	if (ret == PAGE_SIZE)
+		return 0;
+
+	return ret < 0 ? ret : -EIO;
+}
+
+/*
+ * Write blocks lo..hi out to the backing device and drop them from its
+ * page cache, which would otherwise hold on to the memory writeback is
+ * meant to free.
+ */
+static void zram_wb_flush(struct zram *zram, unsigned long lo,
+			unsigned long hi)
+{
+	struct file *file = zram->backing_file;
+
+	vfs_fsync_range(file, (loff_t)lo << PAGE_SHIFT,
+			((loff_t)(hi + 1) << PAGE_SHIFT) - 1, 1);
+	invalidate_mapping_pages(file->f_mapping, lo, hi);
+}
+
+struct zram_backing_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_read_backing_work(struct work_struct *work)
+{
+	struct zram_backing_work *bw =
+		container_of(work, struct zram_backing_work, work);
+
+	bw->ret = zram_backing_rw(bw->zram, bw->page, bw->blk, READ);
+}
+
+/*
+ * Read a written back page. Bios submitted from within a make_request
+ * function are only dispatched once it returns (see generic_make_request),
+ * so waiting here for I/O on a backing block device would never finish.
+ * The read is done from a worker instead.
+ */
+static int zram_read_backing(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_backing_work bw;
+
+	bw.zram = zram;
+	bw.page = page;
+	bw.blk = blk;
+	INIT_WORK_ON_STACK(&bw.work, zram_read_backing_work);
+
+	schedule_work(&bw.work);
+	flush_work(&bw.work);
+	destroy_work_on_stack(&bw.work);
+
+	return bw.ret;
+}
+
+/*
+ * Free memory associated with the given table entry.
+ * Called with zram->tb_lock held for writing.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
+	u32 clen, count, checksum;
 	void *obj;
+	struct zobj_header *zheader;
 
 	struct page *page = zram->table[index].page;
 	u32 offset = zram->table[index].offset;
 
+	/* Any access, and any pending writeback, is over */
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
 	if (unlikely(!page)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -163,6 +660,14 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_free_blk(zram, zram->table[index].blk);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram->table[index].blk = 0;
+		return;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
 		__free_page(page);
@@ -172,15 +677,27 @@ static void zram_free_page(struct zram *zram, size_t index)
 	}
 
 	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
+	zheader = obj;
+	clen = xv_get_object_size(obj) - sizeof(*zheader);
+	count = atomic_dec_return(&zheader->count);
+	checksum = zheader->checksum;
 	kunmap_atomic(obj, KM_USER0);
 
-	xv_free(zram->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	/* Object is still shared with other table entries */
+	if (count) {
+		zram_stat_dec(&zram->stats.pages_dedup);
+		goto out_shared;
+	}
+
+	zram_dedup_del(zram, page, offset, checksum);
+	xv_free(zram->mem_pool, page, offset);
+
 out:
 	zram->stats.compr_size -= clen;
+out_shared:
 	zram_stat_dec(&zram->stats.pages_stored);
 
 	zram->table[index].page = NULL;
@@ -220,36 +737,81 @@ static int zram_read(struct zram *zram, struct bio *bio)
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_strm *zstrm;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
+		unsigned int clen;
 		struct page *page;
 		struct zobj_header *zheader;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
+		zstrm = NULL;
+
+		/* Page is being accessed: it is no longer idle */
+		if (unlikely(zram_test_flag(zram, index, ZRAM_IDLE))) {
+			write_lock(&zram->tb_lock);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			write_unlock(&zram->tb_lock);
+		}
+
+again:
+		read_lock(&zram->tb_lock);
 
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			read_unlock(&zram->tb_lock);
 			handle_zero_page(page);
-			continue;
+			goto next;
+		}
+
+		/* Page was moved to the backing device */
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+			unsigned long blk = zram->table[index].blk;
+
+			read_unlock(&zram->tb_lock);
+
+			ret = zram_read_backing(zram, page, blk);
+			if (unlikely(ret)) {
+				pr_err("Backing device read failed! err=%d, "
+					"page=%u\n", ret, index);
+				zram_stat64_inc(zram, &zram->stats.failed_reads);
+				goto out;
+			}
+
+			zram_stat64_inc(zram, &zram->stats.bd_reads);
+			flush_dcache_page(page);
+			goto next;
 		}
 
 		/* Requested page is not present in compressed area */
 		if (unlikely(!zram->table[index].page)) {
+			read_unlock(&zram->tb_lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			/* Do nothing */
-			continue;
+			goto next;
 		}
 
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
-			continue;
+			read_unlock(&zram->tb_lock);
+			goto next;
+		}
+
+		/*
+		 * Some compressors keep decompression state in the transform,
+		 * so a stream is needed. Getting one may sleep: drop tb_lock
+		 * and look at the entry again, it may have changed meanwhile.
+		 */
+		if (!zstrm) {
+			read_unlock(&zram->tb_lock);
+			zstrm = zram_stream_get(zram);
+			goto again;
 		}
 
 		user_mem = kmap_atomic(page, KM_USER0);
@@ -258,16 +820,17 @@ static int zram_read(struct zram *zram, struct bio *bio)
 		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
 				zram->table[index].offset;
 
-		ret = lzo1x_decompress_safe(
+		ret = crypto_comp_decompress(zstrm->tfm,
 			cmem + sizeof(*zheader),
 			xv_get_object_size(cmem) - sizeof(*zheader),
 			user_mem, &clen);
 
 		kunmap_atomic(user_mem, KM_USER0);
 		kunmap_atomic(cmem, KM_USER1);
+		read_unlock(&zram->tb_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -275,6 +838,9 @@ static int zram_read(struct zram *zram, struct bio *bio)
 		}
 
 		flush_dcache_page(page);
+next:
+		if (zstrm)
+			zram_stream_put(zram, zstrm);
 		index++;
 	}
 
@@ -283,10 +849,18 @@ static int zram_read(struct zram *zram, struct bio *bio)
 	return 0;
 
 out:
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
 	bio_io_error(bio);
 	return 0;
 }
 
+/*
+ * Pages are compressed outside of any device-wide lock, using one of the
+ * per-device compression streams, so writers on different CPUs proceed
+ * in parallel. zram->tb_lock is only taken to publish the new object in
+ * the table (and free the old one).
+ */
 static int zram_write(struct zram *zram, struct bio *bio)
 {
 	int i;
@@ -298,42 +872,74 @@ static int zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
+		int ret, uncompressed = 0;
+		u32 offset, checksum;
+		unsigned int clen;
 		struct zobj_header *zheader;
+		struct zram_strm *zstrm;
+		struct zram_dedup *zd;
 		struct page *page, *page_store;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
 
-		mutex_lock(&zram->lock);
+		/* May sleep: must be called before kmap_atomic() */
+		zstrm = zram_stream_get(zram);
 
 		user_mem = kmap_atomic(page, KM_USER0);
 		if (page_zero_filled(user_mem)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
+			zram_stream_put(zram, zstrm);
+
+			/*
+			 * System overwrites unused sectors. Free memory
+			 * associated with this sector now.
+			 */
+			write_lock(&zram->tb_lock);
+			zram_free_page(zram, index);
 			zram_stat_inc(&zram->stats.pages_zero);
 			zram_set_flag(zram, index, ZRAM_ZERO);
+			write_unlock(&zram->tb_lock);
+			index++;
+			continue;
+		}
+
+		/* Share an already stored copy of this page if there is one */
+		checksum = zram_checksum(user_mem);
+		read_lock(&zram->tb_lock);
+		ret = zram_dedup_get(zram, zstrm, user_mem, checksum,
+					&page_store, &offset, &clen);
+		read_unlock(&zram->tb_lock);
+		if (ret) {
+			kunmap_atomic(user_mem, KM_USER0);
+
+			write_lock(&zram->tb_lock);
+			zram_free_page(zram, index);
+			zram->table[index].page = page_store;
+			zram->table[index].offset = offset;
+
+			zram_stat_inc(&zram->stats.pages_dedup);
+			zram_stat_inc(&zram->stats.pages_stored);
+			if (clen <= PAGE_SIZE / 2)
+				zram_stat_inc(&zram->stats.good_compress);
+			write_unlock(&zram->tb_lock);
+
+			zram_stream_put(zram, zstrm);
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			index++;
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		src = zstrm->buffer;
+		clen = 2 * PAGE_SIZE;
+
+		ret = crypto_comp_compress(zstrm->tfm, user_mem, PAGE_SIZE,
+					src, &clen);
 
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_stream_put(zram, zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -345,10 +951,12 @@ static int zram_write(struct zram *zram, struct bio *bio)
 		 * errors which has side effect of hanging the system.
 		 */
 		if (unlikely(clen > max_zpage_size)) {
+			zram_stream_put(zram, zstrm);
+			zstrm = NULL;
+
 			clen = PAGE_SIZE;
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -357,43 +965,65 @@ static int zram_write(struct zram *zram, struct bio *bio)
 			}
 
 			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
+			uncompressed = 1;
 			src = kmap_atomic(page, KM_USER0);
 			goto memstore;
 		}
 
 		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
+				&page_store, &offset,
 				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+			zram_stream_put(zram, zstrm);
 			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
+				"page: %u, size=%u\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
 memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = kmap_atomic(page_store, KM_USER1) + offset;
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		if (!uncompressed) {
 			zheader = (struct zobj_header *)cmem;
+			zheader->checksum = checksum;
+			atomic_set(&zheader->count, 1);
+			/* Back-reference needed for memory defragmentation */
 			zheader->table_idx = index;
 			cmem += sizeof(*zheader);
 		}
-#endif
 
 		memcpy(cmem, src, clen);
 
 		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
+		if (unlikely(uncompressed))
 			kunmap_atomic(src, KM_USER0);
+		else
+			zram_stream_put(zram, zstrm);
+
+		/*
+		 * Index the new object for deduplication. Failing to get
+		 * a hash entry only means later copies are not shared.
+		 */
+		zd = NULL;
+		if (!uncompressed)
+			zd = kmem_cache_alloc(zram_dedup_cache, GFP_NOIO);
+
+		write_lock(&zram->tb_lock);
+
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		zram_free_page(zram, index);
+
+		zram->table[index].page = page_store;
+		zram->table[index].offset = offset;
+		if (unlikely(uncompressed)) {
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+			zram_stat_inc(&zram->stats.pages_expand);
+		} else if (zd) {
+			zram_dedup_add(zram, zd, page_store, offset, checksum);
+		}
 
 		/* Update stats */
 		zram->stats.compr_size += clen;
@@ -401,7 +1031,7 @@ memstore:
 		if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
 
-		mutex_unlock(&zram->lock);
+		write_unlock(&zram->tb_lock);
 		index++;
 	}
 
@@ -467,36 +1097,30 @@ static void reset_device(struct zram *zram)
 {
 	size_t index;
 
+	if (zram->init_done)
+		unregister_shrinker(&zram->shrinker);
+
 	/* Do not accept any new I/O request */
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_destroy_streams(zram);
 
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+	/*
+	 * Free all pages that are still in this zram device. Objects may
+	 * be shared, so go through zram_free_page() to honour refcounts.
+	 */
+	if (zram->table) {
+		for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+			zram_free_page(zram, index);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+
 	xv_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
@@ -504,11 +1128,15 @@ static void reset_device(struct zram *zram)
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
 	zram->disksize = 0;
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
+
+	zram_release_backing_dev(zram);
 }
 
 static int zram_ioctl_init_device(struct zram *zram)
 {
-	int ret;
+	int i, ret;
 	size_t num_pages;
 
 	if (zram->init_done) {
@@ -518,17 +1146,10 @@ static int zram_ioctl_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression streams!\n",
+			zram->compressor);
 		goto fail;
 	}
 
@@ -543,6 +1164,18 @@ static int zram_ioctl_init_device(struct zram *zram)
 	}
 	memset(zram->table, 0, num_pages * sizeof(*zram->table));
 
+	/* Roughly one dedup hash bucket per 8 pages of disk */
+	zram->dedup_hash_bits = max_t(int, ilog2(num_pages | 1) - 3, 8);
+	zram->dedup_hash = vmalloc(sizeof(*zram->dedup_hash) <<
+				zram->dedup_hash_bits);
+	if (!zram->dedup_hash) {
+		pr_err("Error allocating zram dedup hash\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	for (i = 0; i < 1 << zram->dedup_hash_bits; i++)
+		INIT_HLIST_HEAD(&zram->dedup_hash[i]);
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
@@ -555,6 +1188,10 @@ static int zram_ioctl_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->shrinker.shrink = zram_shrink;
+	zram->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&zram->shrinker);
+
 	zram->init_done = 1;
 
 	pr_debug("Initialization done!\n");
@@ -567,6 +1204,213 @@ fail:
 	return ret;
 }
 
+static int zram_ioctl_compact(struct zram *zram)
+{
+	u32 freed;
+	u64 before;
+
+	before = xv_get_total_size_bytes(zram->mem_pool);
+	freed = zram_compact(zram, before >> PAGE_SHIFT);
+
+#if defined(CONFIG_ZRAM_STATS)
+	zram->stats.compact_before = before;
+	zram->stats.compact_after = xv_get_total_size_bytes(zram->mem_pool);
+#endif
+
+	pr_debug("Compaction freed %u pages\n", freed);
+	return 0;
+}
+
+/*
+ * Mark all pages held in memory idle. Pages still idle at the next
+ * ZRAMIO_WRITEBACK (ZRAM_WB_IDLE) have not been accessed in between.
+ */
+static int zram_ioctl_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->tb_lock);
+		if (zram->table[index].page &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->tb_lock);
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* Called with zram->tb_lock held */
+static int zram_wb_candidate(struct zram *zram, size_t index, u32 mode)
+{
+	if (!zram->table[index].page ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
+
+	if ((mode & ZRAM_WB_HUGE) &&
+	    zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		return 1;
+
+	if ((mode & ZRAM_WB_IDLE) && zram_test_flag(zram, index, ZRAM_IDLE))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Copy the (uncompressed) data of the given page into page and mark it
+ * ZRAM_UNDER_WB. Returns 0 if the page is not to be written back.
+ */
+static int zram_wb_prepare(struct zram *zram, size_t index, u32 mode,
+			struct page *page)
+{
+	int ret;
+	unsigned int clen;
+	struct zram_strm *zstrm;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
+
+	read_lock(&zram->tb_lock);
+	ret = zram_wb_candidate(zram, index, mode);
+	read_unlock(&zram->tb_lock);
+	if (!ret)
+		return 0;
+
+	zstrm = zram_stream_get(zram);
+	write_lock(&zram->tb_lock);
+
+	/* Page may have been rewritten or freed meanwhile */
+	if (!zram_wb_candidate(zram, index, mode)) {
+		ret = 0;
+		goto out;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		handle_uncompressed_page(zram, page, index);
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		ret = 1;
+		goto out;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
+
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
+			zram->table[index].offset;
+
+	ret = crypto_comp_decompress(zstrm->tfm,
+		cmem + sizeof(*zheader),
+		xv_get_object_size(cmem) - sizeof(*zheader),
+		user_mem, &clen);
+
+	kunmap_atomic(user_mem, KM_USER0);
+	kunmap_atomic(cmem, KM_USER1);
+
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%zu\n",
+			ret, index);
+		ret = 0;
+		goto out;
+	}
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	ret = 1;
+
+out:
+	write_unlock(&zram->tb_lock);
+	zram_stream_put(zram, zstrm);
+	return ret;
+}
+
+/*
+ * Move pages selected by mode (ZRAM_WB_*) to the backing device, freeing
+ * the memory they use. Pages written to, or freed, while their data is
+ * in flight lose ZRAM_UNDER_WB and are left in memory.
+ */
+static int zram_ioctl_writeback(struct zram *zram, u32 mode)
+{
+	int ret = 0;
+	size_t index;
+	u64 nr_written = 0;
+	unsigned int nr_batch = 0;
+	unsigned long blk, lo = ULONG_MAX, hi = 0;
+	struct page *page;
+
+	if (!zram->backing_file)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->wb_lock);
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		cond_resched();
+
+		ret = zram_wb_prepare(zram, index, mode, page);
+		if (!ret)
+			continue;
+
+		blk = zram_alloc_blk(zram);
+		if (!blk) {
+			write_lock(&zram->tb_lock);
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->tb_lock);
+			pr_info("Backing device full\n");
+			ret = -ENOSPC;
+			break;
+		}
+
+		ret = zram_backing_rw(zram, page, blk, WRITE);
+		if (!ret) {
+			lo = min(lo, blk);
+			hi = max(hi, blk);
+			if (++nr_batch == wb_batch_pages) {
+				zram_wb_flush(zram, lo, hi);
+				nr_batch = 0;
+				lo = ULONG_MAX;
+				hi = 0;
+			}
+		}
+
+		write_lock(&zram->tb_lock);
+		if (!ret && zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram->table[index].blk = blk;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat_inc(&zram->stats.pages_wb);
+			nr_written++;
+			blk = 0;
+		}
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+
+		if (blk)
+			zram_free_blk(zram, blk);
+
+		if (ret) {
+			pr_err("Backing device write failed! err=%d, "
+				"page=%zu\n", ret, index);
+			break;
+		}
+	}
+
+	if (nr_batch)
+		zram_wb_flush(zram, lo, hi);
+
+	mutex_unlock(&zram->wb_lock);
+	__free_page(page);
+
+	zram_stat64_add(zram, &zram->stats.bd_writes, nr_written);
+	pr_debug("Wrote back %llu pages\n", nr_written);
+
+	return ret;
+}
+
 static int zram_ioctl_reset_device(struct zram *zram)
 {
 	if (zram->init_done)
@@ -579,7 +1423,9 @@ static int zram_ioctl(struct block_device *bdev, fmode_t mode,
 			unsigned int cmd, unsigned long arg)
 {
 	int ret = 0;
+	u32 wb_mode;
 	size_t disksize_kb;
+	char compressor[ZRAM_MAX_COMP_NAME];
 
 	struct zram *zram = bdev->bd_disk->private_data;
 
@@ -619,10 +1465,100 @@ static int zram_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+	case ZRAMIO_GET_EXT_STATS:
+	{
+		struct zram_ioctl_ext_stats stats;
+		if (!zram->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		memset(&stats, 0, sizeof(stats));
+		zram_ioctl_get_ext_stats(zram, &stats);
+		if (copy_to_user((void *)arg, &stats, sizeof(stats)))
+			ret = -EFAULT;
+		break;
+	}
+	case ZRAMIO_SET_COMPRESSOR:
+		if (zram->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(compressor, (void *)arg,
+						sizeof(compressor))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		compressor[sizeof(compressor) - 1] = '\0';
+		if (!crypto_has_comp(compressor, 0, 0)) {
+			pr_info("Compressor %s not available\n", compressor);
+			ret = -EINVAL;
+			goto out;
+		}
+		strlcpy(zram->compressor, compressor,
+			sizeof(zram->compressor));
+		pr_info("Compressor set to %s\n", zram->compressor);
+		break;
+
+	case ZRAMIO_GET_COMPRESSOR:
+		if (copy_to_user((void *)arg, zram->compressor,
+						sizeof(zram->compressor)))
+			ret = -EFAULT;
+		break;
+
 	case ZRAMIO_INIT:
 		ret = zram_ioctl_init_device(zram);
 		break;
 
+	case ZRAMIO_COMPACT:
+		if (!zram->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		ret = zram_ioctl_compact(zram);
+		break;
+
+	case ZRAMIO_SET_BACKING_DEV:
+	{
+		char *path;
+		if (zram->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		path = kmalloc(ZRAM_MAX_PATH, GFP_KERNEL);
+		if (!path) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if (copy_from_user(path, (void *)arg, ZRAM_MAX_PATH)) {
+			kfree(path);
+			ret = -EFAULT;
+			goto out;
+		}
+		path[ZRAM_MAX_PATH - 1] = '\0';
+		ret = zram_set_backing_dev(zram, path);
+		kfree(path);
+		break;
+	}
+	case ZRAMIO_MARK_IDLE:
+		if (!zram->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		ret = zram_ioctl_mark_idle(zram);
+		break;
+
+	case ZRAMIO_WRITEBACK:
+		if (!zram->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		if (copy_from_user(&wb_mode, (void *)arg, sizeof(wb_mode))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		ret = zram_ioctl_writeback(zram, wb_mode);
+		break;
+
 	case ZRAMIO_RESET:
 		/* Do not reset an active device! */
 		if (bdev->bd_holders) {
@@ -651,7 +1587,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -665,8 +1603,14 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
+	rwlock_init(&zram->tb_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->strm_lock);
+	mutex_init(&zram->wb_lock);
+	INIT_LIST_HEAD(&zram->idle_strm);
+	init_waitqueue_head(&zram->strm_wait);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -738,11 +1682,18 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_dedup_cache = KMEM_CACHE(zram_dedup, 0);
+	if (!zram_dedup_cache) {
+		pr_warning("Unable to create dedup cache\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -772,6 +1723,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	kmem_cache_destroy(zram_dedup_cache);
 out:
 	return ret;
 }
@@ -787,11 +1740,13 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			reset_device(zram);
+		zram_release_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	kmem_cache_destroy(zram_dedup_cache);
 	pr_debug("Cleanup done!\n");
 }
 
@@ -16,7 +16,11 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/spinlock.h>
+#include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
+#include <linux/mm.h>
 
 #include "zram_ioctl.h"
 #include "xvmalloc.h"
@@ -30,13 +34,19 @@ static const unsigned max_num_devices = 32;
 /*
  * Stored at beginning of each compressed object.
  *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
+ * Identical pages share one object: count is the number of table
+ * entries pointing to it and checksum locates it in the dedup hash.
+ * References are taken under zram->tb_lock held for reading, so count
+ * is atomic.
+ *
+ * It also stores back-reference to table entry which points to this
+ * object. This is required to support memory defragmentation. Shared
+ * objects (count > 1) are never moved since only one entry is known.
  */
 struct zobj_header {
-#if 0
+	u32 checksum;
+	atomic_t count;
 	u32 table_idx;
-#endif
 };
 
 /*-- Configurable parameters */
@@ -44,6 +54,12 @@ struct zobj_header {
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/*
+ * Default compression algorithm; any crypto API compressor ("lzo",
+ * "lz4", "deflate", ...) can be selected per device before init.
+ */
+static const char *default_compressor = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -56,6 +72,18 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
  * otherwise, xv_malloc() would always return failure.
  */
 
+/*
+ * Max no. of xvmalloc pages examined by compaction before zram->tb_lock
+ * is dropped to let pending I/O through.
+ */
+static const unsigned compact_batch_pages = 64;
+
+/*
+ * Max no. of pages written back before they are flushed to the backing
+ * device and dropped from its page cache.
+ */
+static const unsigned wb_batch_pages = 32;
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -71,6 +99,15 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is stored on the backing device (table[page_no].blk) */
+	ZRAM_WB,
+
+	/* Page was not accessed since the last ZRAMIO_MARK_IDLE */
+	ZRAM_IDLE,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -78,12 +115,34 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
+	union {
+		struct page *page;
+		unsigned long blk;	/* backing device block (ZRAM_WB) */
+	};
 	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * Compression stream: compressor transform and output buffer for one
+ * compressor invocation. zram keeps one stream per online CPU so
+ * that concurrent writers do not serialize on a single buffer.
+ */
+struct zram_strm {
+	struct crypto_comp *tfm;
+	void *buffer;
+	struct list_head list;
+};
+
+/* Dedup hash entry, one for each compressed object */
+struct zram_dedup {
+	struct hlist_node node;
+	struct page *page;
+	u32 offset;
+	u32 checksum;
+};
+
 struct zram_stats {
 	/* basic stats */
 	size_t compr_size;	/* compressed size of pages stored -
@@ -96,24 +155,47 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dedup_hits;		/* no. of writes that shared an object */
+	u64 pages_compacted;	/* no. of pool pages freed by compaction */
+	u64 compact_before;	/* pool size before last compaction */
+	u64 compact_after;	/* pool size after last compaction */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written to backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_wb;		/* no. of pages on backing device */
 #endif
 };
 
 struct zram {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
 	struct table *table;
+	struct hlist_head *dedup_hash;	/* checksum -> compressed object */
+	unsigned int dedup_hash_bits;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t tb_lock;	/* protect table entries, dedup hash and
+				 * 32-bit stats */
+
+	struct shrinker shrinker;	/* compacts mem_pool under pressure */
+
+	/* idle compression streams */
+	struct list_head idle_strm;
+	spinlock_t strm_lock;	/* protect idle_strm list */
+	wait_queue_head_t strm_wait;	/* wait for a stream to go idle */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
+	char compressor[ZRAM_MAX_COMP_NAME];	/* crypto API algorithm */
+
+	/* optional backing device for idle and incompressible pages */
+	struct file *backing_file;
+	struct block_device *backing_bdev;	/* claimed, if a bdev */
+	unsigned long *wb_bitmap;	/* blocks in use on backing_file */
+	unsigned long wb_nr_blks;
+	struct mutex wb_lock;	/* serialize ZRAMIO_WRITEBACK */
 	/*
 	 * This is the limit on amount of *uncompressed* worth of data
 	 * we can store in a disk.
@@ -144,6 +226,13 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	spin_unlock(&zram->stat64_lock);
 }
 
+static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v + inc;
+	spin_unlock(&zram->stat64_lock);
+}
+
 static u64 zram_stat64_read(struct zram *zram, u64 *v)
 {
 	u64 val;
@@ -158,6 +247,7 @@ static u64 zram_stat64_read(struct zram *zram, u64 *v)
 #define zram_stat_inc(v)
 #define zram_stat_dec(v)
 #define zram_stat64_inc(r, v)
+#define zram_stat64_add(r, v, i)
 #define zram_stat64_read(r, v)
 #endif /* CONFIG_ZRAM_STATS */
 
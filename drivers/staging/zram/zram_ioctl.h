@@ -33,9 +33,41 @@ struct zram_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+/*
+ * Stats added after zram_ioctl_stats. That structure is part of the
+ * ZRAMIO_GET_STATS ioctl number and must not change.
+ */
+struct zram_ioctl_ext_stats {
+	u64 dedup_hits;		/* no. of writes that shared a stored page */
+	u32 pages_dedup;	/* no. of pages currently shared */
+	u64 pages_compacted;	/* no. of pool pages freed by compaction */
+	u64 compact_before;	/* pool size before last ZRAMIO_COMPACT */
+	u64 compact_after;	/* pool size after last ZRAMIO_COMPACT */
+	u32 pages_wb;		/* no. of pages on backing device */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written to backing device */
+} __attribute__ ((packed, aligned(4)));
+
+/* Max length of compressor name, including terminating NUL */
+#define ZRAM_MAX_COMP_NAME	64
+
+/* Max length of backing device path, including terminating NUL */
+#define ZRAM_MAX_PATH		256
+
+/* ZRAMIO_WRITEBACK modes: pages to move to the backing device */
+#define ZRAM_WB_IDLE		(1 << 0)	/* not accessed since marked idle */
+#define ZRAM_WB_HUGE		(1 << 1)	/* stored uncompressed */
+
 #define ZRAMIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define ZRAMIO_GET_STATS	_IOR('z', 1, struct zram_ioctl_stats)
 #define ZRAMIO_INIT		_IO('z', 2)
 #define ZRAMIO_RESET		_IO('z', 3)
+#define ZRAMIO_SET_COMPRESSOR	_IOW('z', 4, char[ZRAM_MAX_COMP_NAME])
+#define ZRAMIO_GET_COMPRESSOR	_IOR('z', 5, char[ZRAM_MAX_COMP_NAME])
+#define ZRAMIO_COMPACT		_IO('z', 6)
+#define ZRAMIO_SET_BACKING_DEV	_IOW('z', 7, char[ZRAM_MAX_PATH])
+#define ZRAMIO_MARK_IDLE	_IO('z', 8)
+#define ZRAMIO_WRITEBACK	_IOW('z', 9, u32)
+#define ZRAMIO_GET_EXT_STATS	_IOR('z', 10, struct zram_ioctl_ext_stats)
 
 #endif
@@ -29,13 +29,17 @@
 #include <linux/types.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 
 #include <linux/usb/android_composite.h>
 
-#define BULK_BUFFER_SIZE           4096
+#define BULK_BUFFER_SIZE           16384
 
-/* number of tx requests to allocate */
+/* number of tx and rx requests to allocate */
 #define TX_REQ_MAX 4
+/* one rx request is filled by the host while the other is copied out */
+#define RX_REQ_MAX 2
 
 static const char shortname[] = "android_adb";
 
@@ -58,8 +62,11 @@ struct adb_dev {
 
 	wait_queue_head_t read_wq;
 	wait_queue_head_t write_wq;
-	struct usb_request *rx_req;
-	int rx_done;
+	struct usb_request *rx_req[RX_REQ_MAX];
+	/* number of bulk OUT completions, for adb_read */
+	int rx_completed;
+	/* tx request adb_splice_write is filling from the pipe */
+	struct usb_request *tx_fill;
 };
 
 static struct usb_interface_descriptor adb_interface_desc = {
@@ -229,8 +236,9 @@ static void adb_complete_out(struct usb_ep *ep, struct usb_request *req)
 {
 	struct adb_dev *dev = _adb_dev;
 
-	dev->rx_done = 1;
-	if (req->status != 0)
+	dev->rx_completed++;
+	/* -ECONNRESET is adb_read taking back a request after an error */
+	if (req->status != 0 && req->status != -ECONNRESET)
 		dev->error = 1;
 
 	wake_up(&dev->read_wq);
@@ -266,11 +274,13 @@ static int __init create_bulk_endpoints(struct adb_dev *dev,
 	dev->ep_out = ep;
 
 	/* now allocate requests for our endpoints */
-	req = adb_request_new(dev->ep_out, BULK_BUFFER_SIZE);
-	if (!req)
-		goto fail;
-	req->complete = adb_complete_out;
-	dev->rx_req = req;
+	for (i = 0; i < RX_REQ_MAX; i++) {
+		req = adb_request_new(dev->ep_out, BULK_BUFFER_SIZE);
+		if (!req)
+			goto fail;
+		req->complete = adb_complete_out;
+		dev->rx_req[i] = req;
+	}
 
 	for (i = 0; i < TX_REQ_MAX; i++) {
 		req = adb_request_new(dev->ep_in, BULK_BUFFER_SIZE);
@@ -287,19 +297,24 @@ fail:
 	return -1;
 }
 
-static ssize_t adb_read(struct file *fp, char __user *buf,
-				size_t count, loff_t *pos)
+/*
+ * Receives up to count bytes, handing each completed request to copy(), which
+ * puts its data at the given offset of the destination: a user buffer for
+ * adb_read, pipe pages for adb_splice_read.
+ */
+static ssize_t adb_receive(struct adb_dev *dev, size_t count,
+		int (*copy)(void *to, size_t offset, const void *from,
+			    size_t len),
+		void *to)
 {
-	struct adb_dev *dev = fp->private_data;
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *req;
-	int r = count, xfer;
+	struct usb_request *req, *next;
+	size_t unqueued, done;
+	int index, completed;
+	int r;
 	int ret;
 
-	DBG(cdev, "adb_read(%d)\n", count);
-
-	if (count > BULK_BUFFER_SIZE)
-		return -EINVAL;
+	DBG(cdev, "adb_receive(%d)\n", count);
 
 	if (_lock(&dev->read_excl))
 		return -EBUSY;
@@ -320,42 +335,188 @@ static ssize_t adb_read(struct file *fp, char __user *buf,
 	}
 
 requeue_req:
+	index = completed = 0;
+	unqueued = count;
+	done = 0;
+	dev->rx_completed = 0;
+
 	/* queue a request */
-	req = dev->rx_req;
-	req->length = count;
-	dev->rx_done = 0;
+	req = dev->rx_req[index];
+	req->length = min(unqueued, (size_t)BULK_BUFFER_SIZE);
 	ret = usb_ep_queue(dev->ep_out, req, GFP_ATOMIC);
 	if (ret < 0) {
 		DBG(cdev, "adb_read: failed to queue req %p (%d)\n", req, ret);
 		r = -EIO;
 		dev->error = 1;
 		goto done;
-	} else {
-		DBG(cdev, "rx %p queue\n", req);
 	}
+	DBG(cdev, "rx %p queue\n", req);
+	unqueued -= req->length;
+
+	while (1) {
+		/* wait for the request to complete */
+		ret = wait_event_interruptible(dev->read_wq,
+				dev->rx_completed != completed || dev->error);
+		if (ret < 0) {
+			dev->error = 1;
+			r = ret;
+			goto cancel;
+		}
+		if (dev->error) {
+			r = -EIO;
+			goto cancel;
+		}
+		completed++;
 
-	/* wait for a request to complete */
-	ret = wait_event_interruptible(dev->read_wq, dev->rx_done);
-	if (ret < 0) {
-		dev->error = 1;
-		r = ret;
-		goto done;
-	}
-	if (!dev->error) {
 		/* If we got a 0-len packet, throw it back and try again. */
-		if (req->actual == 0)
+		if (req->actual == 0 && done == 0)
 			goto requeue_req;
 
+		/*
+		 * Queue the next request before copying this one out, so the
+		 * host can keep sending meanwhile.  Only after a full request
+		 * though: a short packet ends the transfer, and a request
+		 * queued past it would take the start of the next one.
+		 */
+		next = NULL;
+		if (req->actual == req->length && unqueued > 0) {
+			index = (index + 1) % RX_REQ_MAX;
+			next = dev->rx_req[index];
+			next->length = min(unqueued, (size_t)BULK_BUFFER_SIZE);
+			ret = usb_ep_queue(dev->ep_out, next, GFP_ATOMIC);
+			if (ret < 0) {
+				DBG(cdev, "adb_read: failed to queue req %p (%d)\n",
+					next, ret);
+				r = -EIO;
+				dev->error = 1;
+				goto done;
+			}
+			DBG(cdev, "rx %p queue\n", next);
+			unqueued -= next->length;
+		}
+
 		DBG(cdev, "rx %p %d\n", req, req->actual);
-		xfer = (req->actual < count) ? req->actual : count;
-		if (copy_to_user(buf, req->buf, xfer))
-			r = -EFAULT;
-	} else
-		r = -EIO;
+		ret = copy(to, done, req->buf, req->actual);
+		if (ret < 0) {
+			r = ret;
+			if (!next)
+				goto done;
+			req = next;
+			goto cancel;
+		}
+		done += req->actual;
 
+		if (!next)
+			break;
+		req = next;
+	}
+	r = done;
+	goto done;
+
+cancel:
+	/* take back the queued request and wait for it to be given back */
+	usb_ep_dequeue(dev->ep_out, req);
+	wait_event(dev->read_wq, dev->rx_completed != completed);
 done:
 	_unlock(&dev->read_excl);
-	DBG(cdev, "adb_read returning %d\n", r);
+	DBG(cdev, "adb_receive returning %d\n", r);
+	return r;
+}
+
+static int adb_copy_to_user(void *to, size_t offset, const void *from,
+			    size_t len)
+{
+	if (copy_to_user((char __user *)to + offset, from, len))
+		return -EFAULT;
+	return 0;
+}
+
+static ssize_t adb_read(struct file *fp, char __user *buf,
+				size_t count, loff_t *pos)
+{
+	return adb_receive(fp->private_data, count, adb_copy_to_user,
+			   (void __force *)buf);
+}
+
+static int adb_copy_to_pages(void *to, size_t offset, const void *from,
+			     size_t len)
+{
+	struct page **pages = to;
+	size_t n;
+
+	while (len) {
+		n = min_t(size_t, len, PAGE_SIZE - offset % PAGE_SIZE);
+		memcpy(page_address(pages[offset / PAGE_SIZE]) +
+		       offset % PAGE_SIZE, from, n);
+		from += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static const struct pipe_buf_operations adb_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = generic_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+static void adb_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+	__free_page(spd->pages[i]);
+}
+
+/*
+ * Receives straight into pages handed to the pipe, so adbd can splice what
+ * the host pushes on to a file without it passing through user space.
+ */
+static ssize_t adb_splice_read(struct file *fp, loff_t *ppos,
+			       struct pipe_inode_info *pipe, size_t len,
+			       unsigned int flags)
+{
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.flags = flags,
+		.ops = &adb_pipe_buf_ops,
+		.spd_release = adb_spd_release,
+	};
+	unsigned int nr_pages, i;
+	ssize_t r;
+
+	len = min_t(size_t, len, PIPE_DEF_BUFFERS * PAGE_SIZE);
+	nr_pages = DIV_ROUND_UP(len, PAGE_SIZE);
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = alloc_page(GFP_USER);
+		if (!pages[i]) {
+			r = -ENOMEM;
+			goto free;
+		}
+	}
+
+	r = adb_receive(fp->private_data, len, adb_copy_to_pages, pages);
+	if (r <= 0)
+		goto free;
+
+	for (spd.nr_pages = 0; spd.nr_pages * PAGE_SIZE < r; spd.nr_pages++) {
+		partial[spd.nr_pages].offset = 0;
+		partial[spd.nr_pages].len = min_t(size_t,
+				r - spd.nr_pages * PAGE_SIZE, PAGE_SIZE);
+	}
+	for (i = spd.nr_pages; i < nr_pages; i++)
+		__free_page(pages[i]);
+
+	return splice_to_pipe(pipe, &spd);
+
+free:
+	while (i-- > 0)
+		__free_page(pages[i]);
 	return r;
 }
 
@@ -425,6 +586,96 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 	return r;
 }
 
+/*
+ * Copies a pipe buffer into the tx request being filled, queueing the request
+ * once it is full.
+ */
+static int adb_pipe_to_req(struct pipe_inode_info *pipe,
+			   struct pipe_buffer *buf, struct splice_desc *sd)
+{
+	struct adb_dev *dev = sd->u.file->private_data;
+	struct usb_request *req;
+	size_t len;
+	void *data;
+	int ret;
+
+	if (!dev->tx_fill) {
+		ret = wait_event_interruptible(dev->write_wq,
+			(dev->tx_fill = req_get(dev, &dev->tx_idle)) ||
+			dev->error);
+		if (ret < 0)
+			return ret;
+		if (!dev->tx_fill)
+			return -EIO;
+		dev->tx_fill->length = 0;
+	}
+	req = dev->tx_fill;
+
+	len = min_t(size_t, sd->len, BULK_BUFFER_SIZE - req->length);
+	data = buf->ops->map(pipe, buf, 0);
+	memcpy(req->buf + req->length, data + buf->offset, len);
+	buf->ops->unmap(pipe, buf, data);
+	req->length += len;
+
+	if (req->length == BULK_BUFFER_SIZE) {
+		dev->tx_fill = NULL;
+		ret = usb_ep_queue(dev->ep_in, req, GFP_ATOMIC);
+		if (ret < 0) {
+			DBG(dev->cdev, "adb_splice_write: xfer error %d\n", ret);
+			dev->error = 1;
+			req_put(dev, &dev->tx_idle, req);
+			return -EIO;
+		}
+	}
+	return len;
+}
+
+/*
+ * Fills tx requests straight from the pipe, so adbd can sendfile() a file to
+ * the host with one copy, from the page cache to the request, rather than
+ * two through a user buffer. What is left in a part filled request at the
+ * end is sent as a transfer of its own, as adb_write would have.
+ */
+static ssize_t adb_splice_write(struct pipe_inode_info *pipe, struct file *fp,
+				loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct adb_dev *dev = fp->private_data;
+	struct usb_request *req;
+	ssize_t r;
+	int ret;
+
+	DBG(dev->cdev, "adb_splice_write(%d)\n", len);
+
+	if (_lock(&dev->write_excl))
+		return -EBUSY;
+
+	if (dev->error) {
+		r = -EIO;
+		goto done;
+	}
+
+	r = splice_from_pipe(pipe, fp, ppos, len, flags, adb_pipe_to_req);
+
+	req = dev->tx_fill;
+	dev->tx_fill = NULL;
+	if (req && req->length && !dev->error) {
+		ret = usb_ep_queue(dev->ep_in, req, GFP_ATOMIC);
+		if (ret < 0) {
+			DBG(dev->cdev, "adb_splice_write: xfer error %d\n", ret);
+			dev->error = 1;
+			r = -EIO;
+		} else
+			req = NULL;
+	}
+	if (req)
+		req_put(dev, &dev->tx_idle, req);
+
+done:
+	_unlock(&dev->write_excl);
+	DBG(dev->cdev, "adb_splice_write returning %d\n", r);
+	return r;
+}
+
 static int adb_open(struct inode *ip, struct file *fp)
 {
 	static unsigned long last_print;
@@ -479,6 +730,8 @@ static struct file_operations adb_fops = {
 	.owner = THIS_MODULE,
 	.read = adb_read,
 	.write = adb_write,
+	.splice_read = adb_splice_read,
+	.splice_write = adb_splice_write,
 	.open = adb_open,
 	.release = adb_release,
 };
@@ -564,10 +817,12 @@ adb_function_unbind(struct usb_configuration *c, struct usb_function *f)
 {
 	struct adb_dev	*dev = func_to_dev(f);
 	struct usb_request *req;
+	int i;
 
 	spin_lock_irq(&dev->lock);
 
-	adb_request_free(dev->rx_req, dev->ep_out);
+	for (i = 0; i < RX_REQ_MAX; i++)
+		adb_request_free(dev->rx_req[i], dev->ep_out);
 	while ((req = req_get(dev, &dev->tx_idle)))
 		adb_request_free(req, dev->ep_in);
 
@@ -134,6 +134,9 @@
  *				boolean to permit the driver to halt
  *				bulk endpoints.
  *
+ * The number of pipeline buffers is set by num_buffers (default 4, 2 to
+ * 32), which is never prefixed.
+ *
  * The module parameters may be prefixed with some string.  You need
  * to consult gadget's documentation or source to verify whether it is
  * using those module parameters and if it does what are the prefixes
@@ -215,14 +218,14 @@
  * a callback functions is needed.
  *
  * To provide maximum throughput, the driver uses a circular pipeline of
- * buffer heads (struct fsg_buffhd).  In principle the pipeline can be
- * arbitrarily long; in practice the benefits don't justify having more
- * than 2 stages (i.e., double buffering).  But it helps to think of the
- * pipeline as being a long one.  Each buffer head contains a bulk-in and
- * a bulk-out request pointer (since the buffer can be used for both
- * output and input -- directions always are given from the host's
- * point of view) as well as a pointer to the buffer and various state
- * variables.
+ * buffer heads (struct fsg_buffhd).  The number of stages is set by the
+ * num_buffers module parameter (default 4).  Two are enough for double
+ * buffering; more let the file I/O for a long READ or WRITE run ahead
+ * of, or behind, the USB transfers when either side is bursty.  Each
+ * buffer head contains a bulk-in and a bulk-out request pointer (since
+ * the buffer can be used for both output and input -- directions always
+ * are given from the host's point of view) as well as a pointer to the
+ * buffer and various state variables.
  *
  * Use of the pipeline follows a simple protocol.  There is a variable
  * (fsg->next_buffhd_to_fill) that points to the next buffer head to use.
@@ -235,6 +238,16 @@
  * (again possibly by USB I/O, during which it is marked BUSY) and
  * finally marked EMPTY again (possibly by a completion routine).
  *
+ * WRITE data is not written to the backing file by the main thread but
+ * by a separate I/O thread, so that the main thread can go on queuing
+ * bulk-out requests while a write is blocked in the filesystem.  A
+ * buffer handed to the I/O thread stays BUSY until the main thread has
+ * seen that its write finished; buffers are handed over and retired in
+ * ring order, and do_write() waits for the I/O thread to finish with all
+ * of them before it returns, even when interrupted.  READs need no such
+ * thread: the main thread's vfs_read() of one buffer already overlaps
+ * the bulk-in transfers of the buffers before it.
+ *
  * A module parameter tells the driver to avoid stalling the bulk
  * endpoints wherever the transport specification allows.  This is
  * necessary for some UDCs like the SuperH, which cannot reliably clear a
@@ -289,6 +302,7 @@
 #include <linux/string.h>
 #include <linux/freezer.h>
 #include <linux/utsname.h>
+#include <linux/workqueue.h>
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/gadget.h>
@@ -344,6 +358,18 @@ struct fsg_operations {
 };
 
 
+/* A buffer's worth of data on its way to the backing file, written by the
+ * I/O thread so that the main thread can keep bulk-out requests queued. */
+struct fsg_write {
+	struct work_struct	work;
+	struct fsg_common	*common;
+	struct fsg_lun		*curlun;
+	loff_t			file_offset;
+	unsigned int		amount;
+	ssize_t			nwritten;
+	int			done;
+};
+
 /* Data shared by all the FSG instances. */
 struct fsg_common {
 	struct usb_gadget	*gadget;
@@ -362,7 +388,12 @@ struct fsg_common {
 
 	struct fsg_buffhd	*next_buffhd_to_fill;
 	struct fsg_buffhd	*next_buffhd_to_drain;
-	struct fsg_buffhd	buffhds[FSG_NUM_BUFFERS];
+	struct fsg_buffhd	*buffhds;	/* fsg_num_buffers of them */
+
+	/* The I/O thread runs backing file writes for do_write() */
+	struct workqueue_struct	*io_wq;
+	struct fsg_write	*writes;	/* One for each buffhd */
+	int			write_failed;
 
 	int			cmnd_size;
 	u8			cmnd[MAX_COMMAND_SIZE];
@@ -860,14 +891,52 @@ static int do_read(struct fsg_common *common)
 
 /*-------------------------------------------------------------------------*/
 
+/* Runs in the I/O thread, one buffer at a time and in order */
+static void fsg_write_work(struct work_struct *work)
+{
+	struct fsg_write	*w = container_of(work, struct fsg_write, work);
+	struct fsg_common	*common = w->common;
+	struct fsg_buffhd	*bh = &common->buffhds[w - common->writes];
+	struct fsg_lun		*curlun = w->curlun;
+	loff_t			file_offset_tmp = w->file_offset;
+	mm_segment_t		old_fs;
+
+	/* Once a write has failed the host is told that nothing past it
+	 * was written, so nothing past it may be */
+	if (common->write_failed) {
+		w->nwritten = 0;
+	} else {
+		old_fs = get_fs();
+		set_fs(get_ds());
+		w->nwritten = vfs_write(curlun->filp,
+				(char __user *) bh->buf,
+				w->amount, &file_offset_tmp);
+		set_fs(old_fs);
+		VLDBG(curlun, "file write %u @ %llu -> %d\n", w->amount,
+				(unsigned long long) w->file_offset,
+				(int) w->nwritten);
+		if (w->nwritten != (ssize_t) w->amount)
+			common->write_failed = 1;
+	}
+
+	/* Hold the lock while we update the write's state */
+	smp_wmb();
+	spin_lock_irq(&common->lock);
+	w->done = 1;
+	wakeup_thread(common);
+	spin_unlock_irq(&common->lock);
+}
+
 static int do_write(struct fsg_common *common)
 {
 	struct fsg_lun		*curlun = common->curlun;
 	u32			lba;
-	struct fsg_buffhd	*bh;
-	int			get_some_more;
+	struct fsg_buffhd	*bh, *bh_to_retire;
+	struct fsg_write	*w;
+	int			get_some_more, stop_draining;
+	unsigned int		writes_in_flight;
 	u32			amount_left_to_req, amount_left_to_write;
-	loff_t			usb_offset, file_offset, file_offset_tmp;
+	loff_t			usb_offset, file_offset;
 	unsigned int		amount;
 	unsigned int		partial_page;
 	ssize_t			nwritten;
@@ -907,11 +976,17 @@ static int do_write(struct fsg_common *common)
 		return -EINVAL;
 	}
 
-	/* Carry out the file writes */
+	/* Carry out the file writes.  Received buffers are handed to the
+	 * I/O thread in order and retired in the same order once written,
+	 * so bulk-out requests stay queued while the file is written. */
 	get_some_more = 1;
+	stop_draining = 0;
 	file_offset = usb_offset = ((loff_t) lba) << 9;
 	amount_left_to_req = common->data_size_from_cmnd;
 	amount_left_to_write = common->data_size_from_cmnd;
+	bh_to_retire = common->next_buffhd_to_drain;
+	writes_in_flight = 0;
+	common->write_failed = 0;
 
 	while (amount_left_to_write > 0) {
 
@@ -969,22 +1044,53 @@ static int do_write(struct fsg_common *common)
 					  &bh->outreq_busy, &bh->state)
 				/* Don't know what to do if
 				 * common->fsg is NULL */
-				return -EIO;
+				break;
 			common->next_buffhd_to_fill = bh->next;
 			continue;
 		}
 
-		/* Write the received data to the backing file */
+		/* Account for the oldest write once the I/O thread is done */
+		w = &common->writes[bh_to_retire - common->buffhds];
+		if (writes_in_flight > 0 && w->done) {
+			smp_rmb();
+			bh_to_retire->state = BUF_STATE_EMPTY;
+			bh_to_retire = bh_to_retire->next;
+			--writes_in_flight;
+
+			nwritten = w->nwritten;
+			if (nwritten < 0) {
+				LDBG(curlun, "error in file write: %d\n",
+						(int) nwritten);
+				nwritten = 0;
+			} else if (nwritten < w->amount) {
+				LDBG(curlun, "partial file write: %d/%u\n",
+						(int) nwritten, w->amount);
+				nwritten -= (nwritten & 511);
+				/* Round down to a block */
+			}
+			amount_left_to_write -= nwritten;
+			common->residue -= nwritten;
+
+			/* If an error occurred, report it and its position */
+			if (nwritten < w->amount) {
+				curlun->sense_data = SS_WRITE_ERROR;
+				curlun->sense_data_info =
+					(w->file_offset + nwritten) >> 9;
+				curlun->info_valid = 1;
+				break;
+			}
+			continue;
+		}
+
+		/* Hand the received data to the I/O thread */
 		bh = common->next_buffhd_to_drain;
-		if (bh->state == BUF_STATE_EMPTY && !get_some_more)
-			break;			/* We stopped early */
-		if (bh->state == BUF_STATE_FULL) {
+		if (bh->state == BUF_STATE_FULL && !stop_draining) {
 			smp_rmb();
 			common->next_buffhd_to_drain = bh->next;
-			bh->state = BUF_STATE_EMPTY;
 
 			/* Did something go wrong with the transfer? */
 			if (bh->outreq->status != 0) {
+				bh->state = BUF_STATE_EMPTY;
 				curlun->sense_data = SS_COMMUNICATION_FAILURE;
 				curlun->sense_data_info = file_offset >> 9;
 				curlun->info_valid = 1;
@@ -1000,54 +1106,44 @@ static int do_write(struct fsg_common *common)
 				amount = curlun->file_length - file_offset;
 			}
 
-			/* Perform the write */
-			file_offset_tmp = file_offset;
-			nwritten = vfs_write(curlun->filp,
-					(char __user *) bh->buf,
-					amount, &file_offset_tmp);
-			VLDBG(curlun, "file write %u @ %llu -> %d\n", amount,
-					(unsigned long long) file_offset,
-					(int) nwritten);
-			if (signal_pending(current))
-				return -EINTR;		/* Interrupted! */
-
-			if (nwritten < 0) {
-				LDBG(curlun, "error in file write: %d\n",
-						(int) nwritten);
-				nwritten = 0;
-			} else if (nwritten < amount) {
-				LDBG(curlun, "partial file write: %d/%u\n",
-						(int) nwritten, amount);
-				nwritten -= (nwritten & 511);
-				/* Round down to a block */
-			}
-			file_offset += nwritten;
-			amount_left_to_write -= nwritten;
-			common->residue -= nwritten;
-
-			/* If an error occurred, report it and its position */
-			if (nwritten < amount) {
-				curlun->sense_data = SS_WRITE_ERROR;
-				curlun->sense_data_info = file_offset >> 9;
-				curlun->info_valid = 1;
-				break;
-			}
-
-			/* Did the host decide to stop early? */
+			w = &common->writes[bh - common->buffhds];
+			w->curlun = curlun;
+			w->file_offset = file_offset;
+			w->amount = amount;
+			w->done = 0;
+			bh->state = BUF_STATE_BUSY;
+			queue_work(common->io_wq, &w->work);
+			file_offset += amount;
+			++writes_in_flight;
+
+			/* Did the host decide to stop early?  The writes
+			 * already queued still have to be accounted for. */
 			if (bh->outreq->actual != bh->outreq->length) {
 				common->short_packet_received = 1;
-				break;
+				stop_draining = 1;
 			}
 			continue;
 		}
+		if (writes_in_flight == 0 && (stop_draining ||
+				(bh->state == BUF_STATE_EMPTY && !get_some_more)))
+			break;			/* We stopped early */
 
 		/* Wait for something to happen */
 		rc = sleep_thread(common);
 		if (rc)
-			return rc;
+			goto out;
 	}
 
-	return -EIO;		/* No default reply */
+	rc = -EIO;		/* No default reply */
+out:
+	/* The I/O thread must be done with our buffers before they are
+	 * refilled or an exception resets them */
+	flush_workqueue(common->io_wq);
+	while (writes_in_flight--) {
+		bh_to_retire->state = BUF_STATE_EMPTY;
+		bh_to_retire = bh_to_retire->next;
+	}
+	return rc;
 }
 
 
@@ -2353,7 +2449,7 @@ reset:
 	if (common->fsg) {
 		fsg = common->fsg;
 
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < fsg_num_buffers; ++i) {
 			struct fsg_buffhd *bh = &common->buffhds[i];
 
 			if (bh->inreq) {
@@ -2405,7 +2501,7 @@ reset:
 	clear_bit(IGNORE_BULK_OUT, &fsg->atomic_bitflags);
 
 	/* Allocate the requests */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &common->buffhds[i];
 
 		rc = alloc_request(common, fsg->bulk_in, &bh->inreq);
@@ -2473,7 +2569,7 @@ static void handle_exception(struct fsg_common *common)
 
 	/* Cancel all the pending transfers */
 	if (likely(common->fsg)) {
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < fsg_num_buffers; ++i) {
 			bh = &common->buffhds[i];
 			if (bh->inreq_busy)
 				usb_ep_dequeue(common->fsg->bulk_in, bh->inreq);
@@ -2485,7 +2581,7 @@ static void handle_exception(struct fsg_common *common)
 		/* Wait until everything is idle */
 		for (;;) {
 			int num_active = 0;
-			for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+			for (i = 0; i < fsg_num_buffers; ++i) {
 				bh = &common->buffhds[i];
 				num_active += bh->inreq_busy + bh->outreq_busy;
 			}
@@ -2506,7 +2602,7 @@ static void handle_exception(struct fsg_common *common)
 	 * state, and the exception.  Then invoke the handler. */
 	spin_lock_irq(&common->lock);
 
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		bh = &common->buffhds[i];
 		bh->state = BUF_STATE_EMPTY;
 	}
@@ -2705,6 +2801,10 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 	int nluns, i, rc;
 	char *pathbuf;
 
+	rc = fsg_num_buffers_validate();
+	if (rc)
+		return ERR_PTR(rc);
+
 	/* Find out how many LUNs there should be */
 	nluns = cfg->nluns;
 	if (nluns < 1 || nluns > FSG_MAX_LUNS) {
@@ -2719,10 +2819,18 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 			return ERR_PTR(-ENOMEM);
 		common->free_storage_on_release = 1;
 	} else {
-		memset(common, 0, sizeof common);
+		memset(common, 0, sizeof *common);
 		common->free_storage_on_release = 0;
 	}
 
+	common->buffhds = kcalloc(fsg_num_buffers, sizeof *common->buffhds,
+				  GFP_KERNEL);
+	if (!common->buffhds) {
+		if (common->free_storage_on_release)
+			kfree(common);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	common->ops = cfg->ops;
 	common->private_data = cfg->private_data;
 
@@ -2730,6 +2838,19 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 	common->ep0 = gadget->ep0;
 	common->ep0req = cdev->req;
 
+	/* Backing file writes are run by the I/O thread */
+	common->writes = kcalloc(fsg_num_buffers, sizeof *common->writes,
+				 GFP_KERNEL);
+	common->io_wq = create_singlethread_workqueue("file-storage-io");
+	if (!common->writes || !common->io_wq) {
+		rc = -ENOMEM;
+		goto error_release;
+	}
+	for (i = 0; i < fsg_num_buffers; ++i) {
+		INIT_WORK(&common->writes[i].work, fsg_write_work);
+		common->writes[i].common = common;
+	}
+
 	/* Maybe allocate device-global string IDs, and patch descriptors */
 	if (fsg_strings[FSG_STRING_INTERFACE].id == 0) {
 		rc = usb_string_id(cdev);
@@ -2799,7 +2920,7 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 
 	/* Data buffers cyclic list */
 	bh = common->buffhds;
-	i = FSG_NUM_BUFFERS;
+	i = fsg_num_buffers;
 	goto buffhds_first_it;
 	do {
 		bh->next = bh + 1;
@@ -2935,12 +3056,17 @@ static void fsg_common_release(struct kref *ref)
 		kfree(common->luns);
 	}
 
-	{
+	if (likely(common->io_wq))
+		destroy_workqueue(common->io_wq);
+	kfree(common->writes);
+
+	if (likely(common->buffhds)) {
 		struct fsg_buffhd *bh = common->buffhds;
-		unsigned i = FSG_NUM_BUFFERS;
+		unsigned i = fsg_num_buffers;
 		do {
 			kfree(bh->buf);
 		} while (++bh, --i);
+		kfree(common->buffhds);
 	}
 
 	if (common->free_storage_on_release)
@@ -50,9 +50,32 @@
 #define STATE_CANCELED              3   /* transaction canceled by host */
 #define STATE_ERROR                 4   /* error from completion routine */
 
-/* number of tx and rx requests to allocate */
+/* default number of tx and rx requests to allocate */
 #define TX_REQ_MAX 4
-#define RX_REQ_MAX 2
+#define RX_REQ_MAX 4
+/* most rx requests we allow */
+#define RX_REQ_LIMIT 8
+
+/*
+ * More and bigger requests let file I/O and USB transfers overlap for
+ * longer.  If buffers this big can't be had at bind time we fall back
+ * to BULK_BUFFER_SIZE.
+ */
+static unsigned int mtp_tx_req_len = 65536;
+module_param(mtp_tx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_req_len, "MTP bulk IN request buffer size");
+
+static unsigned int mtp_tx_reqs = TX_REQ_MAX;
+module_param(mtp_tx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_reqs, "MTP bulk IN request count");
+
+static unsigned int mtp_rx_req_len = 65536;
+module_param(mtp_rx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_req_len, "MTP bulk OUT request buffer size");
+
+static unsigned int mtp_rx_reqs = RX_REQ_MAX;
+module_param(mtp_rx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_reqs, "MTP bulk OUT request count");
 
 /* ID for Microsoft MTP OS String */
 #define MTP_OS_STRING_ID   0xEE
@@ -92,9 +115,16 @@ struct mtp_dev {
 
 	wait_queue_head_t read_wq;
 	wait_queue_head_t write_wq;
-	struct usb_request *rx_req[RX_REQ_MAX];
+	struct usb_request *rx_req[RX_REQ_LIMIT];
 	struct usb_request *intr_req;
 	int rx_done;
+	/* number of bulk OUT completions, for receive_file_work */
+	int rx_completed;
+
+	/* request sizes and rx request count we got at bind time */
+	unsigned int tx_req_len;
+	unsigned int rx_req_len;
+	int rx_reqs;
 	/* true if interrupt endpoint is busy */
 	int intr_busy;
 
@@ -362,7 +392,9 @@ static void mtp_complete_out(struct usb_ep *ep, struct usb_request *req)
 	struct mtp_dev *dev = _mtp_dev;
 
 	dev->rx_done = 1;
-	if (req->status != 0)
+	dev->rx_completed++;
+	/* -ECONNRESET is us dequeueing reads a transfer no longer needs */
+	if (req->status != 0 && req->status != -ECONNRESET)
 		dev->state = STATE_ERROR;
 
 	wake_up(&dev->read_wq);
@@ -428,17 +460,44 @@ static int __init create_bulk_endpoints(struct mtp_dev *dev,
 	dev->ep_intr = ep;
 
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_in, BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+	dev->tx_req_len = max(mtp_tx_req_len, (unsigned int)BULK_BUFFER_SIZE);
+	/*
+	 * An OUT request must be a whole number of packets, or the host may
+	 * overrun it.  A multiple of the high speed size is one at full speed.
+	 */
+	dev->rx_req_len = round_down(max(mtp_rx_req_len,
+			(unsigned int)BULK_BUFFER_SIZE),
+			le16_to_cpu(mtp_highspeed_out_desc.wMaxPacketSize));
+	dev->rx_reqs = clamp(mtp_rx_reqs, 1U, (unsigned int)RX_REQ_LIMIT);
+
+retry_tx_alloc:
+	for (i = 0; i < max(mtp_tx_reqs, 1U); i++) {
+		req = mtp_request_new(dev->ep_in, dev->tx_req_len);
+		if (!req) {
+			if (dev->tx_req_len <= BULK_BUFFER_SIZE)
+				goto fail;
+			while ((req = req_get(dev, &dev->tx_idle)))
+				mtp_request_free(req, dev->ep_in);
+			dev->tx_req_len = BULK_BUFFER_SIZE;
+			goto retry_tx_alloc;
+		}
 		req->complete = mtp_complete_in;
 		req_put(dev, &dev->tx_idle, req);
 	}
-	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_out, BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+
+retry_rx_alloc:
+	for (i = 0; i < dev->rx_reqs; i++) {
+		req = mtp_request_new(dev->ep_out, dev->rx_req_len);
+		if (!req) {
+			if (dev->rx_req_len <= BULK_BUFFER_SIZE)
+				goto fail;
+			while (i-- > 0) {
+				mtp_request_free(dev->rx_req[i], dev->ep_out);
+				dev->rx_req[i] = NULL;
+			}
+			dev->rx_req_len = BULK_BUFFER_SIZE;
+			goto retry_rx_alloc;
+		}
 		req->complete = mtp_complete_out;
 		dev->rx_req[i] = req;
 	}
@@ -466,7 +525,7 @@ static ssize_t mtp_read(struct file *fp, char __user *buf,
 
 	DBG(cdev, "mtp_read(%d)\n", count);
 
-	if (count > BULK_BUFFER_SIZE)
+	if (count > dev->rx_req_len)
 		return -EINVAL;
 
 	/* we will block until we're online */
@@ -586,8 +645,8 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 			break;
 		}
 
-		if (count > BULK_BUFFER_SIZE)
-			xfer = BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		if (xfer && copy_from_user(req->buf, buf, xfer)) {
@@ -670,8 +729,8 @@ static void send_file_work(struct work_struct *data) {
 			break;
 		}
 
-		if (count > BULK_BUFFER_SIZE)
-			xfer = BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		ret = vfs_read(filp, req->buf, xfer, &offset);
@@ -710,11 +769,13 @@ static void receive_file_work(struct work_struct *data)
 {
 	struct mtp_dev	*dev = container_of(data, struct mtp_dev, receive_file_work);
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *req;
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
-	int ret, cur_buf = 0;
+	int64_t count;		/* bytes still to be received */
+	int64_t unqueued;	/* bytes not yet covered by a queued read */
+	int head = 0, tail = 0, in_flight = 0, completed = 0;
+	int ret;
 	int r = 0;
 
 	/* read our parameters */
@@ -725,62 +786,84 @@ static void receive_file_work(struct work_struct *data)
 
 	DBG(cdev, "receive_file_work(%lld)\n", count);
 
-	while (count > 0 || write_req) {
-		if (count > 0) {
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
+	unqueued = count;
+	dev->rx_completed = 0;
 
-			read_req->length = (count > BULK_BUFFER_SIZE
-					? BULK_BUFFER_SIZE : count);
-			dev->rx_done = 0;
-			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
+	while (count > 0) {
+		/*
+		 * Keep the idle rx requests queued, as far as the length of the
+		 * transfer allows, so the host can go on sending while we write
+		 * to the file.  If xfer_file_length is 0xFFFFFFFF we read until
+		 * a short packet and so can't read ahead: anything queued past
+		 * the end would take the host's next container.
+		 */
+		while (in_flight < dev->rx_reqs && unqueued > 0 &&
+		       (count != 0xFFFFFFFF || in_flight == 0)) {
+			req = dev->rx_req[head];
+			req->length = (unqueued > dev->rx_req_len
+					? dev->rx_req_len : unqueued);
+			ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 			if (ret < 0) {
 				r = -EIO;
 				dev->state = STATE_ERROR;
-				break;
+				goto out;
 			}
+			if (count != 0xFFFFFFFF)
+				unqueued -= req->length;
+			head = (head + 1) % dev->rx_reqs;
+			in_flight++;
 		}
 
-		if (write_req) {
-			DBG(cdev, "rx %p %d\n", write_req, write_req->actual);
-			ret = vfs_write(filp, write_req->buf, write_req->actual,
-				&offset);
-			DBG(cdev, "vfs_write %d\n", ret);
-			if (ret != write_req->actual) {
-				r = -EIO;
-				dev->state = STATE_ERROR;
-				break;
-			}
-			write_req = NULL;
+		/* reads complete in the order they were queued */
+		req = dev->rx_req[tail];
+		ret = wait_event_interruptible(dev->read_wq,
+			dev->rx_completed != completed
+			|| dev->state != STATE_BUSY);
+		if (dev->state == STATE_CANCELED) {
+			r = -ECANCELED;
+			goto out;
+		}
+		if (dev->state != STATE_BUSY) {
+			r = -EIO;
+			goto out;
+		}
+		if (ret < 0)
+			continue;
+
+		completed++;
+		in_flight--;
+		tail = (tail + 1) % dev->rx_reqs;
+
+		if (count != 0xFFFFFFFF)
+			count -= req->actual;
+		if (req->actual < req->length) {
+			/* short packet is used to signal EOF for sizes > 4 gig */
+			DBG(cdev, "got short packet\n");
+			count = 0;
 		}
 
-		if (read_req) {
-			/* wait for our last read to complete */
-			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
-			if (dev->state == STATE_CANCELED) {
-				r = -ECANCELED;
-				if (!dev->rx_done)
-					usb_ep_dequeue(dev->ep_out, read_req);
-				break;
-			}
-			/* if xfer_file_length is 0xFFFFFFFF, then we read until
-			 * we get a zero length packet
-			 */
-			if (count != 0xFFFFFFFF)
-				count -= read_req->actual;
-			if (read_req->actual < read_req->length) {
-				/* short packet is used to signal EOF for sizes > 4 gig */
-				DBG(cdev, "got short packet\n");
-				count = 0;
-			}
-
-			write_req = read_req;
-			read_req = NULL;
+		DBG(cdev, "rx %p %d\n", req, req->actual);
+		ret = vfs_write(filp, req->buf, req->actual, &offset);
+		DBG(cdev, "vfs_write %d\n", ret);
+		if (ret != req->actual) {
+			r = -EIO;
+			dev->state = STATE_ERROR;
+			goto out;
 		}
 	}
 
+out:
+	/*
+	 * Take back reads the transfer didn't use, and wait for them to be
+	 * given back so a late completion can't be taken for a later read.
+	 */
+	completed += in_flight;
+	while (in_flight-- > 0) {
+		usb_ep_dequeue(dev->ep_out, dev->rx_req[tail]);
+		tail = (tail + 1) % dev->rx_reqs;
+	}
+	wait_event(dev->read_wq, dev->rx_completed - completed >= 0);
+
 	DBG(cdev, "receive_file_work returning %d\n", r);
 	/* write the result */
 	dev->xfer_result = r;
@@ -1012,7 +1095,7 @@ mtp_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	spin_lock_irq(&dev->lock);
 	while ((req = req_get(dev, &dev->tx_idle)))
 		mtp_request_free(req, dev->ep_in);
-	for (i = 0; i < RX_REQ_MAX; i++)
+	for (i = 0; i < dev->rx_reqs; i++)
 		mtp_request_free(dev->rx_req[i], dev->ep_out);
 	mtp_request_free(dev->intr_req, dev->ep_intr);
 	dev->state = STATE_OFFLINE;
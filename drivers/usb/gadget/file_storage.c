@@ -112,10 +112,12 @@
  *	buflen=N		Default N=16384, buffer size used (will be
  *					rounded down to a multiple of
  *					PAGE_CACHE_SIZE)
+ *	num_buffers=N		Default N=4, number of pipeline buffers
+ *					(2 to 32)
  *
  * If CONFIG_USB_FILE_STORAGE_TEST is not set, only the "file", "ro",
- * "removable", "luns", "nofua", "stall", and "cdrom" options are available;
- * default values are used for everything else.
+ * "removable", "luns", "nofua", "stall", "cdrom", and "num_buffers" options
+ * are available; default values are used for everything else.
  *
  * The pathnames of the backing files and the ro settings are available in
  * the attribute files "file", "nofua", and "ro" in the lun<n> subdirectory of
@@ -176,14 +178,14 @@
  * FSG_STATE_TERMINATED.
  *
  * To provide maximum throughput, the driver uses a circular pipeline of
- * buffer heads (struct fsg_buffhd).  In principle the pipeline can be
- * arbitrarily long; in practice the benefits don't justify having more
- * than 2 stages (i.e., double buffering).  But it helps to think of the
- * pipeline as being a long one.  Each buffer head contains a bulk-in and
- * a bulk-out request pointer (since the buffer can be used for both
- * output and input -- directions always are given from the host's
- * point of view) as well as a pointer to the buffer and various state
- * variables.
+ * buffer heads (struct fsg_buffhd).  The number of stages is set by the
+ * num_buffers module parameter (default 4).  Two are enough for double
+ * buffering; more let the file I/O for a long READ or WRITE run ahead
+ * of, or behind, the USB transfers when either side is bursty.  Each
+ * buffer head contains a bulk-in and a bulk-out request pointer (since
+ * the buffer can be used for both output and input -- directions always
+ * are given from the host's point of view) as well as a pointer to the
+ * buffer and various state variables.
  *
  * Use of the pipeline follows a simple protocol.  There is a variable
  * (fsg->next_buffhd_to_fill) that points to the next buffer head to use.
@@ -464,7 +466,7 @@ struct fsg_dev {
 
 	struct fsg_buffhd	*next_buffhd_to_fill;
 	struct fsg_buffhd	*next_buffhd_to_drain;
-	struct fsg_buffhd	buffhds[FSG_NUM_BUFFERS];
+	struct fsg_buffhd	*buffhds;	/* fsg_num_buffers of them */
 
 	int			thread_wakeup_needed;
 	struct completion	thread_notifier;
@@ -2777,7 +2779,7 @@ static int do_set_interface(struct fsg_dev *fsg, int altsetting)
 
 reset:
 	/* Deallocate the requests */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		struct fsg_buffhd *bh = &fsg->buffhds[i];
 
 		if (bh->inreq) {
@@ -2838,7 +2840,7 @@ reset:
 	}
 
 	/* Allocate the requests */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &fsg->buffhds[i];
 
 		if ((rc = alloc_request(fsg, fsg->bulk_in, &bh->inreq)) != 0)
@@ -2934,7 +2936,7 @@ static void handle_exception(struct fsg_dev *fsg)
 	/* Cancel all the pending transfers */
 	if (fsg->intreq_busy)
 		usb_ep_dequeue(fsg->intr_in, fsg->intreq);
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		bh = &fsg->buffhds[i];
 		if (bh->inreq_busy)
 			usb_ep_dequeue(fsg->bulk_in, bh->inreq);
@@ -2945,7 +2947,7 @@ static void handle_exception(struct fsg_dev *fsg)
 	/* Wait until everything is idle */
 	for (;;) {
 		num_active = fsg->intreq_busy;
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < fsg_num_buffers; ++i) {
 			bh = &fsg->buffhds[i];
 			num_active += bh->inreq_busy + bh->outreq_busy;
 		}
@@ -2967,7 +2969,7 @@ static void handle_exception(struct fsg_dev *fsg)
 	 * state, and the exception.  Then invoke the handler. */
 	spin_lock_irq(&fsg->lock);
 
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		bh = &fsg->buffhds[i];
 		bh->state = BUF_STATE_EMPTY;
 	}
@@ -3152,6 +3154,7 @@ static void fsg_release(struct kref *ref)
 	struct fsg_dev	*fsg = container_of(ref, struct fsg_dev, ref);
 
 	kfree(fsg->luns);
+	kfree(fsg->buffhds);
 	kfree(fsg);
 }
 
@@ -3196,7 +3199,7 @@ static void /* __init_or_exit */ fsg_unbind(struct usb_gadget *gadget)
 	}
 
 	/* Free the data buffers */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i)
+	for (i = 0; i < fsg_num_buffers; ++i)
 		kfree(fsg->buffhds[i].buf);
 
 	/* Free the request and buffer for endpoint 0 */
@@ -3502,7 +3505,7 @@ static int __ref fsg_bind(struct usb_gadget *gadget)
 	req->complete = ep0_complete;
 
 	/* Allocate the data buffers */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg_num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &fsg->buffhds[i];
 
 		/* Allocate for the bulk-in endpoint.  We assume that
@@ -3513,7 +3516,7 @@ static int __ref fsg_bind(struct usb_gadget *gadget)
 			goto out;
 		bh->next = bh + 1;
 	}
-	fsg->buffhds[FSG_NUM_BUFFERS - 1].next = &fsg->buffhds[0];
+	fsg->buffhds[fsg_num_buffers - 1].next = &fsg->buffhds[0];
 
 	/* This should reflect the actual gadget power source */
 	usb_gadget_set_selfpowered(gadget);
@@ -3627,10 +3630,21 @@ static struct usb_gadget_driver		fsg_driver = {
 static int __init fsg_alloc(void)
 {
 	struct fsg_dev		*fsg;
+	int			rc;
+
+	rc = fsg_num_buffers_validate();
+	if (rc)
+		return rc;
 
 	fsg = kzalloc(sizeof *fsg, GFP_KERNEL);
 	if (!fsg)
 		return -ENOMEM;
+	fsg->buffhds = kcalloc(fsg_num_buffers, sizeof *fsg->buffhds,
+			       GFP_KERNEL);
+	if (!fsg->buffhds) {
+		kfree(fsg);
+		return -ENOMEM;
+	}
 	spin_lock_init(&fsg->lock);
 	init_rwsem(&fsg->filesem);
 	kref_init(&fsg->ref);
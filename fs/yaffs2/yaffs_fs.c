@@ -2671,6 +2671,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_WriteChunkWithTagsToNAND;
 		param->readChunkWithTagsFromNAND =
 		    nandmtd2_ReadChunkWithTagsFromNAND;
+		param->readBlockTagsFromNAND = nandmtd2_ReadBlockTagsFromNAND;
 		param->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		param->queryNANDBlock = nandmtd2_QueryNANDBlock;
 		yaffs_DeviceToContext(dev)->spareBuffer = YMALLOC(mtd->oobsize);
@@ -2915,6 +2916,7 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nFreeTnodes........ %d\n", dev->nFreeTnodes);
 	buf += sprintf(buf, "nObjectsCreated.... %d\n", dev->nObjectsCreated);
 	buf += sprintf(buf, "nFreeObjects....... %d\n", dev->nFreeObjects);
+	buf += sprintf(buf, "nObjectBuckets..... %d\n", dev->nObjectBuckets);
 	buf += sprintf(buf, "nFreeChunks........ %d\n", dev->nFreeChunks);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "nPageWrites........ %u\n", dev->nPageWrites);
@@ -2935,6 +2937,8 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nDeletedFiles...... %u\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %u\n", dev->nUnlinkedFiles);
 	buf += sprintf(buf, "refreshCount....... %u\n", dev->refreshCount);
+	buf += sprintf(buf, "nBlockTagReads..... %u\n", dev->nBlockTagReads);
+	buf += sprintf(buf, "nBlockTagFallbacks. %u\n", dev->nBlockTagFallbacks);
 	buf +=
 	    sprintf(buf, "nBackgroudDeletions %u\n", dev->nBackgroundDeletions);
 
@@ -46,6 +46,10 @@
 
 #include "yaffs_ecc.h"
 
+#if defined(__KERNEL__) && defined(CONFIG_SMP)
+#include <linux/async.h>
+#endif
+
 
 /* Robustification (if it ever comes about...) */
 static void yaffs_RetireBlock(yaffs_Device *dev, int blockInNAND);
@@ -854,7 +858,7 @@ static void yaffs_VerifyObjects(yaffs_Device *dev)
 
 	/* Iterate through the objects in each hash entry */
 
-	for (i = 0; i <  YAFFS_NOBJECT_BUCKETS; i++) {
+	for (i = 0; i <  dev->nObjectBuckets; i++) {
 		ylist_for_each(lh, &dev->objectBucket[i].list) {
 			if (lh) {
 				obj = ylist_entry(lh, yaffs_Object, hashLink);
@@ -869,10 +873,10 @@ static void yaffs_VerifyObjects(yaffs_Device *dev)
  *  Simple hash function. Needs to have a reasonable spread
  */
 
-static Y_INLINE int yaffs_HashFunction(int n)
+static Y_INLINE int yaffs_HashFunction(yaffs_Device *dev, int n)
 {
 	n = abs(n);
-	return n % YAFFS_NOBJECT_BUCKETS;
+	return n & (dev->nObjectBuckets - 1);
 }
 
 /*
@@ -2151,8 +2155,9 @@ static void yaffs_UnhashObject(yaffs_Object *tn)
 	/* If it is still linked into the bucket list, free from the list */
 	if (!ylist_empty(&tn->hashLink)) {
 		ylist_del_init(&tn->hashLink);
-		bucket = yaffs_HashFunction(tn->objectId);
+		bucket = yaffs_HashFunction(dev, tn->objectId);
 		dev->objectBucket[bucket].count--;
+		dev->nHashedObjects--;
 	}
 }
 
@@ -2219,20 +2224,97 @@ static void yaffs_DeinitialiseObjects(yaffs_Device *dev)
 	dev->freeObjects = NULL;
 	dev->nFreeObjects = 0;
 	dev->nObjectsCreated = 0;
+
+	if (dev->altObjectBucket)
+		YFREE_ALT(dev->objectBucket);
+	else
+		YFREE(dev->objectBucket);
+	dev->objectBucket = NULL;
+	dev->nObjectBuckets = 0;
+	dev->nHashedObjects = 0;
 }
 
-static void yaffs_InitialiseObjects(yaffs_Device *dev)
+static yaffs_ObjectBucket *yaffs_AllocateObjectBuckets(int nBuckets, int *alt)
 {
+	yaffs_ObjectBucket *buckets;
 	int i;
 
+	*alt = 0;
+	buckets = YMALLOC(nBuckets * sizeof(yaffs_ObjectBucket));
+	if (!buckets) {
+		buckets = YMALLOC_ALT(nBuckets * sizeof(yaffs_ObjectBucket));
+		*alt = 1;
+	}
+
+	if (buckets) {
+		for (i = 0; i < nBuckets; i++) {
+			YINIT_LIST_HEAD(&buckets[i].list);
+			buckets[i].count = 0;
+		}
+	}
+
+	return buckets;
+}
+
+static int yaffs_InitialiseObjects(yaffs_Device *dev)
+{
 	dev->allocatedObjectList = NULL;
 	dev->freeObjects = NULL;
 	dev->nFreeObjects = 0;
 
-	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
-		YINIT_LIST_HEAD(&dev->objectBucket[i].list);
-		dev->objectBucket[i].count = 0;
+	dev->objectBucket = yaffs_AllocateObjectBuckets(YAFFS_NOBJECT_BUCKETS,
+							&dev->altObjectBucket);
+	dev->nObjectBuckets = dev->objectBucket ? YAFFS_NOBJECT_BUCKETS : 0;
+	dev->nHashedObjects = 0;
+	dev->bucketFinder = 0;
+
+	return dev->objectBucket ? YAFFS_OK : YAFFS_FAIL;
+}
+
+/*
+ * Spread the hashed objects over nBuckets buckets. If the bigger table
+ * can't be had we just carry on with longer chains.
+ */
+static void yaffs_ResizeObjectBuckets(yaffs_Device *dev, int nBuckets)
+{
+	yaffs_ObjectBucket *oldBuckets = dev->objectBucket;
+	int nOldBuckets = dev->nObjectBuckets;
+	int oldAlt = dev->altObjectBucket;
+	yaffs_ObjectBucket *newBuckets;
+	int newAlt;
+	struct ylist_head *lh;
+	struct ylist_head *n;
+	yaffs_Object *obj;
+	int bucket;
+	int i;
+
+	newBuckets = yaffs_AllocateObjectBuckets(nBuckets, &newAlt);
+	if (!newBuckets)
+		return;
+
+	dev->objectBucket = newBuckets;
+	dev->nObjectBuckets = nBuckets;
+	dev->altObjectBucket = newAlt;
+	dev->bucketFinder = 0;
+
+	for (i = 0; i < nOldBuckets; i++) {
+		ylist_for_each_safe(lh, n, &oldBuckets[i].list) {
+			obj = ylist_entry(lh, yaffs_Object, hashLink);
+			bucket = yaffs_HashFunction(dev, obj->objectId);
+			ylist_del(lh);
+			ylist_add(lh, &newBuckets[bucket].list);
+			newBuckets[bucket].count++;
+		}
 	}
+
+	if (oldAlt)
+		YFREE_ALT(oldBuckets);
+	else
+		YFREE(oldBuckets);
+
+	T(YAFFS_TRACE_OS,
+	  (TSTR("yaffs: object hash now %d buckets for %d objects" TENDSTR),
+	   nBuckets, dev->nHashedObjects));
 }
 
 static int yaffs_FindNiceObjectBucket(yaffs_Device *dev)
@@ -2248,7 +2330,7 @@ static int yaffs_FindNiceObjectBucket(yaffs_Device *dev)
 
 	for (i = 0; i < 10 && lowest > 4; i++) {
 		dev->bucketFinder++;
-		dev->bucketFinder %= YAFFS_NOBJECT_BUCKETS;
+		dev->bucketFinder %= dev->nObjectBuckets;
 		if (dev->objectBucket[dev->bucketFinder].count < lowest) {
 			lowest = dev->objectBucket[dev->bucketFinder].count;
 			l = dev->bucketFinder;
@@ -2276,7 +2358,7 @@ static int yaffs_CreateNewObjectNumber(yaffs_Device *dev)
 
 	while (!found) {
 		found = 1;
-		n += YAFFS_NOBJECT_BUCKETS;
+		n += dev->nObjectBuckets;
 		if (1 || dev->objectBucket[bucket].count > 0) {
 			ylist_for_each(i, &dev->objectBucket[bucket].list) {
 				/* If there is already one in the list */
@@ -2293,16 +2375,22 @@ static int yaffs_CreateNewObjectNumber(yaffs_Device *dev)
 
 static void yaffs_HashObject(yaffs_Object *in)
 {
-	int bucket = yaffs_HashFunction(in->objectId);
 	yaffs_Device *dev = in->myDev;
+	int bucket;
+
+	if (dev->nHashedObjects >= dev->nObjectBuckets * YAFFS_OBJECT_BUCKET_LOAD &&
+	    dev->nObjectBuckets < YAFFS_MAX_OBJECT_BUCKETS)
+		yaffs_ResizeObjectBuckets(dev, dev->nObjectBuckets * 2);
 
+	bucket = yaffs_HashFunction(dev, in->objectId);
 	ylist_add(&in->hashLink, &dev->objectBucket[bucket].list);
 	dev->objectBucket[bucket].count++;
+	dev->nHashedObjects++;
 }
 
 yaffs_Object *yaffs_FindObjectByNumber(yaffs_Device *dev, __u32 number)
 {
-	int bucket = yaffs_HashFunction(number);
+	int bucket = yaffs_HashFunction(dev, number);
 	struct ylist_head *i;
 	yaffs_Object *in;
 
@@ -4780,7 +4868,7 @@ static int yaffs_WriteCheckpointObjects(yaffs_Device *dev)
 	 * dumping them to the checkpointing stream.
 	 */
 
-	for (i = 0; ok &&  i <  YAFFS_NOBJECT_BUCKETS; i++) {
+	for (i = 0; ok &&  i <  dev->nObjectBuckets; i++) {
 		ylist_for_each(lh, &dev->objectBucket[i].list) {
 			if (lh) {
 				obj = ylist_entry(lh, yaffs_Object, hashLink);
@@ -5900,6 +5988,82 @@ static int ybicmp(const void *a, const void *b)
 		return aseq - bseq;
 }
 
+#if defined(__KERNEL__) && defined(CONFIG_SMP)
+
+/* Below this many blocks, handing half the sort off costs more than it saves */
+#define YAFFS_PARALLEL_SORT_MIN_BLOCKS 1024
+
+typedef struct {
+	yaffs_BlockIndex *blocks;
+	int nBlocks;
+} yaffs_SortRun;
+
+static void yaffs_SortRunAsync(void *data, async_cookie_t cookie)
+{
+	yaffs_SortRun *run = data;
+
+	yaffs_qsort(run->blocks, run->nBlocks, sizeof(yaffs_BlockIndex),
+		    ybicmp);
+}
+
+/*
+ * Sort the first half of the block index on another cpu while this one sorts
+ * the second, then merge the two. If there is no other cpu, too few blocks
+ * or no memory for the merge, sort it all here.
+ */
+static void yaffs_SortBlockIndex(yaffs_BlockIndex *blockIndex, int nBlocks)
+{
+	LIST_HEAD(domain);
+	yaffs_SortRun first;
+	yaffs_BlockIndex *merged = NULL;
+	int altMerged = 0;
+	int half = nBlocks / 2;
+	int i, j, k;
+
+	if (nBlocks >= YAFFS_PARALLEL_SORT_MIN_BLOCKS && num_online_cpus() > 1) {
+		merged = YMALLOC(nBlocks * sizeof(yaffs_BlockIndex));
+		if (!merged) {
+			merged = YMALLOC_ALT(nBlocks * sizeof(yaffs_BlockIndex));
+			altMerged = 1;
+		}
+	}
+	if (!merged) {
+		yaffs_qsort(blockIndex, nBlocks, sizeof(yaffs_BlockIndex),
+			    ybicmp);
+		return;
+	}
+
+	first.blocks = blockIndex;
+	first.nBlocks = half;
+	async_schedule_domain(yaffs_SortRunAsync, &first, &domain);
+	yaffs_qsort(blockIndex + half, nBlocks - half,
+		    sizeof(yaffs_BlockIndex), ybicmp);
+	async_synchronize_full_domain(&domain);
+
+	for (i = 0, j = half, k = 0; k < nBlocks; k++) {
+		if (j == nBlocks ||
+		    (i < half && ybicmp(&blockIndex[i], &blockIndex[j]) <= 0))
+			merged[k] = blockIndex[i++];
+		else
+			merged[k] = blockIndex[j++];
+	}
+	memcpy(blockIndex, merged, nBlocks * sizeof(yaffs_BlockIndex));
+
+	if (altMerged)
+		YFREE_ALT(merged);
+	else
+		YFREE(merged);
+}
+
+#else
+
+static void yaffs_SortBlockIndex(yaffs_BlockIndex *blockIndex, int nBlocks)
+{
+	yaffs_qsort(blockIndex, nBlocks, sizeof(yaffs_BlockIndex), ybicmp);
+}
+
+#endif
+
 
 struct yaffs_ShadowFixerStruct {
 	int objectId;
@@ -5976,7 +6140,7 @@ static void yaffs_FixHangingObjects(yaffs_Device *dev)
 	 * Make sure it is rooted.
 	 */
 
-	for (i = 0; i <  YAFFS_NOBJECT_BUCKETS; i++) {
+	for (i = 0; i <  dev->nObjectBuckets; i++) {
 		ylist_for_each_safe(lh, n, &dev->objectBucket[i].list) {
 			if (lh) {
 				obj = ylist_entry(lh, yaffs_Object, hashLink);
@@ -6585,6 +6749,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
+	yaffs_ExtendedTags *blockTags;
 
 	if (!dev->param.isYaffs2) {
 		T(YAFFS_TRACE_SCAN,
@@ -6617,6 +6782,12 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
+	/*
+	 * Every chunk of a block that needs scanning gets its tags read, so
+	 * read them a block at a time. Without the buffer, go chunk by chunk.
+	 */
+	blockTags = YMALLOC(dev->param.nChunksPerBlock * sizeof(yaffs_ExtendedTags));
+
 	/* Scan all the blocks to determine their state */
 	bi = dev->blockInfo;
 	for (blk = dev->internalStartBlock; blk <= dev->internalEndBlock; blk++) {
@@ -6685,8 +6856,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	/* Sort the blocks */
 #ifndef CONFIG_YAFFS_USE_OWN_SORT
 	{
-		/* Use qsort now. */
-		yaffs_qsort(blockIndex, nBlocksToScan, sizeof(yaffs_BlockIndex), ybicmp);
+		/* Use qsort now, over two cpus if there are enough blocks */
+		yaffs_SortBlockIndex(blockIndex, nBlocksToScan);
 	}
 #else
 	{
@@ -6733,6 +6904,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		if (blockTags &&
+		    (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
+		     state == YAFFS_BLOCK_STATE_ALLOCATING))
+			yaffs_ReadBlockTagsFromNAND(dev, blk, blockTags);
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->param.nChunksPerBlock - 1;
@@ -6745,8 +6921,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->param.nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (blockTags)
+				tags = blockTags[c];
+			else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -7182,6 +7361,9 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	else
 		YFREE(blockIndex);
 
+	if (blockTags)
+		YFREE(blockTags);
+
 	/* Ok, we've done all the scanning.
 	 * Fix up the hard link chains.
 	 * We should now have scanned all the objects, now it's time to add these
@@ -8004,7 +8186,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	yaffs_InitialiseTnodes(dev);
-	yaffs_InitialiseObjects(dev);
+	if (!init_failed && !yaffs_InitialiseObjects(dev))
+		init_failed = 1;
 
 	if (!init_failed && !yaffs_CreateInitialDirectories(dev))
 		init_failed = 1;
@@ -8039,7 +8222,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 					init_failed = 1;
 
 				yaffs_InitialiseTnodes(dev);
-				yaffs_InitialiseObjects(dev);
+				if (!init_failed && !yaffs_InitialiseObjects(dev))
+					init_failed = 1;
 
 				if (!init_failed && !yaffs_CreateInitialDirectories(dev))
 					init_failed = 1;
@@ -58,7 +58,13 @@
 #define YAFFS_ALLOCATION_NTNODES	100
 #define YAFFS_ALLOCATION_NLINKS		100
 
+/*
+ * The object hash starts with YAFFS_NOBJECT_BUCKETS buckets and doubles
+ * whenever it averages more than YAFFS_OBJECT_BUCKET_LOAD objects a bucket.
+ */
 #define YAFFS_NOBJECT_BUCKETS		256
+#define YAFFS_MAX_OBJECT_BUCKETS	65536
+#define YAFFS_OBJECT_BUCKET_LOAD	4
 
 
 #define YAFFS_OBJECT_SPACE		0x40000
@@ -584,6 +590,9 @@ struct yaffs_DeviceParamStruct {
 	int (*readChunkWithTagsFromNAND) (struct yaffs_DeviceStruct *dev,
 					  int chunkInNAND, __u8 *data,
 					  yaffs_ExtendedTags *tags);
+	/* Optional: read the tags of all chunks in a block at once */
+	int (*readBlockTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+				      int blockNo, yaffs_ExtendedTags *tags);
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
@@ -697,7 +706,10 @@ struct yaffs_DeviceStruct {
 
 	yaffs_ObjectList *allocatedObjectList;
 
-	yaffs_ObjectBucket objectBucket[YAFFS_NOBJECT_BUCKETS];
+	yaffs_ObjectBucket *objectBucket;
+	int nObjectBuckets;		/* Always a power of 2 */
+	int altObjectBucket;		/* objectBucket came from YMALLOC_ALT */
+	int nHashedObjects;
 	__u32 bucketFinder;
 
 	int nFreeChunks;
@@ -778,6 +790,10 @@ struct yaffs_DeviceStruct {
 	__u32 refreshCount;
 	__u32 cacheHits;
 
+	/* Mount scan, not reset once mounted */
+	__u32 nBlockTagReads;		/* Blocks whose tags came in one read */
+	__u32 nBlockTagFallbacks;	/* Blocks read chunk by chunk instead */
+
 };
 
 typedef struct yaffs_DeviceStruct yaffs_Device;
@@ -193,6 +193,69 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/*
+ * Read the tags of all the chunks in a block with one oob read. MTD_OOB_AUTO
+ * packs each page's free oob bytes back to back, so the tags of chunk i
+ * start at i * oobavail.
+ */
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockNo,
+				   yaffs_ExtendedTags *tags)
+{
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	struct mtd_info *mtd = yaffs_DeviceToContext(dev)->mtd;
+	struct mtd_oob_ops ops;
+	int nChunks = dev->param.nChunksPerBlock;
+	int retval;
+	int i;
+	__u8 *oob;
+
+	loff_t addr = ((loff_t) blockNo) * nChunks *
+			dev->param.totalBytesPerChunk;
+
+	yaffs_PackedTags2 pt;
+
+	int packed_tags_size = dev->param.noTagsECC ? sizeof(pt.t) : sizeof(pt);
+	void * packed_tags_ptr = dev->param.noTagsECC ? (void *) &pt.t: (void *)&pt;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadBlockTagsFromNAND block %d" TENDSTR), blockNo));
+
+	if (dev->param.inbandTags || mtd->oobavail < packed_tags_size)
+		return YAFFS_FAIL;
+
+	oob = YMALLOC(nChunks * mtd->oobavail);
+	if (!oob)
+		return YAFFS_FAIL;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = nChunks * mtd->oobavail;
+	ops.len = 0;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	/*
+	 * Bit flip reports can't be tied to a chunk here, so anything but a
+	 * clean read of the whole block is left to the per chunk path.
+	 */
+	if (retval == 0 && ops.oobretlen == ops.ooblen) {
+		for (i = 0; i < nChunks; i++) {
+			memcpy(packed_tags_ptr, oob + i * mtd->oobavail,
+			       packed_tags_size);
+			yaffs_UnpackTags2(&tags[i], &pt, !dev->param.noTagsECC);
+		}
+	} else
+		retval = -EIO;
+
+	YFREE(oob);
+
+	if (retval == 0)
+		return YAFFS_OK;
+#endif
+	return YAFFS_FAIL;
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = yaffs_DeviceToContext(dev)->mtd;
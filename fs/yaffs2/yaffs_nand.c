@@ -51,6 +51,42 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 	return result;
 }
 
+/*
+ * Read the tags of every chunk in a block into tags[]. This is a single
+ * request to the driver if it supports that, else one per chunk.
+ */
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockNo,
+				yaffs_ExtendedTags *tags)
+{
+	int firstChunk = blockNo * dev->param.nChunksPerBlock;
+	int result = YAFFS_FAIL;
+	int i;
+
+	if (dev->param.readBlockTagsFromNAND && !dev->param.inbandTags)
+		result = dev->param.readBlockTagsFromNAND(dev,
+						blockNo - dev->blockOffset, tags);
+
+	if (result == YAFFS_OK) {
+		dev->nPageReads += dev->param.nChunksPerBlock;
+		dev->nBlockTagReads++;
+
+		for (i = 0; i < dev->param.nChunksPerBlock; i++) {
+			if (tags[i].eccResult > YAFFS_ECC_RESULT_NO_ERROR)
+				yaffs_HandleChunkError(dev,
+					yaffs_GetBlockInfo(dev, blockNo));
+		}
+		return YAFFS_OK;
+	}
+
+	/* Not supported, or the driver could not do it: go chunk by chunk */
+	dev->nBlockTagFallbacks++;
+	for (i = 0; i < dev->param.nChunksPerBlock; i++)
+		result = yaffs_ReadChunkWithTagsFromNAND(dev, firstChunk + i,
+							 NULL, &tags[i]);
+
+	return result;
+}
+
 int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						   int chunkInNAND,
 						   const __u8 *buffer,
@@ -99,6 +99,19 @@ struct mmc_host_ops {
 	 */
 	int (*enable)(struct mmc_host *host);
 	int (*disable)(struct mmc_host *host, int lazy);
+	/*
+	 * It is optional for the host to implement pre_req and post_req.
+	 * pre_req is called for a request before it is started, possibly
+	 * while another request is still being transferred, and lets the
+	 * host do its preparation (e.g. DMA mapping) off the critical path.
+	 * is_first_req is set when no request is in flight to overlap with.
+	 * post_req undoes it once the request has completed.  Hosts may
+	 * keep state in data->host_cookie, which is zeroed by the caller.
+	 */
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req,
+			   bool is_first_req);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
 	/*
 	 * Avoid calling these three functions too often or in a "fast path",
@@ -175,6 +188,7 @@ struct mmc_host {
 #define MMC_CAP_WAIT_WHILE_BUSY	(1 << 9)	/* Waits while card is busy */
 #define MMC_CAP_ERASE		(1 << 10)	/* Allow erase/trim commands */
 #define MMC_CAP_FORCE_HS	(1 << 11)	/* Must enable highspeed mode */
+#define MMC_CAP_PACKED_WR	(1 << 12)	/* Allow packed write commands */
 
 	mmc_pm_flag_t		pm_caps;	/* supported pm features */
 
@@ -246,9 +260,9 @@ struct mmc_host {
 	} embedded_sdio_data;
 #endif
 
-	unsigned long		private[0] ____cacheline_aligned;
+	u32			opcode;		/* last command started */
 
-	u32			opcode;
+	unsigned long		private[0] ____cacheline_aligned;
 };
 
 extern struct mmc_host *mmc_alloc_host(int extra, struct device *);
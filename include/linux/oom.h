@@ -68,6 +68,48 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_OOM_ADJ_INDEX
+/*
+ * Thread group leaders hashed by signal->oom_adj, one list per value, so
+ * that a killer looking for the highest oom_adj does not have to walk
+ * every process. The lists are protected by oom_adj_index_lock. It nests
+ * inside tasklist_lock and the sighand lock, which interrupts take too,
+ * so it is always taken with interrupts disabled.
+ */
+#define OOM_ADJ_INDEX_SIZE	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+extern struct hlist_head oom_adj_index[OOM_ADJ_INDEX_SIZE];
+extern spinlock_t oom_adj_index_lock;
+
+static inline struct hlist_head *oom_adj_index_head(int oom_adj)
+{
+	return &oom_adj_index[oom_adj - OOM_DISABLE];
+}
+
+extern void oom_adj_index_add(struct task_struct *p);
+extern void oom_adj_index_del(struct task_struct *p);
+extern void oom_adj_index_replace(struct task_struct *old,
+				  struct task_struct *new);
+extern void oom_adj_index_update(struct task_struct *p);
+#else
+static inline void oom_adj_index_add(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_index_del(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_index_replace(struct task_struct *old,
+					 struct task_struct *new)
+{
+}
+
+static inline void oom_adj_index_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
@@ -1215,6 +1215,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_OOM_ADJ_INDEX
+	struct hlist_node oom_adj_node;
+#endif
 	struct plist_node pushable_tasks;
 
 	struct mm_struct *mm, *active_mm;
@@ -251,6 +251,8 @@ extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
 extern int remove_mapping(struct address_space *mapping, struct page *page);
 extern long vm_total_pages;
+extern int vmpressure_register_notifier(struct notifier_block *nb);
+extern int vmpressure_unregister_notifier(struct notifier_block *nb);
 
 #ifdef CONFIG_NUMA
 extern int zone_reclaim_mode;
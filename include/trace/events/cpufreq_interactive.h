@@ -0,0 +1,134 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_interactive
+
+#if !defined(_TRACE_CPUFREQ_INTERACTIVE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_INTERACTIVE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * The raw input of each load evaluation: the busy and idle time over the
+ * sample, and since the last frequency change.
+ */
+TRACE_EVENT(cpufreq_interactive_sample,
+
+	TP_PROTO(unsigned long cpu_id, unsigned int delta_time,
+		 unsigned int delta_idle, unsigned int change_time,
+		 unsigned int change_idle),
+
+	TP_ARGS(cpu_id, delta_time, delta_idle, change_time, change_idle),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	cpu_id		)
+		__field(	unsigned int,	delta_time	)
+		__field(	unsigned int,	delta_idle	)
+		__field(	unsigned int,	change_time	)
+		__field(	unsigned int,	change_idle	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->delta_time = delta_time;
+		__entry->delta_idle = delta_idle;
+		__entry->change_time = change_time;
+		__entry->change_idle = change_idle;
+	),
+
+	TP_printk("cpu=%lu time=%uus idle=%uus since_change=%uus "
+		  "change_idle=%uus",
+		  __entry->cpu_id, __entry->delta_time, __entry->delta_idle,
+		  __entry->change_time, __entry->change_idle)
+);
+
+DECLARE_EVENT_CLASS(loadeval,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long curfreq, unsigned long targfreq),
+
+	TP_ARGS(cpu_id, load, curfreq, targfreq),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	cpu_id		)
+		__field(	unsigned long,	load		)
+		__field(	unsigned long,	curfreq		)
+		__field(	unsigned long,	targfreq	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->load = load;
+		__entry->curfreq = curfreq;
+		__entry->targfreq = targfreq;
+	),
+
+	TP_printk("cpu=%lu load=%lu cur=%lu targ=%lu", __entry->cpu_id,
+		  __entry->load, __entry->curfreq, __entry->targfreq)
+);
+
+DEFINE_EVENT(loadeval, cpufreq_interactive_target,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long curfreq, unsigned long targfreq),
+
+	TP_ARGS(cpu_id, load, curfreq, targfreq)
+);
+
+DEFINE_EVENT(loadeval, cpufreq_interactive_already,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long curfreq, unsigned long targfreq),
+
+	TP_ARGS(cpu_id, load, curfreq, targfreq)
+);
+
+DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long load,
+		 unsigned long curfreq, unsigned long targfreq),
+
+	TP_ARGS(cpu_id, load, curfreq, targfreq)
+);
+
+DECLARE_EVENT_CLASS(set,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long targfreq,
+		 unsigned long actualfreq),
+
+	TP_ARGS(cpu_id, targfreq, actualfreq),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	cpu_id		)
+		__field(	unsigned long,	targfreq	)
+		__field(	unsigned long,	actualfreq	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->targfreq = targfreq;
+		__entry->actualfreq = actualfreq;
+	),
+
+	TP_printk("cpu=%lu targ=%lu actual=%lu", __entry->cpu_id,
+		  __entry->targfreq, __entry->actualfreq)
+);
+
+DEFINE_EVENT(set, cpufreq_interactive_up,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long targfreq,
+		 unsigned long actualfreq),
+
+	TP_ARGS(cpu_id, targfreq, actualfreq)
+);
+
+DEFINE_EVENT(set, cpufreq_interactive_down,
+
+	TP_PROTO(unsigned long cpu_id, unsigned long targfreq,
+		 unsigned long actualfreq),
+
+	TP_ARGS(cpu_id, targfreq, actualfreq)
+);
+
+#endif /* _TRACE_CPUFREQ_INTERACTIVE_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
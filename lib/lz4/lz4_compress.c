@@ -0,0 +1,156 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Greedy single-pass compressor producing the LZ4 block format.
+ *  Candidate matches are found through a hash table of 4-byte
+ *  sequences; as with LZO1X-1, the table is not cleared between
+ *  calls since every candidate is verified against the input.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U)
+			>> (32 - LZ4_HASH_LOG);
+}
+
+/* Bytes needed to encode a length field beyond its token nibble */
+static inline size_t lz4_length_bytes(size_t len, size_t mask)
+{
+	return len >= mask ? (len - mask) / 255 + 1 : 0;
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char ** const table = wrkmem;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - LZ4_MFLIMIT;
+	const unsigned char * const matchlimit = iend - LZ4_LASTLITERALS;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	unsigned char * const oend = dst + *dst_len;
+	unsigned char *op = dst, *token;
+	size_t litlen, mlen;
+	u32 h, searches;
+
+	/* Too short to contain any match */
+	if (src_len < LZ4_MFLIMIT + 1)
+		goto last_literals;
+
+	table[lz4_hash(ip)] = ip;
+	ip++;
+
+	for (;;) {
+		/* Find a match */
+		searches = 1 << LZ4_SKIP_TRIGGER;
+		for (;;) {
+			if (ip > mflimit)
+				goto last_literals;
+
+			h = lz4_hash(ip);
+			ref = table[h];
+			table[h] = ip;
+
+			if (ref >= src && ref < ip &&
+			    ip - ref <= LZ4_MAX_DISTANCE &&
+			    get_unaligned((const u32 *)ref) ==
+			    get_unaligned((const u32 *)ip))
+				break;
+
+			ip += searches++ >> LZ4_SKIP_TRIGGER;
+		}
+
+		/* Extend backwards into pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Extend forwards */
+		mlen = LZ4_MINMATCH;
+		while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+			mlen++;
+
+		litlen = ip - anchor;
+		if (unlikely((size_t)(oend - op) < 1 + litlen + 2 +
+				lz4_length_bytes(litlen, LZ4_RUN_MASK) +
+				lz4_length_bytes(mlen - LZ4_MINMATCH,
+						LZ4_ML_MASK)))
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		token = op++;
+		if (litlen >= LZ4_RUN_MASK) {
+			*token = LZ4_RUN_MASK << LZ4_ML_BITS;
+			op = lz4_put_length(op, litlen - LZ4_RUN_MASK);
+		} else {
+			*token = litlen << LZ4_ML_BITS;
+		}
+
+		memcpy(op, anchor, litlen);
+		op += litlen;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		if (mlen - LZ4_MINMATCH >= LZ4_ML_MASK) {
+			*token |= LZ4_ML_MASK;
+			op = lz4_put_length(op,
+					mlen - LZ4_MINMATCH - LZ4_ML_MASK);
+		} else {
+			*token |= mlen - LZ4_MINMATCH;
+		}
+
+		ip += mlen;
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+
+		/* Seed the table with a position inside the match */
+		table[lz4_hash(ip - 2)] = ip - 2;
+	}
+
+last_literals:
+	litlen = iend - anchor;
+	if (unlikely((size_t)(oend - op) < 1 + litlen +
+			lz4_length_bytes(litlen, LZ4_RUN_MASK)))
+		return LZ4_E_OUTPUT_OVERRUN;
+
+	if (litlen >= LZ4_RUN_MASK) {
+		*op++ = LZ4_RUN_MASK << LZ4_ML_BITS;
+		op = lz4_put_length(op, litlen - LZ4_RUN_MASK);
+	} else {
+		*op++ = litlen << LZ4_ML_BITS;
+	}
+
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,98 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Decodes the LZ4 block format, checking every literal run and match
+ *  against both the input and the output bounds.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char * const iend = src + src_len;
+	unsigned char * const oend = dst + *dst_len;
+	const unsigned char *ip = src, *ref;
+	unsigned char *op = dst;
+	unsigned int token, s;
+	size_t len, off;
+
+	*dst_len = 0;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literal run */
+		len = token >> LZ4_ML_BITS;
+		if (len == LZ4_RUN_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					return LZ4_E_INPUT_OVERRUN;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+
+		if (unlikely(len > (size_t)(iend - ip)))
+			return LZ4_E_INPUT_OVERRUN;
+		if (unlikely(len > (size_t)(oend - op)))
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			return LZ4_E_INPUT_OVERRUN;
+		off = get_unaligned_le16(ip);
+		ip += 2;
+
+		if (unlikely(!off || off > (size_t)(op - dst)))
+			return LZ4_E_LOOKBEHIND_OVERRUN;
+
+		/* Match */
+		len = token & LZ4_ML_MASK;
+		if (len == LZ4_ML_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					return LZ4_E_INPUT_OVERRUN;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += LZ4_MINMATCH;
+
+		if (unlikely(len > (size_t)(oend - op)))
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		ref = op - off;
+		if (off >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* Overlapping copy replicates the last 'off' bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,27 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_MINMATCH		4
+
+/* The last LZ4_LASTLITERALS bytes of a block are always literals */
+#define LZ4_LASTLITERALS	5
+
+/* A match may not start within the last LZ4_MFLIMIT bytes */
+#define LZ4_MFLIMIT		12
+
+#define LZ4_MAX_DISTANCE	0xffff
+
+#define LZ4_ML_BITS		4
+#define LZ4_ML_MASK		((1U << LZ4_ML_BITS) - 1)
+#define LZ4_RUN_MASK		((1U << (8 - LZ4_ML_BITS)) - 1)
+
+/*
+ * Number of failed match attempts after which the compressor starts
+ * skipping ahead faster through incompressible data.
+ */
+#define LZ4_SKIP_TRIGGER	6
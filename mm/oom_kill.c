@@ -37,6 +37,60 @@ int sysctl_oom_kill_allocating_task;
 int sysctl_oom_dump_tasks = 1;
 static DEFINE_SPINLOCK(zone_scan_lock);
 
+#ifdef CONFIG_OOM_ADJ_INDEX
+struct hlist_head oom_adj_index[OOM_ADJ_INDEX_SIZE];
+DEFINE_SPINLOCK(oom_adj_index_lock);
+
+/*
+ * Called with tasklist_lock write-locked for a new thread group leader,
+ * and for the leader that goes away.
+ */
+void oom_adj_index_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	hlist_add_head(&p->oom_adj_node,
+		       oom_adj_index_head(p->signal->oom_adj));
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+void oom_adj_index_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	hlist_del_init(&p->oom_adj_node);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/* A thread that execs takes over the place of its old group leader */
+void oom_adj_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	hlist_add_after(&old->oom_adj_node, &new->oom_adj_node);
+	hlist_del_init(&old->oom_adj_node);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/* Called with the sighand lock held after signal->oom_adj changed */
+void oom_adj_index_update(struct task_struct *p)
+{
+	unsigned long flags;
+
+	p = p->group_leader;
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	if (!hlist_unhashed(&p->oom_adj_node)) {
+		hlist_del(&p->oom_adj_node);
+		hlist_add_head(&p->oom_adj_node,
+			       oom_adj_index_head(p->signal->oom_adj));
+	}
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+#endif
+
 #ifdef CONFIG_NUMA
 /**
  * has_intersects_mems_allowed() - check task eligiblity for kill
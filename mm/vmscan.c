@@ -181,6 +181,70 @@ void unregister_shrinker(struct shrinker *shrinker)
 }
 EXPORT_SYMBOL(unregister_shrinker);
 
+/*
+ * Global reclaim efficiency, sampled over windows of VMPRESSURE_WIN
+ * scanned LRU pages. At the end of each window the notifier chain is
+ * called with the pressure, from 0 (everything scanned was reclaimed)
+ * to 100 (nothing was).
+ */
+#define VMPRESSURE_WIN (SWAP_CLUSTER_MAX * 16)
+
+static ATOMIC_NOTIFIER_HEAD(vmpressure_notifier);
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+
+int vmpressure_register_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL(vmpressure_register_notifier);
+
+int vmpressure_unregister_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL(vmpressure_unregister_notifier);
+
+static void vmpressure(unsigned long scanned, unsigned long reclaimed)
+{
+	unsigned long pressure = 0;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	if (vmpressure_scanned < VMPRESSURE_WIN) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	if (reclaimed < scanned)
+		pressure = 100 - reclaimed * 100 / scanned;
+	atomic_notifier_call_chain(&vmpressure_notifier, pressure, NULL);
+}
+
+/*
+ * With few pages left on the LRU lists, anon pages without swap for
+ * instance, a window may never fill up however hard reclaim struggles.
+ * Once direct reclaim is down to this priority, count a window in which
+ * nothing was reclaimed.
+ */
+#define VMPRESSURE_CRITICAL_PRIO 3
+
+static void vmpressure_prio(int priority)
+{
+	if (priority <= VMPRESSURE_CRITICAL_PRIO)
+		vmpressure(VMPRESSURE_WIN, 0);
+}
+
 #define SHRINK_BATCH 128
 /*
  * Call the shrink functions to age shrinkable caches
@@ -1747,6 +1811,7 @@ static void shrink_zone(int priority, struct zone *zone,
 	enum lru_list l;
 	unsigned long nr_reclaimed = sc->nr_reclaimed;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_scanned = sc->nr_scanned;
 
 	get_scan_count(zone, sc, nr, priority);
 
@@ -1776,6 +1841,9 @@ static void shrink_zone(int priority, struct zone *zone,
 			break;
 	}
 
+	if (scanning_global_lru(sc))
+		vmpressure(sc->nr_scanned - nr_scanned,
+			   nr_reclaimed - sc->nr_reclaimed);
 	sc->nr_reclaimed = nr_reclaimed;
 
 	/*
@@ -1904,6 +1972,8 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		 */
 		if (scanning_global_lru(sc)) {
 			unsigned long lru_pages = 0;
+
+			vmpressure_prio(priority);
 			for_each_zone_zonelist(zone, z, zonelist,
 					gfp_zone(sc->gfp_mask)) {
 				if (!cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))
@@ -0,0 +1,170 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o ashmem-ranges ashmem-ranges.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Cost of pin, unpin and pin status queries on a fragmented ashmem area.
+ *
+ * For each number of ranges given with -r, maps an area twice that many
+ * pages long and unpins every other page, leaving that many unpinned ranges
+ * which cannot merge, the way an image cache ends up after many partial
+ * unpins. Random pages are then pinned and unpinned again, and the pin
+ * status of random pages is queried. The average time of each operation is
+ * printed for each number of ranges, so how it grows with the number of
+ * ranges can be read off directly:
+ *
+ *	ashmem-ranges -r 10,100,1000,10000 -n 100000
+ *
+ * Only the ranges are set up, the pages themselves are never touched, so
+ * even large counts need little memory.
+ */
+
+#include <fcntl.h>
+#include <linux/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../include/linux/ashmem.h"
+
+#define PAGE_SIZE	4096
+
+static const char *dev = "/dev/ashmem";
+static unsigned ops = 100000;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int pin_ioctl(int fd, unsigned long cmd, unsigned page)
+{
+	struct ashmem_pin pin = { page * PAGE_SIZE, PAGE_SIZE };
+	int ret = ioctl(fd, cmd, &pin);
+
+	if (ret < 0)
+		die(cmd == ASHMEM_PIN ? "ASHMEM_PIN" : cmd == ASHMEM_UNPIN ?
+		    "ASHMEM_UNPIN" : "ASHMEM_GET_PIN_STATUS");
+	return ret;
+}
+
+static void bench(unsigned ranges)
+{
+	size_t size = (size_t)ranges * 2 * PAGE_SIZE;
+	uint64_t start, pin_ns = 0, unpin_ns = 0, status_ns;
+	unsigned i, seed = ranges;
+	void *map;
+	int fd;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	if (ioctl(fd, ASHMEM_SET_SIZE, size))
+		die("ASHMEM_SET_SIZE");
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		die("mmap");
+
+	/* odd pages unpinned, each between two pinned ones */
+	for (i = 0; i < ranges; i++)
+		pin_ioctl(fd, ASHMEM_UNPIN, 2 * i + 1);
+
+	/* removes a range and puts it back */
+	for (i = 0; i < ops; i++) {
+		unsigned page = 2 * (rand_r(&seed) % ranges) + 1;
+
+		start = now_ns();
+		pin_ioctl(fd, ASHMEM_PIN, page);
+		pin_ns += now_ns() - start;
+		start = now_ns();
+		pin_ioctl(fd, ASHMEM_UNPIN, page);
+		unpin_ns += now_ns() - start;
+	}
+
+	start = now_ns();
+	for (i = 0; i < ops; i++) {
+		unsigned page = rand_r(&seed) % (2 * ranges);
+
+		if (pin_ioctl(fd, ASHMEM_GET_PIN_STATUS, page) !=
+		    (page & 1 ? ASHMEM_IS_UNPINNED : ASHMEM_IS_PINNED)) {
+			fprintf(stderr, "page %u: wrong pin status\n", page);
+			exit(1);
+		}
+	}
+	status_ns = now_ns() - start;
+
+	printf("%8u  %10.0f  %11.0f  %12.0f\n", ranges,
+	       (double)pin_ns / ops, (double)unpin_ns / ops,
+	       (double)status_ns / ops);
+	fflush(stdout);
+
+	munmap(map, size);
+	close(fd);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-r ranges,...] [-n ops]\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *counts = NULL, *count;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:r:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'r':
+			counts = optarg;
+			break;
+		case 'n':
+			ops = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!ops)
+		usage(argv[0]);
+	if (!counts)
+		counts = strdup("10,100,1000,10000");
+
+	printf("%8s  %10s  %11s  %12s\n", "ranges", "pin ns/op",
+	       "unpin ns/op", "status ns/op");
+	for (count = strtok(counts, ","); count; count = strtok(NULL, ",")) {
+		unsigned ranges = atoi(count);
+
+		if (!ranges)
+			usage(argv[0]);
+		bench(ranges);
+	}
+	return 0;
+}
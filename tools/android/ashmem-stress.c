@@ -0,0 +1,385 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o ashmem-stress ashmem-stress.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Pin/unpin storm on ashmem, with and without memory pressure.
+ *
+ * Every thread maps an area of its own, the way each app has its own
+ * caches, and flips random chunks of it between pinned and unpinned, about
+ * half of the area being unpinned at any time. A chunk found purged when it
+ * is pinned again is refilled, as an app would. Each pin and unpin is timed.
+ *
+ * The storm is run twice. The second time, a hog process holds more memory
+ * than reclaim can find without the shrinkers and keeps faulting slices of
+ * it back in, so that the ashmem shrinker runs while the threads pin and
+ * unpin. The hog is restarted whenever one of the killers picks it. For each
+ * run, the rate of operations, the median, 99th percentile and worst pin and
+ * unpin latencies and the number of chunks purged are printed:
+ *
+ *	ashmem-stress -t 4 -s 16 -n 500000
+ *
+ * With CONFIG_LOCK_STAT, the wait and hold times of the ashmem locks are
+ * taken from /proc/lock_stat and printed after each run, so that how long
+ * the shrinker holds them can be seen next to what the threads waited.
+ * Needs root for that, and to keep the killers away from the threads.
+ */
+
+#include <fcntl.h>
+#include <linux/types.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../include/linux/ashmem.h"
+
+#define MB		(1 << 20)
+#define PAGE_SIZE	4096
+#define LOCK_STAT	"/proc/lock_stat"
+
+static const char *dev = "/dev/ashmem";
+static unsigned threads = 4, size_mb = 8, chunk_pages = 16, ops = 20000;
+static pthread_barrier_t barrier;
+
+struct worker {
+	pthread_t	thread;
+	unsigned	id;
+	uint32_t	*pin_lat, *unpin_lat;
+	unsigned	nr_pin, nr_unpin;
+	unsigned	purged;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void set_oom_adj(int adj)
+{
+	FILE *f = fopen("/proc/self/oom_adj", "w");
+
+	if (f) {
+		fprintf(f, "%d\n", adj);
+		fclose(f);
+	}
+}
+
+static void touch(char *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += PAGE_SIZE)
+		p[i] = 1;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)size_mb * MB, chunk = chunk_pages * PAGE_SIZE;
+	unsigned nr_chunks = size / chunk, i, seed = w->id;
+	char name[ASHMEM_NAME_LEN], *map, *pinned;
+	int fd;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	snprintf(name, sizeof(name), "ashmem-stress-%u", w->id);
+	if (ioctl(fd, ASHMEM_SET_NAME, name) ||
+	    ioctl(fd, ASHMEM_SET_SIZE, size))
+		die("ashmem");
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	pinned = malloc(nr_chunks);
+	if (map == MAP_FAILED || !pinned)
+		die("mmap");
+	touch(map, size);
+	memset(pinned, 1, nr_chunks);
+	/* all areas populated, then wait for the pressure to start */
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+
+	for (i = 0; i < ops; i++) {
+		unsigned c = rand_r(&seed) % nr_chunks;
+		struct ashmem_pin pin = { c * chunk, chunk };
+		uint64_t start = now_ns();
+		int ret;
+
+		ret = ioctl(fd, pinned[c] ? ASHMEM_UNPIN : ASHMEM_PIN, &pin);
+		if (ret < 0)
+			die(pinned[c] ? "ASHMEM_UNPIN" : "ASHMEM_PIN");
+		if (pinned[c])
+			w->unpin_lat[w->nr_unpin++] = now_ns() - start;
+		else {
+			w->pin_lat[w->nr_pin++] = now_ns() - start;
+			if (ret == ASHMEM_WAS_PURGED) {
+				touch(map + pin.offset, chunk);
+				w->purged++;
+			}
+		}
+		pinned[c] = !pinned[c];
+	}
+
+	munmap(map, size);
+	close(fd);
+	free(pinned);
+	return NULL;
+}
+
+/*
+ * MemFree + Cached - Shmem from /proc/meminfo, in MB: what reclaim can find
+ * without the shrinkers, ashmem pages being shmem.
+ */
+static unsigned available_mb(void)
+{
+	FILE *f = fopen("/proc/meminfo", "r");
+	long kb, total = 0;
+	char line[128];
+
+	if (!f)
+		die("/proc/meminfo");
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "MemFree: %ld", &kb) == 1 ||
+		    sscanf(line, "Cached: %ld", &kb) == 1)
+			total += kb;
+		else if (sscanf(line, "Shmem: %ld", &kb) == 1)
+			total -= kb;
+	fclose(f);
+	return total > 0 ? total >> 10 : 0;
+}
+
+/*
+ * Allocates what reclaim can find plus half of what the threads keep
+ * unpinned, then keeps dropping and faulting back a slice of it, so that
+ * reclaim runs for as long as the threads do.
+ */
+static void hog(void)
+{
+	size_t len = ((size_t)available_mb() + threads * size_mb / 4) * MB;
+	size_t slice = 4 * MB, off;
+	char *p;
+
+	/* if the killers have to step in, this is the one to pick */
+	set_oom_adj(0);
+	/* no overcommit check, reclaim has to find the memory */
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	touch(p, len);
+	for (off = 0;; off = (off + slice) % (len - slice)) {
+		madvise(p + off, slice, MADV_DONTNEED);
+		touch(p + off, slice);
+	}
+}
+
+/* keeps a hog running, restarting it when a killer got it */
+static void pressure(void)
+{
+	setpgid(0, 0);
+	for (;;) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			hog();
+		waitpid(pid, NULL, 0);
+	}
+}
+
+static void clear_lock_stat(void)
+{
+	FILE *f = fopen(LOCK_STAT, "w");
+
+	if (f) {
+		fprintf(f, "0\n");
+		fclose(f);
+	}
+}
+
+/* the lines of /proc/lock_stat about the ashmem locks */
+static void print_lock_stat(void)
+{
+	FILE *f = fopen(LOCK_STAT, "r");
+	char line[512], name[64];
+	unsigned long contentions, acquisitions, bounces;
+	double wmin, wmax, wtotal, hmin, hmax, htotal;
+
+	if (!f)
+		return;
+	printf("%-24s %10s %10s %10s %10s %10s %10s\n", "lock",
+	       "acquired", "contended", "wait avg", "wait max",
+	       "hold avg", "hold max");
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, " %63[^:]: %lu %lu %lf %lf %lf %lu %lu "
+			   "%lf %lf %lf", name, &bounces, &contentions, &wmin,
+			   &wmax, &wtotal, &bounces, &acquisitions, &hmin,
+			   &hmax, &htotal) != 11 ||
+		    (!strstr(name, "ashmem") && !strstr(name, "asma")))
+			continue;
+		printf("%-24s %10lu %10lu %10.1f %10.1f %10.1f %10.1f\n",
+		       name, acquisitions, contentions,
+		       contentions ? wtotal / contentions : 0, wmax,
+		       acquisitions ? htotal / acquisitions : 0, hmax);
+	}
+	fclose(f);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_lat(uint32_t *lat, unsigned n)
+{
+	qsort(lat, n, sizeof(*lat), cmp_u32);
+	if (n)
+		printf("  %9.1f  %9.1f  %9.1f", lat[n / 2] / 1e3,
+		       lat[n - 1 - n / 100] / 1e3, lat[n - 1] / 1e3);
+	else
+		printf("  %9s  %9s  %9s", "-", "-", "-");
+}
+
+static void run(int with_pressure)
+{
+	struct worker w[threads];
+	uint32_t *pin_lat, *unpin_lat;
+	unsigned i, nr_pin = 0, nr_unpin = 0, purged = 0;
+	uint64_t start, elapsed;
+	pid_t pid = 0;
+
+	pin_lat = malloc((size_t)threads * ops * sizeof(*pin_lat));
+	unpin_lat = malloc((size_t)threads * ops * sizeof(*unpin_lat));
+	if (!pin_lat || !unpin_lat)
+		die("malloc");
+
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].id = i;
+		w[i].pin_lat = pin_lat + i * ops;
+		w[i].unpin_lat = unpin_lat + i * ops;
+		if (pthread_create(&w[i].thread, NULL, worker_thread, &w[i]))
+			die("pthread_create");
+	}
+	pthread_barrier_wait(&barrier);
+
+	if (with_pressure) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			pressure();
+	}
+	clear_lock_stat();
+	start = now_ns();
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < threads; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now_ns() - start;
+
+	if (pid) {
+		kill(-pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+
+	/* pack the latencies of all threads together */
+	for (i = 0; i < threads; i++) {
+		memmove(pin_lat + nr_pin, w[i].pin_lat,
+			w[i].nr_pin * sizeof(*pin_lat));
+		memmove(unpin_lat + nr_unpin, w[i].unpin_lat,
+			w[i].nr_unpin * sizeof(*unpin_lat));
+		nr_pin += w[i].nr_pin;
+		nr_unpin += w[i].nr_unpin;
+		purged += w[i].purged;
+	}
+
+	printf("%-8s  %8.0f", with_pressure ? "pressure" : "idle",
+	       (nr_pin + nr_unpin) * 1e9 / elapsed);
+	print_lat(pin_lat, nr_pin);
+	print_lat(unpin_lat, nr_unpin);
+	printf("  %6u\n", purged);
+	print_lock_stat();
+	printf("\n");
+	fflush(stdout);
+
+	pthread_barrier_destroy(&barrier);
+	free(pin_lat);
+	free(unpin_lat);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-t threads] [-s area_mb] "
+		"[-c chunk_pages] [-n ops]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:s:c:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 's':
+			size_mb = atoi(optarg);
+			break;
+		case 'c':
+			chunk_pages = atoi(optarg);
+			break;
+		case 'n':
+			ops = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!threads || !chunk_pages || !ops ||
+	    (size_t)size_mb * MB < (size_t)chunk_pages * PAGE_SIZE)
+		usage(argv[0]);
+
+	set_oom_adj(-17);
+
+	printf("%-8s  %8s  %9s  %9s  %9s  %9s  %9s  %9s  %6s\n", "run",
+	       "ops/s", "pin p50", "pin p99", "pin max", "unpin p50",
+	       "unpin p99", "unpin max", "purged");
+	printf("(latencies in us)\n");
+	fflush(stdout);
+	run(0);
+	run(1);
+	return 0;
+}
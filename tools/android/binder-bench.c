@@ -0,0 +1,604 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -I../../drivers/staging/android -o binder-bench binder-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Binder transaction throughput between independent pairs of processes.
+ *
+ * For 1, 2, 4, ... pairs, forks that many server processes and as many
+ * clients. Each client looks up its own server and then makes synchronous
+ * calls to it back to back, the server replying with as many bytes as it was
+ * sent. No two pairs share a process, so with fine-grained locking in the
+ * driver the pairs should not slow each other down. The aggregate number of
+ * calls per second and the median, 99th percentile and worst call latencies
+ * are printed for each number of pairs:
+ *
+ *	binder-bench -p 4 -n 20000 -s 128
+ *
+ * Servers are registered with the context manager the way services are. If
+ * no context manager is running, on a desktop kernel for instance, the
+ * benchmark becomes the context manager itself and serves the lookups.
+ * On a device that means running it as root, so servicemanager accepts the
+ * registrations.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binder.h"
+
+#define MAP_SIZE		(128 * 1024)
+
+/* servicemanager protocol */
+#define SVC_MGR_NAME		"android.os.IServiceManager"
+#define SVC_MGR_GET_SERVICE	1
+#define SVC_MGR_ADD_SERVICE	3
+
+#define CALL_CODE		1	/* code of the benchmarked calls */
+
+static const char *dev = "/dev/binder";
+static unsigned max_pairs = 2, calls = 20000, size = 128;
+
+struct binder {
+	int		fd;
+	uint32_t	rbuf[64];	/* commands returned by the driver */
+	size_t		rlen, rpos;
+};
+
+struct parcel {
+	char		data[512];
+	size_t		len;
+	size_t		offs[1];
+	size_t		nr_offs;
+};
+
+/* one entry per name registered with our own context manager */
+struct service {
+	char		name[64];
+	long		handle;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void binder_open(struct binder *b)
+{
+	struct binder_version vers;
+
+	b->fd = open(dev, O_RDWR);
+	if (b->fd < 0)
+		die(dev);
+	if (ioctl(b->fd, BINDER_VERSION, &vers) ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "%s: unsupported binder protocol\n", dev);
+		exit(1);
+	}
+	/* the driver copies the transactions we receive into this mapping */
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, b->fd, 0) ==
+	    MAP_FAILED)
+		die("mmap");
+	b->rlen = b->rpos = 0;
+}
+
+/*
+ * Writes 'len' bytes of commands and, with 'wait', reads what the driver has
+ * for us if everything read before has been used.
+ */
+static void binder_io(struct binder *b, const void *cmds, size_t len,
+		      int wait)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)cmds;
+	bwr.write_size = len;
+	if (wait && b->rpos == b->rlen) {
+		bwr.read_buffer = (unsigned long)b->rbuf;
+		bwr.read_size = sizeof(b->rbuf);
+	}
+	while (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0)
+		if (errno != EINTR)
+			die("BINDER_WRITE_READ");
+	if (bwr.read_size) {
+		b->rlen = bwr.read_consumed;
+		b->rpos = 0;
+	}
+}
+
+/*
+ * Returns the next command from the driver, and its payload in 'arg'.
+ * Reference count requests are acknowledged here, the caller never sees
+ * them.
+ */
+static uint32_t binder_next(struct binder *b, void *arg)
+{
+	for (;;) {
+		uint32_t cmd;
+		size_t len;
+
+		while (b->rpos == b->rlen)
+			binder_io(b, NULL, 0, 1);
+
+		memcpy(&cmd, (char *)b->rbuf + b->rpos, sizeof(cmd));
+		len = _IOC_SIZE(cmd);
+		memcpy(arg, (char *)b->rbuf + b->rpos + sizeof(cmd), len);
+		b->rpos += sizeof(cmd) + len;
+
+		if (cmd == BR_INCREFS || cmd == BR_ACQUIRE) {
+			struct {
+				uint32_t cmd;
+				struct binder_ptr_cookie pc;
+			} __attribute__((packed)) done;
+
+			done.cmd = cmd == BR_INCREFS ? BC_INCREFS_DONE :
+						       BC_ACQUIRE_DONE;
+			memcpy(&done.pc, arg, sizeof(done.pc));
+			binder_io(b, &done, sizeof(done), 0);
+			continue;
+		}
+		if (cmd == BR_NOOP || cmd == BR_RELEASE || cmd == BR_DECREFS ||
+		    cmd == BR_TRANSACTION_COMPLETE || cmd == BR_SPAWN_LOOPER)
+			continue;
+		return cmd;
+	}
+}
+
+static void binder_cmd(struct binder *b, uint32_t cmd, const void *arg,
+		       size_t len, int wait)
+{
+	char buf[sizeof(cmd) + sizeof(struct binder_transaction_data)];
+
+	memcpy(buf, &cmd, sizeof(cmd));
+	if (len)
+		memcpy(buf + sizeof(cmd), arg, len);
+	binder_io(b, buf, sizeof(cmd) + len, wait);
+}
+
+static void binder_free(struct binder *b, const void *buffer)
+{
+	binder_cmd(b, BC_FREE_BUFFER, &buffer, sizeof(buffer), 0);
+}
+
+/*
+ * Sends a transaction, or a reply if 'handle' is negative, and for a
+ * transaction waits for the reply. The reply buffer must be freed with
+ * binder_free().
+ */
+static void binder_send(struct binder *b, long handle, uint32_t code,
+			const struct parcel *p,
+			struct binder_transaction_data *reply)
+{
+	struct binder_transaction_data txn;
+	uint32_t cmd;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.target.handle = handle;
+	txn.code = code;
+	txn.data_size = p->len;
+	txn.offsets_size = p->nr_offs * sizeof(size_t);
+	txn.data.ptr.buffer = p->data;
+	txn.data.ptr.offsets = p->offs;
+	/* the reply usually comes back in the same ioctl */
+	binder_cmd(b, handle < 0 ? BC_REPLY : BC_TRANSACTION, &txn,
+		   sizeof(txn), handle >= 0);
+	if (handle < 0)
+		return;
+
+	cmd = binder_next(b, reply);
+	if (cmd != BR_REPLY) {
+		fprintf(stderr, "transaction failed: %s\n",
+			cmd == BR_DEAD_REPLY ? "dead reply" : "failed reply");
+		exit(1);
+	}
+}
+
+static void put_u32(struct parcel *p, uint32_t v)
+{
+	memcpy(p->data + p->len, &v, sizeof(v));
+	p->len += sizeof(v);
+}
+
+/* a String16: length in chars, then the chars and a NUL, padded to 4 */
+static void put_string16(struct parcel *p, const char *s)
+{
+	uint16_t c;
+	size_t i, n = strlen(s);
+
+	put_u32(p, n);
+	for (i = 0; i <= n; i++) {
+		c = (unsigned char)s[i];
+		memcpy(p->data + p->len, &c, sizeof(c));
+		p->len += sizeof(c);
+	}
+	while (p->len & 3)
+		p->data[p->len++] = 0;
+}
+
+static void put_object(struct parcel *p, unsigned long type, long handle,
+		       void *ptr)
+{
+	struct flat_binder_object obj;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = type;
+	obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	if (type == BINDER_TYPE_HANDLE)
+		obj.handle = handle;
+	else
+		obj.binder = ptr;
+	p->offs[p->nr_offs++] = p->len;
+	memcpy(p->data + p->len, &obj, sizeof(obj));
+	p->len += sizeof(obj);
+}
+
+static void put_header(struct parcel *p, const char *name)
+{
+	p->len = p->nr_offs = 0;
+	put_u32(p, 0);			/* strict mode policy */
+	put_string16(p, SVC_MGR_NAME);
+	put_string16(p, name);
+}
+
+/* reads a String16 at *pos into 'buf' as ASCII */
+static int get_string16(const struct binder_transaction_data *txn,
+			size_t *pos, char *buf, size_t len)
+{
+	const char *data = txn->data.ptr.buffer;
+	uint32_t n, i;
+	uint16_t c;
+
+	if (*pos + sizeof(n) > txn->data_size)
+		return -1;
+	memcpy(&n, data + *pos, sizeof(n));
+	*pos += sizeof(n);
+	if (n >= len || *pos + (n + 1) * sizeof(c) > txn->data_size)
+		return -1;
+	for (i = 0; i < n; i++) {
+		memcpy(&c, data + *pos + i * sizeof(c), sizeof(c));
+		buf[i] = c;
+	}
+	buf[n] = '\0';
+	*pos += ((n + 1) * sizeof(c) + 3) & ~3;
+	return 0;
+}
+
+/* the handle of the first object in a transaction, or -1 */
+static long get_handle(const struct binder_transaction_data *txn)
+{
+	const size_t *offs = txn->data.ptr.offsets;
+	struct flat_binder_object obj;
+
+	if (!txn->offsets_size)
+		return -1;
+	memcpy(&obj, (const char *)txn->data.ptr.buffer + offs[0],
+	       sizeof(obj));
+	return obj.type == BINDER_TYPE_HANDLE ? obj.handle : -1;
+}
+
+/* keeps a handle alive once the buffer it came in is freed */
+static void acquire(struct binder *b, long handle)
+{
+	uint32_t desc = handle;
+
+	binder_cmd(b, BC_INCREFS, &desc, sizeof(desc), 0);
+	binder_cmd(b, BC_ACQUIRE, &desc, sizeof(desc), 0);
+}
+
+static void add_service(struct binder *b, const char *name, void *ptr)
+{
+	struct binder_transaction_data reply;
+	struct parcel p;
+
+	put_header(&p, name);
+	put_object(&p, BINDER_TYPE_BINDER, 0, ptr);
+	binder_send(b, 0, SVC_MGR_ADD_SERVICE, &p, &reply);
+	binder_free(b, reply.data.ptr.buffer);
+}
+
+static long get_service(struct binder *b, const char *name)
+{
+	struct binder_transaction_data reply;
+	struct parcel p;
+	long handle;
+
+	for (;;) {
+		put_header(&p, name);
+		binder_send(b, 0, SVC_MGR_GET_SERVICE, &p, &reply);
+		handle = get_handle(&reply);
+		if (handle >= 0)
+			acquire(b, handle);
+		binder_free(b, reply.data.ptr.buffer);
+		if (handle >= 0)
+			return handle;
+		/* the server has not registered yet */
+		usleep(10000);
+	}
+}
+
+/* a minimal servicemanager, for when there is none */
+static void context_manager(struct binder *b)
+{
+	static struct service services[256];
+	struct binder_transaction_data txn;
+	unsigned nr_services = 0, i;
+	struct parcel reply;
+
+	binder_cmd(b, BC_ENTER_LOOPER, NULL, 0, 0);
+	for (;;) {
+		char iface[64], name[64];
+		size_t pos = sizeof(uint32_t);
+
+		if (binder_next(b, &txn) != BR_TRANSACTION)
+			continue;
+
+		reply.len = reply.nr_offs = 0;
+		if (!get_string16(&txn, &pos, iface, sizeof(iface)) &&
+		    !get_string16(&txn, &pos, name, sizeof(name))) {
+			if (txn.code == SVC_MGR_ADD_SERVICE &&
+			    nr_services < 256) {
+				struct service *s = &services[nr_services++];
+
+				strcpy(s->name, name);
+				s->handle = get_handle(&txn);
+				acquire(b, s->handle);
+			} else if (txn.code == SVC_MGR_GET_SERVICE) {
+				for (i = 0; i < nr_services; i++)
+					if (!strcmp(services[i].name, name))
+						break;
+				if (i < nr_services)
+					put_object(&reply, BINDER_TYPE_HANDLE,
+						   services[i].handle, NULL);
+			}
+		}
+		if (!reply.len)
+			put_u32(&reply, 0);
+
+		binder_free(b, txn.data.ptr.buffer);
+		binder_send(b, -1, 0, &reply, NULL);
+	}
+}
+
+/* replies to every call with as many bytes as it got */
+static void server(const char *name)
+{
+	static int cookie;
+	struct binder_transaction_data txn;
+	struct parcel reply;
+	struct binder b;
+
+	binder_open(&b);
+	add_service(&b, name, &cookie);
+	binder_cmd(&b, BC_ENTER_LOOPER, NULL, 0, 0);
+
+	memset(reply.data, 'r', sizeof(reply.data));
+	reply.nr_offs = 0;
+	for (;;) {
+		if (binder_next(&b, &txn) != BR_TRANSACTION)
+			continue;
+		reply.len = txn.data_size;
+		binder_free(&b, txn.data.ptr.buffer);
+		binder_send(&b, -1, 0, &reply, NULL);
+	}
+}
+
+static void client(const char *name, int ready, int start, uint32_t *lat)
+{
+	struct binder_transaction_data reply;
+	struct parcel p;
+	struct binder b;
+	long handle;
+	unsigned i;
+	char c;
+
+	binder_open(&b);
+	handle = get_service(&b, name);
+
+	memset(p.data, 'c', sizeof(p.data));
+	p.len = size;
+	p.nr_offs = 0;
+
+	/* wait for every client to be ready */
+	c = 0;
+	if (write(ready, &c, 1) != 1 || read(start, &c, 1) < 0)
+		die("pipe");
+
+	for (i = 0; i < calls; i++) {
+		uint64_t t = now_ns();
+
+		binder_send(&b, handle, CALL_CODE, &p, &reply);
+		lat[i] = now_ns() - t;
+		if (reply.data_size != size) {
+			fprintf(stderr, "short reply\n");
+			exit(1);
+		}
+		binder_free(&b, reply.data.ptr.buffer);
+	}
+	exit(0);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(unsigned pairs, uint32_t *lat)
+{
+	pid_t servers[pairs], clients[pairs];
+	unsigned i, total = pairs * calls;
+	uint64_t start, elapsed;
+	int ready[2], go[2], status;
+	char name[64], c;
+
+	if (pipe(ready) || pipe(go))
+		die("pipe");
+
+	for (i = 0; i < pairs; i++) {
+		snprintf(name, sizeof(name), "binder-bench.%d.%u.%u",
+			 getpid(), pairs, i);
+		servers[i] = fork();
+		if (servers[i] < 0)
+			die("fork");
+		if (!servers[i]) {
+			close(go[1]);
+			server(name);
+		}
+		clients[i] = fork();
+		if (clients[i] < 0)
+			die("fork");
+		if (!clients[i]) {
+			close(go[1]);
+			client(name, ready[1], go[0], lat + i * calls);
+		}
+	}
+
+	/* each client says when it has found its server */
+	for (i = 0; i < pairs; i++)
+		if (read(ready[0], &c, 1) != 1)
+			die("read");
+	close(ready[0]);
+	close(ready[1]);
+	close(go[0]);
+	start = now_ns();
+	close(go[1]);
+	for (i = 0; i < pairs; i++) {
+		if (waitpid(clients[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "client %u failed\n", i);
+			exit(1);
+		}
+	}
+	elapsed = now_ns() - start;
+
+	for (i = 0; i < pairs; i++) {
+		kill(servers[i], SIGKILL);
+		waitpid(servers[i], NULL, 0);
+	}
+
+	qsort(lat, total, sizeof(*lat), cmp_u32);
+	printf("%5u  %8.0f  %7.1f  %7.1f  %8.1f\n", pairs,
+	       total * 1e9 / elapsed, lat[total / 2] / 1e3,
+	       lat[total - 1 - total / 100] / 1e3, lat[total - 1] / 1e3);
+	fflush(stdout);
+}
+
+/* forks our own context manager if there is none yet */
+static pid_t start_context_manager(void)
+{
+	int pipefd[2], err = 0;
+	struct binder b;
+	pid_t pid;
+
+	if (pipe(pipefd))
+		die("pipe");
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid) {
+		binder_open(&b);
+		if (ioctl(b.fd, BINDER_SET_CONTEXT_MGR, 0))
+			err = errno;
+		if (write(pipefd[1], &err, sizeof(err)) != sizeof(err))
+			die("write");
+		if (err)
+			exit(0);
+		context_manager(&b);
+	}
+	if (read(pipefd[0], &err, sizeof(err)) != sizeof(err))
+		die("read");
+	close(pipefd[0]);
+	close(pipefd[1]);
+	if (err) {
+		/* there is one, e.g. servicemanager */
+		waitpid(pid, NULL, 0);
+		return 0;
+	}
+	return pid;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-p pairs] [-n calls] "
+		"[-s size]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned pairs;
+	uint32_t *lat;
+	pid_t mgr;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:p:n:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'p':
+			max_pairs = atoi(optarg);
+			break;
+		case 'n':
+			calls = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_pairs || !calls || size > sizeof(((struct parcel *)0)->data))
+		usage(argv[0]);
+
+	/* filled in by the clients */
+	lat = mmap(NULL, (size_t)max_pairs * calls * sizeof(*lat),
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (lat == MAP_FAILED)
+		die("mmap");
+
+	mgr = start_context_manager();
+
+	printf("pairs   calls/s  p50 us   p99 us    max us\n");
+	fflush(stdout);
+	for (pairs = 1; pairs <= max_pairs; pairs *= 2)
+		run(pairs, lat);
+
+	if (mgr) {
+		kill(mgr, SIGKILL);
+		waitpid(mgr, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,384 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o gadget-bench gadget-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Bulk throughput of a USB gadget function, measured from both ends at once
+ * on a machine where the gadget is connected to its own host through
+ * dummy_hcd.
+ *
+ * A child process plays the device: with -f mtp it has the MTP driver
+ * receive a file with MTP_RECEIVE_FILE and send it back with MTP_SEND_FILE,
+ * the ioctls the MTP service uses for file transfers. With -f adb it copies
+ * between /dev/android_adb and the file with read() and write(), the way
+ * adbd handles a push and a pull; with -f adb-splice it does the same with
+ * splice() and sendfile(), so the two can be compared. The parent plays the
+ * host through usbfs, writing the data to the function's bulk OUT endpoint
+ * and reading it back from the bulk IN one, with several URBs in flight the
+ * way a host side client keeps the bus busy. The throughput each way is
+ * printed for each round, as the host sees it:
+ *
+ *	modprobe dummy_hcd
+ *	echo 1 > /sys/class/usb_composite/mtp/enable
+ *	gadget-bench -f mtp -u /dev/bus/usb/002/002 -t /tmp/gadget-bench
+ *
+ * The adb function is enabled for as long as /dev/android_adb_enable is held
+ * open, and adbd must not be running:
+ *
+ *	sleep 3600 < /dev/android_adb_enable &
+ *	gadget-bench -f adb-splice -u /dev/bus/usb/002/003 -t /tmp/gadget-bench
+ *
+ * The device side file, given with -t, is overwritten. The host and device
+ * sides share the cpus, so the numbers are a lower bound on what a real
+ * host would see.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+#include "../../include/linux/usb/f_mtp.h"
+
+#define MAX_URBS	32
+#define URB_LEN		16384	/* largest usbfs takes */
+#define MAX_PACKET	512	/* high speed bulk */
+#define CHUNK		65536	/* adb side reads, writes and splices */
+
+struct function {
+	const char	*name;
+	const char	*dev;		/* the gadget side device node */
+	__u8		class, subclass, protocol;
+	int		zlp;		/* IN transfers end in a ZLP */
+	void		(*serve)(int fd, int file);
+};
+
+static const struct function *func;
+static const char *usbdev, *path = "/data/local/tmp/gadget-bench";
+static unsigned size_mb = 64, rounds = 3, nr_urbs = 8;
+static uint64_t size;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* receives size bytes into the file, then sends them back */
+static void serve_mtp(int fd, int file)
+{
+	struct mtp_file_range range = { file, 0, size };
+
+	if (ioctl(fd, MTP_RECEIVE_FILE, &range))
+		die("MTP_RECEIVE_FILE");
+	if (ioctl(fd, MTP_SEND_FILE, &range))
+		die("MTP_SEND_FILE");
+}
+
+static size_t chunk(uint64_t done)
+{
+	return size - done < CHUNK ? size - done : CHUNK;
+}
+
+/* the same with read() and write() through a buffer */
+static void serve_adb(int fd, int file)
+{
+	static char buf[CHUNK];
+	uint64_t done;
+	ssize_t n;
+
+	if (lseek(file, 0, SEEK_SET))
+		die("lseek");
+	for (done = 0; done < size; done += n) {
+		n = read(fd, buf, chunk(done));
+		if (n <= 0)
+			die("read");
+		if (write(file, buf, n) != n)
+			die("write");
+	}
+
+	if (lseek(file, 0, SEEK_SET))
+		die("lseek");
+	for (done = 0; done < size; done += n) {
+		n = read(file, buf, chunk(done));
+		if (n <= 0)
+			die("read");
+		if (write(fd, buf, n) != n)
+			die("write");
+	}
+}
+
+/* and with splice() through a pipe in, and sendfile() out */
+static void serve_adb_splice(int fd, int file)
+{
+	static int pipefd[2] = { -1, -1 };
+	uint64_t done;
+	loff_t off = 0;
+	ssize_t n, m;
+
+	if (pipefd[0] < 0 && pipe(pipefd))
+		die("pipe");
+	for (done = 0; done < size; done += n) {
+		n = splice(fd, NULL, pipefd[1], NULL, chunk(done), 0);
+		if (n <= 0)
+			die("splice");
+		for (m = 0; m < n; ) {
+			ssize_t r = splice(pipefd[0], NULL, file, &off, n - m,
+					   0);
+
+			if (r <= 0)
+				die("splice");
+			m += r;
+		}
+	}
+
+	for (off = 0, done = 0; done < size; done += n) {
+		n = sendfile(fd, file, &off, size - done);
+		if (n <= 0)
+			die("sendfile");
+	}
+}
+
+static const struct function functions[] = {
+	/* the MTP interface; in PTP mode it is a still image one */
+	{ "mtp", "/dev/mtp_usb", USB_CLASS_VENDOR_SPEC, USB_SUBCLASS_VENDOR_SPEC,
+	  0, 1, serve_mtp },
+	{ "ptp", "/dev/mtp_usb", USB_CLASS_STILL_IMAGE, 1, 1, 1, serve_mtp },
+	{ "adb", "/dev/android_adb", USB_CLASS_VENDOR_SPEC, 0x42, 1, 0,
+	  serve_adb },
+	{ "adb-splice", "/dev/android_adb", USB_CLASS_VENDOR_SPEC, 0x42, 1, 0,
+	  serve_adb_splice },
+};
+
+static void device_side(void)
+{
+	unsigned i;
+	int fd, file;
+
+	fd = open(func->dev, O_RDWR);
+	if (fd < 0)
+		die(func->dev);
+	file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+		die(path);
+	for (i = 0; i < rounds; i++)
+		func->serve(fd, file);
+	close(file);
+	close(fd);
+	exit(0);
+}
+
+/* the function's interface number and bulk endpoints, from usbfs */
+static int find_interface(int fd, unsigned char *in, unsigned char *out)
+{
+	unsigned char desc[4096];
+	ssize_t len, pos;
+	int intf = -1, match = 0;
+
+	len = read(fd, desc, sizeof(desc));
+	if (len < 0)
+		die(usbdev);
+
+	*in = *out = 0;
+	for (pos = 0; pos + 2 <= len && desc[pos]; pos += desc[pos]) {
+		struct usb_interface_descriptor *id = (void *)&desc[pos];
+		struct usb_endpoint_descriptor *ed = (void *)&desc[pos];
+
+		if (desc[pos + 1] == USB_DT_INTERFACE) {
+			match = id->bInterfaceClass == func->class &&
+				id->bInterfaceSubClass == func->subclass &&
+				id->bInterfaceProtocol == func->protocol;
+			if (match)
+				intf = id->bInterfaceNumber;
+		} else if (desc[pos + 1] == USB_DT_ENDPOINT && match &&
+			   (ed->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) ==
+			   USB_ENDPOINT_XFER_BULK) {
+			if (ed->bEndpointAddress & USB_DIR_IN)
+				*in = ed->bEndpointAddress;
+			else
+				*out = ed->bEndpointAddress;
+		}
+	}
+	if (intf < 0 || !*in || !*out) {
+		fprintf(stderr, "%s: no %s interface\n", usbdev, func->name);
+		exit(1);
+	}
+	return intf;
+}
+
+/*
+ * Moves size bytes over the endpoint, keeping nr_urbs URBs in flight, and
+ * returns the time it took. An IN transfer of a whole number of packets
+ * ends with a zero length packet, which is read too.
+ */
+static uint64_t transfer(int fd, unsigned char ep, char *buf)
+{
+	struct usbdevfs_urb urbs[MAX_URBS], *urb;
+	uint64_t queued = 0, done = 0, start;
+	unsigned i, in_flight = 0;
+	int zlp = func->zlp && (ep & USB_DIR_IN) && size % MAX_PACKET == 0;
+
+	memset(urbs, 0, sizeof(urbs));
+	start = now_ns();
+	while (done < size || zlp || in_flight) {
+		for (i = 0; i < nr_urbs && in_flight < nr_urbs; i++) {
+			urb = &urbs[i];
+			if (urb->usercontext)
+				continue;
+			if (queued == size && !zlp)
+				break;
+			memset(urb, 0, sizeof(*urb));
+			urb->type = USBDEVFS_URB_TYPE_BULK;
+			urb->endpoint = ep;
+			urb->buffer = buf + i * URB_LEN;
+			urb->usercontext = urb;
+			if (queued < size) {
+				urb->buffer_length = size - queued < URB_LEN ?
+						     size - queued : URB_LEN;
+				queued += urb->buffer_length;
+			} else {
+				/* only there to take the zero length packet */
+				urb->buffer_length = URB_LEN;
+				zlp = 0;
+			}
+			if (ioctl(fd, USBDEVFS_SUBMITURB, urb))
+				die("USBDEVFS_SUBMITURB");
+			in_flight++;
+		}
+
+		if (ioctl(fd, USBDEVFS_REAPURB, &urb))
+			die("USBDEVFS_REAPURB");
+		if (urb->status) {
+			errno = -urb->status;
+			die("urb");
+		}
+		done += urb->actual_length;
+		if (urb->actual_length < urb->buffer_length && done < size) {
+			fprintf(stderr, "short transfer after %llu bytes\n",
+				(unsigned long long)done);
+			exit(1);
+		}
+		urb->usercontext = NULL;
+		in_flight--;
+	}
+	return now_ns() - start;
+}
+
+static void host_side(void)
+{
+	unsigned char in, out;
+	unsigned i;
+	uint64_t t;
+	char *buf;
+	int fd, intf;
+
+	fd = open(usbdev, O_RDWR);
+	if (fd < 0)
+		die(usbdev);
+	intf = find_interface(fd, &in, &out);
+	if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &intf))
+		die("USBDEVFS_CLAIMINTERFACE");
+	buf = malloc(nr_urbs * URB_LEN);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, nr_urbs * URB_LEN);
+
+	printf("%5s  %14s  %16s\n", "round", "to device MB/s",
+	       "from device MB/s");
+	for (i = 0; i < rounds; i++) {
+		t = transfer(fd, out, buf);
+		printf("%5u  %14.1f", i + 1, size * 1e3 / t);
+		t = transfer(fd, in, buf);
+		printf("  %16.1f\n", size * 1e3 / t);
+		fflush(stdout);
+	}
+
+	ioctl(fd, USBDEVFS_RELEASEINTERFACE, &intf);
+	free(buf);
+	close(fd);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -f mtp|ptp|adb|adb-splice -u usbfs_device "
+		"[-t file] [-s size_mb] [-n rounds] [-q urbs]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = NULL;
+	int status, opt;
+	unsigned i;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "f:u:t:s:n:q:")) != -1) {
+		switch (opt) {
+		case 'f':
+			name = optarg;
+			break;
+		case 'u':
+			usbdev = optarg;
+			break;
+		case 't':
+			path = optarg;
+			break;
+		case 's':
+			size_mb = atoi(optarg);
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 'q':
+			nr_urbs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	for (i = 0; name && i < sizeof(functions) / sizeof(*functions); i++)
+		if (!strcmp(name, functions[i].name))
+			func = &functions[i];
+	if (!func || !usbdev || !size_mb || !rounds || !nr_urbs ||
+	    nr_urbs > MAX_URBS)
+		usage(argv[0]);
+	size = (uint64_t)size_mb << 20;
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid)
+		device_side();
+	host_side();
+	if (waitpid(pid, &status, 0) < 0)
+		die("waitpid");
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
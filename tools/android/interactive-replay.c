@@ -0,0 +1,654 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o interactive-replay interactive-replay.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Replays a recorded per-cpu busy/idle trace through the interactive cpufreq
+ * governor, so that tunables can be compared on a desktop, the same trace
+ * giving the same answer every time.
+ *
+ * The trace is the text of an ftrace recording of the sched_switch and
+ * power_frequency events, taken on the device while the workload of
+ * interest runs:
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/sched/sched_switch/enable
+ *	echo 1 > /sys/kernel/debug/tracing/events/power/power_frequency/enable
+ *	...
+ *	cat /sys/kernel/debug/tracing/trace > app-launch.trace
+ *
+ * Every time a cpu leaves the idle task, it starts a busy period, whose work
+ * is the cycles it ran for at the recorded frequency. The replay hands each
+ * busy period to its cpu at the time it started on the device, and runs it
+ * at the frequency the replayed governor has picked by then, a slower clock
+ * making it last longer, a backlog delaying the next one. The governor is
+ * cpufreq_interactive_timer() and cpufreq_interactive_idle() from
+ * drivers/cpufreq/cpufreq_interactive.c, with jiffies timers and the idle
+ * hook called where the cpu enters and leaves idle; keep the two in step.
+ * Boost is not replayed. The cpus share one clock running at the highest of
+ * their targets, as on Tegra 2, unless -i gives each its own.
+ *
+ * Printed are the time spent at each frequency next to what was recorded,
+ * the ramp latency, from the start of a busy period to the governor first
+ * raising that cpu's speed during it, and an energy proxy: the busy time in
+ * seconds, weighted by f * V^2 relative to the highest frequency, next to
+ * what running everything at the highest frequency would give. Without
+ * voltages (-v), V is taken to scale with f. For instance, to see what a
+ * shorter min_sample_time would cost:
+ *
+ *	interactive-replay -m 40000 app-launch.trace
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CPUS	8
+#define MAX_FREQS	32
+
+/* tunables, defaults as in cpufreq_interactive.c */
+static unsigned long go_maxspeed_load = 85;
+static unsigned long hispeed_freq;
+static unsigned long target_load = 90;
+static unsigned long above_hispeed_delay = 20000;
+static unsigned long min_sample_time = 80000;
+static unsigned hz = 100;
+static int shared_clock = 1;
+
+/* the Tegra 2 table at 1GHz, in kHz */
+static unsigned freqs[MAX_FREQS] = {
+	216000, 312000, 456000, 608000, 760000, 816000, 912000, 1000000,
+};
+static unsigned nr_freqs = 8;
+static unsigned mvolts[MAX_FREQS];
+static unsigned fmin, fmax;
+
+/* a busy period as recorded: when it started and its cycles, in kHz * us */
+struct period {
+	uint64_t	start;
+	uint64_t	work;
+};
+
+struct cpu {
+	/* the recording */
+	struct period	*periods;
+	size_t		nr_periods, max_periods, next;
+	int		rec_busy;
+	unsigned	rec_freq;
+	uint64_t	rec_last;
+	uint64_t	rec_time[MAX_FREQS];
+
+	/* the replay, what the cpu does */
+	uint64_t	work;		/* cycles left to run, kHz * us */
+	int		busy;
+	uint64_t	idle_time;	/* get_cpu_idle_time_us() */
+	uint64_t	busy_since;
+	int		raised;
+	uint64_t	time[MAX_FREQS];
+
+	/* and struct cpufreq_interactive_cpuinfo */
+	int		timer_pending;
+	uint64_t	timer_expires;
+	int		timer_idlecancel;
+	uint64_t	time_in_idle;
+	uint64_t	idle_exit_time;
+	uint64_t	timer_run_time;
+	int		idling;
+	uint64_t	freq_change_time;
+	uint64_t	freq_change_time_in_idle;
+	uint64_t	hispeed_validate_time;
+	unsigned	target_freq;
+};
+
+static struct cpu cpus[MAX_CPUS];
+static unsigned nr_cpus;
+
+static uint32_t *ramps;
+static size_t nr_ramps, max_ramps;
+static double energy;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static unsigned freq_index(unsigned freq)
+{
+	unsigned i;
+
+	for (i = nr_freqs - 1; i > 0; i--)
+		if (freqs[i] <= freq)
+			break;
+	return i;
+}
+
+static void add_period(struct cpu *c, uint64_t start, uint64_t work)
+{
+	if (c->nr_periods == c->max_periods) {
+		c->max_periods = c->max_periods ? 2 * c->max_periods : 1024;
+		c->periods = realloc(c->periods,
+				     c->max_periods * sizeof(*c->periods));
+		if (!c->periods)
+			die("realloc");
+	}
+	c->periods[c->nr_periods].start = start;
+	c->periods[c->nr_periods].work = work;
+	c->nr_periods++;
+}
+
+/*
+ * Accounts the recording of a cpu up to now. Until its first frequency
+ * change, a cpu is taken to run at the highest frequency.
+ */
+static void rec_advance(struct cpu *c, uint64_t now)
+{
+	unsigned freq = c->rec_freq ? c->rec_freq : fmax;
+
+	if (c->rec_freq)
+		c->rec_time[freq_index(c->rec_freq)] += now - c->rec_last;
+	if (c->rec_busy)
+		c->periods[c->nr_periods - 1].work +=
+			(now - c->rec_last) * freq;
+	c->rec_last = now;
+}
+
+/*
+ * Reads the sched_switch and power_frequency lines of an ftrace text
+ * recording. Returns the time of the last event, in us since the first.
+ */
+static uint64_t read_trace(FILE *f)
+{
+	char line[512];
+	double first = -1, ts;
+	uint64_t now = 0;
+	unsigned i;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *ev, *p, *b;
+		unsigned long cpu, type, state;
+		int prev_pid, next_pid;
+		struct cpu *c;
+
+		ev = strstr(line, ": sched_switch: ");
+		if (!ev)
+			ev = strstr(line, ": power_frequency: ");
+		if (!ev)
+			continue;
+
+		/* "  comm-pid  [cpu] flags  secs.usecs: event: ..." */
+		b = strchr(line, '[');
+		if (!b || b > ev)
+			continue;
+		cpu = strtoul(b + 1, NULL, 10);
+		for (p = ev; p > b && p[-1] != ' '; p--)
+			;
+		ts = strtod(p, NULL);
+		if (first < 0)
+			first = ts;
+		now = (uint64_t)((ts - first) * 1e6 + 0.5);
+
+		if (strstr(ev, "sched_switch")) {
+			if (cpu >= MAX_CPUS)
+				continue;
+			p = strstr(ev, "prev_pid=");
+			b = strstr(ev, "next_pid=");
+			if (!p || !b)
+				continue;
+			prev_pid = atoi(p + 9);
+			next_pid = atoi(b + 9);
+			c = &cpus[cpu];
+			if (cpu >= nr_cpus)
+				nr_cpus = cpu + 1;
+			rec_advance(c, now);
+			if (!prev_pid && next_pid) {
+				c->rec_busy = 1;
+				add_period(c, now, 0);
+			} else if (prev_pid && !next_pid)
+				c->rec_busy = 0;
+		} else {
+			/* type=2 state=<kHz> cpu_id=<cpu> */
+			if (sscanf(ev, ": power_frequency: type=%lu state=%lu "
+				   "cpu_id=%lu", &type, &state, &cpu) != 3 ||
+			    type != 2 || cpu >= MAX_CPUS)
+				continue;
+			c = &cpus[cpu];
+			rec_advance(c, now);
+			c->rec_freq = state;
+		}
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		rec_advance(&cpus[i], now);
+	return now;
+}
+
+/*
+ * The governor, as in cpufreq_interactive.c. Times are in us, and 0 stands
+ * for "never" in idle_exit_time, so the replay starts well after it.
+ */
+
+#define START_TIME	1000000
+
+static void mod_timer(struct cpu *c, uint64_t now)
+{
+	uint64_t tick = 1000000 / hz;
+
+	/* jiffies + 2 */
+	c->timer_pending = 1;
+	c->timer_expires = (now / tick + 2) * tick;
+}
+
+static int load_of(unsigned int delta_time, unsigned int delta_idle)
+{
+	if (delta_idle > delta_time)
+		return 0;
+
+	return 100 * (delta_time - delta_idle) / delta_time;
+}
+
+/* cpufreq_frequency_table_target() with CPUFREQ_RELATION_H */
+static unsigned table_target(unsigned target)
+{
+	unsigned i, best = 0, above = ~0U;
+
+	for (i = 0; i < nr_freqs; i++) {
+		if (freqs[i] <= target && freqs[i] >= best)
+			best = freqs[i];
+		else if (freqs[i] > target && freqs[i] <= above)
+			above = freqs[i];
+	}
+	return best ? best : above;
+}
+
+static unsigned choose_freq(struct cpu *c, int cpu_load)
+{
+	unsigned int new_freq;
+
+	new_freq = c->target_freq * cpu_load / target_load;
+
+	if (cpu_load >= (int)go_maxspeed_load) {
+		if (c->target_freq < hispeed_freq ||
+		    new_freq < hispeed_freq)
+			new_freq = hispeed_freq;
+	}
+
+	return table_target(new_freq);
+}
+
+/* what the up task and the down work do, without their latency */
+static void set_target(struct cpu *c, unsigned new_freq, uint64_t now)
+{
+	if (new_freq > c->target_freq && c->busy && !c->raised) {
+		if (nr_ramps == max_ramps) {
+			max_ramps = max_ramps ? 2 * max_ramps : 1024;
+			ramps = realloc(ramps, max_ramps * sizeof(*ramps));
+			if (!ramps)
+				die("realloc");
+		}
+		ramps[nr_ramps++] = now - c->busy_since;
+		c->raised = 1;
+	}
+	c->target_freq = new_freq;
+	c->freq_change_time_in_idle = c->idle_time;
+	c->freq_change_time = now;
+}
+
+static void interactive_timer(struct cpu *c, uint64_t now)
+{
+	unsigned int delta_idle, delta_time, change_idle, change_time;
+	int cpu_load, load_since_change;
+	uint64_t time_in_idle, idle_exit_time;
+	unsigned new_freq;
+
+	time_in_idle = c->time_in_idle;
+	idle_exit_time = c->idle_exit_time;
+	c->timer_run_time = now;
+
+	if (!idle_exit_time)
+		return;
+
+	delta_idle = c->idle_time - time_in_idle;
+	delta_time = now - idle_exit_time;
+
+	if (delta_time < 1000)
+		goto rearm;
+
+	cpu_load = load_of(delta_time, delta_idle);
+	change_idle = c->idle_time - c->freq_change_time_in_idle;
+	change_time = now - c->freq_change_time;
+	load_since_change = load_of(change_time, change_idle);
+
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
+	new_freq = choose_freq(c, cpu_load);
+
+	if (new_freq <= hispeed_freq) {
+		c->hispeed_validate_time = now;
+	} else if (c->target_freq <= hispeed_freq &&
+		   now - c->hispeed_validate_time < above_hispeed_delay) {
+		goto rearm;
+	}
+
+	if (c->target_freq == new_freq)
+		goto rearm_if_notmax;
+
+	if (new_freq < c->target_freq &&
+	    now - c->freq_change_time < min_sample_time)
+		goto rearm;
+
+	set_target(c, new_freq, now);
+
+rearm_if_notmax:
+	if (c->target_freq == fmax)
+		return;
+
+rearm:
+	if (!c->timer_pending) {
+		if (c->target_freq == fmin) {
+			if (c->idling)
+				return;
+			c->timer_idlecancel = 1;
+		}
+
+		c->time_in_idle = c->idle_time;
+		c->idle_exit_time = now;
+		mod_timer(c, now);
+	}
+}
+
+/* the first half of cpufreq_interactive_idle(), up to pm_idle_old() */
+static void idle_enter(struct cpu *c, uint64_t now)
+{
+	c->idling = 1;
+
+	if (c->target_freq != fmin) {
+		if (!c->timer_pending) {
+			c->time_in_idle = c->idle_time;
+			c->idle_exit_time = now;
+			c->timer_idlecancel = 0;
+			mod_timer(c, now);
+		}
+	} else if (c->timer_pending && c->timer_idlecancel) {
+		c->timer_pending = 0;
+		c->idle_exit_time = 0;
+		c->timer_idlecancel = 0;
+	}
+}
+
+/* the second half, once pm_idle_old() returns */
+static void idle_exit(struct cpu *c, uint64_t now)
+{
+	c->idling = 0;
+
+	if (!c->timer_pending && c->timer_run_time >= c->idle_exit_time) {
+		c->time_in_idle = c->idle_time;
+		c->idle_exit_time = now;
+		c->timer_idlecancel = 0;
+		mod_timer(c, now);
+	}
+}
+
+static unsigned clock_of(struct cpu *c)
+{
+	unsigned i, clock = 0;
+
+	if (!shared_clock)
+		return c->target_freq;
+	for (i = 0; i < nr_cpus; i++)
+		if (cpus[i].target_freq > clock)
+			clock = cpus[i].target_freq;
+	return clock;
+}
+
+static void replay(uint64_t end)
+{
+	uint64_t now = START_TIME;
+	unsigned i, f0 = 0;
+
+	end += START_TIME;
+
+	/* governor start, at the first recorded frequency */
+	for (i = 0; i < nr_cpus && !f0; i++)
+		f0 = cpus[i].rec_freq;
+	f0 = f0 ? table_target(f0) : fmax;
+	if (!hispeed_freq)
+		hispeed_freq = fmax;
+	for (i = 0; i < nr_cpus; i++) {
+		struct cpu *c = &cpus[i];
+		size_t j;
+
+		for (j = 0; j < c->nr_periods; j++)
+			c->periods[j].start += START_TIME;
+		c->target_freq = f0;
+		c->freq_change_time = now;
+		c->hispeed_validate_time = now;
+		c->idle_time = 0;
+		c->freq_change_time_in_idle = 0;
+		c->idling = 1;
+	}
+
+	for (;;) {
+		uint64_t next = UINT64_MAX, dt;
+		int busy = 0, left = 0;
+
+		for (i = 0; i < nr_cpus; i++) {
+			struct cpu *c = &cpus[i];
+
+			while (c->next < c->nr_periods &&
+			       c->periods[c->next].start <= now)
+				c->work += c->periods[c->next++].work;
+
+			if (c->work && !c->busy) {
+				c->busy = 1;
+				c->busy_since = now;
+				c->raised = 0;
+				idle_exit(c, now);
+			} else if (!c->work && c->busy) {
+				c->busy = 0;
+				idle_enter(c, now);
+			}
+
+			if (c->timer_pending && c->timer_expires <= now) {
+				/*
+				 * The timer wakes an idle cpu: the idle hook
+				 * returns with the timer still pending, the
+				 * timer runs, and the cpu goes idle again.
+				 */
+				if (!c->busy)
+					idle_exit(c, now);
+				c->timer_pending = 0;
+				interactive_timer(c, now);
+				if (!c->busy)
+					idle_enter(c, now);
+			}
+		}
+
+		/* run until something happens */
+		for (i = 0; i < nr_cpus; i++) {
+			struct cpu *c = &cpus[i];
+			unsigned clock = clock_of(c);
+
+			if (c->next < c->nr_periods) {
+				if (c->periods[c->next].start < next)
+					next = c->periods[c->next].start;
+				left = 1;
+			}
+			if (c->timer_pending && c->timer_expires < next)
+				next = c->timer_expires;
+			if (c->busy) {
+				uint64_t run = (c->work + clock - 1) / clock;
+
+				if (now + run < next)
+					next = now + run;
+				busy = 1;
+			}
+		}
+		if (!busy && !left && now >= end)
+			break;
+		if (!busy && !left && next > end)
+			next = end;
+		dt = next - now;
+
+		for (i = 0; i < nr_cpus; i++) {
+			struct cpu *c = &cpus[i];
+			unsigned clock = clock_of(c), fi = freq_index(clock);
+
+			c->time[fi] += dt;
+			if (c->busy) {
+				double v = mvolts[fi] ?
+					(double)mvolts[fi] / mvolts[nr_freqs - 1] :
+					(double)clock / fmax;
+
+				c->work -= c->work < clock * dt ?
+					c->work : clock * dt;
+				energy += dt * ((double)clock / fmax) * v * v;
+			} else
+				c->idle_time += dt;
+		}
+		now += dt;
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned parse_list(char *s, unsigned *list)
+{
+	unsigned n = 0;
+	char *tok;
+
+	for (tok = strtok(s, ","); tok && n < MAX_FREQS;
+	     tok = strtok(NULL, ","))
+		list[n++] = strtoul(tok, NULL, 10);
+	return n;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-l go_maxspeed_load] [-s hispeed_freq] "
+		"[-t target_load] [-a above_hispeed_delay] "
+		"[-m min_sample_time] [-z HZ] [-f kHz,...] [-v mV,...] [-i] "
+		"[trace]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t end, rec_total = 0, total = 0, work = 0;
+	unsigned i, j, nr_mvolts = 0;
+	size_t periods = 0;
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:s:t:a:m:z:f:v:i")) != -1) {
+		switch (opt) {
+		case 'l':
+			go_maxspeed_load = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			hispeed_freq = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			target_load = strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			above_hispeed_delay = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			min_sample_time = strtoul(optarg, NULL, 10);
+			break;
+		case 'z':
+			hz = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			nr_freqs = parse_list(optarg, freqs);
+			break;
+		case 'v':
+			nr_mvolts = parse_list(optarg, mvolts);
+			break;
+		case 'i':
+			shared_clock = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!target_load || !hz || hz > 1000000 || !nr_freqs ||
+	    (nr_mvolts && nr_mvolts != nr_freqs) || optind < argc - 1)
+		usage(argv[0]);
+	for (i = 1; i < nr_freqs; i++)
+		if (freqs[i] <= freqs[i - 1])
+			usage(argv[0]);
+	fmin = freqs[0];
+	fmax = freqs[nr_freqs - 1];
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f)
+			die(argv[optind]);
+	}
+	end = read_trace(f);
+	if (!nr_cpus) {
+		fprintf(stderr, "no sched_switch events in the trace\n");
+		return 1;
+	}
+	for (i = 0; i < nr_cpus; i++) {
+		periods += cpus[i].nr_periods;
+		for (j = 0; j < cpus[i].nr_periods; j++)
+			work += cpus[i].periods[j].work;
+	}
+
+	replay(end);
+
+	printf("%.3f s, %u cpus, %zu busy periods, %s clock\n", end / 1e6,
+	       nr_cpus, periods, shared_clock ? "shared" : "per-cpu");
+	printf("\n%8s  %8s  %8s\n", "kHz", "recorded", "replay");
+	for (i = 0; i < nr_cpus; i++)
+		for (j = 0; j < nr_freqs; j++) {
+			rec_total += cpus[i].rec_time[j];
+			total += cpus[i].time[j];
+		}
+	for (j = 0; j < nr_freqs; j++) {
+		uint64_t rec = 0, t = 0;
+
+		for (i = 0; i < nr_cpus; i++) {
+			rec += cpus[i].rec_time[j];
+			t += cpus[i].time[j];
+		}
+		if (rec_total)
+			printf("%8u  %7.1f%%  %5.1f%%\n", freqs[j],
+			       100.0 * rec / rec_total, 100.0 * t / total);
+		else
+			printf("%8u  %8s  %5.1f%%\n", freqs[j], "-",
+			       100.0 * t / total);
+	}
+
+	printf("\nramp latency: ");
+	if (nr_ramps) {
+		qsort(ramps, nr_ramps, sizeof(*ramps), cmp_u32);
+		printf("%zu ramps, p50 %u us, p99 %u us, max %u us\n",
+		       nr_ramps, ramps[nr_ramps / 2],
+		       ramps[nr_ramps - 1 - nr_ramps / 100],
+		       ramps[nr_ramps - 1]);
+	} else
+		printf("no ramps\n");
+	printf("energy proxy: %.3f, %.3f at %u kHz throughout\n",
+	       energy / 1e6, (double)work / fmax / 1e6, fmax);
+	return 0;
+}
@@ -0,0 +1,316 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o iosched-bench iosched-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Compares I/O schedulers on a block device under reads competing with
+ * writeback, the load that makes an app stall while something downloads.
+ *
+ * For each scheduler, readers issue random 4KB O_DIRECT reads in the first
+ * half of the device, timing each, while writers write sequentially through
+ * the page cache in the second half, syncing every few MB. After a given
+ * time, the read rate, the median, 99th percentile and worst read latencies
+ * and the write throughput are printed, one line per scheduler. Scheduler
+ * tunables can follow its name, so V(R) with and without its flash mode
+ * can be run against deadline and noop:
+ *
+ *	iosched-bench -d /dev/block/mmcblk1 -e noop,deadline,vr,vr:flash=1
+ *
+ * The device is written to: its contents are lost. Its scheduler is left
+ * set to the last one run.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+#define BLOCK		4096
+#define WRITE_SIZE	(64 * 1024)
+#define MAX_LAT		(1 << 20)
+
+static const char *dev;
+static char queue[256];		/* sysfs queue directory of the device */
+static unsigned readers = 2, writers = 1, seconds = 10, sync_mb = 4;
+static uint64_t size;
+static volatile int stop;
+
+struct worker {
+	pthread_t	thread;
+	unsigned	id;
+	uint32_t	*lat;		/* read latencies, in us */
+	unsigned	nr_lat;
+	uint64_t	bytes;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t blocks = size / 2 / BLOCK;
+	unsigned seed = w->id;
+	void *buf;
+	int fd;
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		die(dev);
+	if (posix_memalign(&buf, BLOCK, BLOCK))
+		die("posix_memalign");
+
+	while (!stop) {
+		uint64_t block = ((uint64_t)rand_r(&seed) << 16 ^
+				  rand_r(&seed)) % blocks;
+		uint64_t start = now_ns();
+
+		if (pread(fd, buf, BLOCK, block * BLOCK) != BLOCK)
+			die("pread");
+		if (w->nr_lat < MAX_LAT)
+			w->lat[w->nr_lat++] = (now_ns() - start) / 1000;
+		w->bytes += BLOCK;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t first = size / 2, len = size / 2 / writers, off = 0;
+	uint64_t since_sync = 0;
+	char *buf;
+	int fd;
+
+	fd = open(dev, O_WRONLY);
+	if (fd < 0)
+		die(dev);
+	buf = malloc(WRITE_SIZE);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, WRITE_SIZE);
+	first += w->id * len;
+
+	while (!stop) {
+		if (pwrite(fd, buf, WRITE_SIZE, first + off) != WRITE_SIZE)
+			die("pwrite");
+		w->bytes += WRITE_SIZE;
+		off = (off + WRITE_SIZE) % (len - len % WRITE_SIZE);
+		since_sync += WRITE_SIZE;
+		if (since_sync >= (uint64_t)sync_mb << 20) {
+			fdatasync(fd);
+			since_sync = 0;
+		}
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void write_sysfs(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f || fprintf(f, "%s\n", val) < 0 || fclose(f))
+		die(path);
+}
+
+/* "name[:attr=value...]" */
+static void set_scheduler(char *spec)
+{
+	char path[512], *attr, *val;
+
+	attr = strchr(spec, ':');
+	if (attr)
+		*attr++ = '\0';
+	snprintf(path, sizeof(path), "%s/scheduler", queue);
+	write_sysfs(path, spec);
+	if (!attr)
+		return;
+
+	for (attr = strtok(attr, ":"); attr; attr = strtok(NULL, ":")) {
+		val = strchr(attr, '=');
+		if (!val) {
+			fprintf(stderr, "%s: no value\n", attr);
+			exit(1);
+		}
+		*val++ = '\0';
+		snprintf(path, sizeof(path), "%s/iosched/%s", queue, attr);
+		write_sysfs(path, val);
+	}
+}
+
+/* the queue directory is the device's, or its disk's for a partition */
+static void find_queue(void)
+{
+	char path[256], *name = basename(strdup(dev));
+	struct stat st;
+
+	snprintf(queue, sizeof(queue), "/sys/class/block/%s/queue", name);
+	if (!stat(queue, &st))
+		return;
+	snprintf(path, sizeof(path), "/sys/class/block/%s/../queue", name);
+	if (!realpath(path, queue) || stat(queue, &st)) {
+		fprintf(stderr, "%s: no queue in sysfs\n", dev);
+		exit(1);
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(const char *name)
+{
+	struct worker w[readers + writers];
+	uint64_t start, elapsed, rbytes = 0, wbytes = 0;
+	unsigned i, n = 0;
+	uint32_t *lat;
+
+	sync();
+	stop = 0;
+	start = now_ns();
+	for (i = 0; i < readers + writers; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].id = i < readers ? i : i - readers;
+		if (i < readers) {
+			w[i].lat = malloc(MAX_LAT * sizeof(*w[i].lat));
+			if (!w[i].lat)
+				die("malloc");
+		}
+		if (pthread_create(&w[i].thread, NULL,
+				   i < readers ? reader_thread : writer_thread,
+				   &w[i]))
+			die("pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < readers + writers; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now_ns() - start;
+
+	lat = malloc((size_t)readers * MAX_LAT * sizeof(*lat));
+	if (!lat)
+		die("malloc");
+	for (i = 0; i < readers; i++) {
+		memcpy(lat + n, w[i].lat, w[i].nr_lat * sizeof(*lat));
+		n += w[i].nr_lat;
+		rbytes += w[i].bytes;
+		free(w[i].lat);
+	}
+	for (; i < readers + writers; i++)
+		wbytes += w[i].bytes;
+	qsort(lat, n, sizeof(*lat), cmp_u32);
+
+	printf("%-16s  %8.0f", name, rbytes / BLOCK * 1e9 / elapsed);
+	if (n)
+		printf("  %8.2f  %8.2f  %8.2f", lat[n / 2] / 1e3,
+		       lat[n - 1 - n / 100] / 1e3, lat[n - 1] / 1e3);
+	else
+		printf("  %8s  %8s  %8s", "-", "-", "-");
+	printf("  %9.1f\n", wbytes * 1e3 / elapsed);
+	fflush(stdout);
+	free(lat);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -d device [-e scheduler[:attr=value],...] "
+		"[-r readers] [-w writers] [-t seconds] [-S sync_mb]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *schedulers = NULL, *spec, *save;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "d:e:r:w:t:S:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'e':
+			schedulers = optarg;
+			break;
+		case 'r':
+			readers = atoi(optarg);
+			break;
+		case 'w':
+			writers = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'S':
+			sync_mb = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev || !readers || !seconds || !sync_mb)
+		usage(argv[0]);
+	if (!schedulers)
+		schedulers = strdup("noop,deadline,vr,vr:flash=1");
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0)
+		die(dev);
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		die("BLKGETSIZE64");
+	close(fd);
+	if (size < 2 * (uint64_t)(writers + 1) * WRITE_SIZE) {
+		fprintf(stderr, "%s: too small\n", dev);
+		return 1;
+	}
+	find_queue();
+
+	printf("%-16s  %8s  %8s  %8s  %8s  %9s\n", "scheduler", "reads/s",
+	       "p50 ms", "p99 ms", "max ms", "write MB/s");
+	for (spec = strtok_r(schedulers, ",", &save); spec;
+	     spec = strtok_r(NULL, ",", &save)) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "%s", spec);
+		set_scheduler(spec);
+		run(name);
+	}
+	return 0;
+}
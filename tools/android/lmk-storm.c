@@ -0,0 +1,332 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o lmk-storm lmk-storm.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Allocation storm against the lowmemorykiller, with and without user-space
+ * trimming caches on the pressure levels of /dev/lowmemorykiller.
+ *
+ * Starts a number of background "apps", each with an oom_adj the killer
+ * may pick and a working set plus a cache of anonymous memory. A foreground
+ * process, which the killer never picks, then allocates and touches memory
+ * until it holds what was free plus half of what the caches hold, so that
+ * something has to give.
+ *
+ * The storm is run twice. The first time nobody listens to the pressure
+ * levels, and the killer has to make room by killing apps. The second time
+ * a listener tells every app to drop its cache as soon as the level reaches
+ * the one given with -l. For each run, the apps killed, the pressure events
+ * of each level and the memory trimmed are printed, and at the end the
+ * number of kills avoided by trimming:
+ *
+ *	lmk-storm -a 8 -w 4 -c 16 -l medium
+ *
+ * Needs root, to set the oom_adj of the foreground process. Without swap,
+ * only the page cache and the apps can give memory back.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MB		(1 << 20)
+#define PARAMS		"/sys/module/lowmemorykiller/parameters/"
+
+static const char *levels[] = { "none", "low", "medium", "critical" };
+
+static unsigned nr_apps = 8, ws_mb = 4, cache_mb = 16, delay_us = 1000;
+static int trim_level = 2;
+
+/* shared with the children */
+static volatile unsigned *trimmed_mb;
+
+struct stats {
+	unsigned	kills;
+	unsigned	events[4];
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void set_oom_adj(int adj)
+{
+	FILE *f = fopen("/proc/self/oom_adj", "w");
+
+	if (!f || fprintf(f, "%d\n", adj) < 0 || fclose(f))
+		die("oom_adj");
+}
+
+static void read_stats(struct stats *s)
+{
+	FILE *f;
+
+	f = fopen(PARAMS "kills", "r");
+	if (!f || fscanf(f, "%u", &s->kills) != 1)
+		die(PARAMS "kills");
+	fclose(f);
+	f = fopen(PARAMS "events", "r");
+	if (!f || fscanf(f, "%u,%u,%u,%u", &s->events[0], &s->events[1],
+			 &s->events[2], &s->events[3]) != 4)
+		die(PARAMS "events");
+	fclose(f);
+}
+
+/* MemFree + Cached from /proc/meminfo, in MB */
+static unsigned available_mb(void)
+{
+	FILE *f = fopen("/proc/meminfo", "r");
+	unsigned long kb, total = 0;
+	char line[128];
+
+	if (!f)
+		die("/proc/meminfo");
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "MemFree: %lu", &kb) == 1 ||
+		    sscanf(line, "Cached: %lu", &kb) == 1)
+			total += kb;
+	fclose(f);
+	return total >> 10;
+}
+
+static void touch(char *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += 4096)
+		p[i] = 1;
+}
+
+static char *cache;
+
+static void drop_cache(int sig)
+{
+	(void)sig;
+	if (cache) {
+		munmap(cache, (size_t)cache_mb * MB);
+		cache = NULL;
+		__sync_fetch_and_add(trimmed_mb, cache_mb);
+	}
+}
+
+static void app(int adj, int ready)
+{
+	char *ws, c = 0;
+
+	set_oom_adj(adj);
+	signal(SIGUSR1, drop_cache);
+	ws = mmap(NULL, (size_t)ws_mb * MB, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	cache = mmap(NULL, (size_t)cache_mb * MB, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ws == MAP_FAILED || cache == MAP_FAILED)
+		die("mmap");
+	touch(ws, (size_t)ws_mb * MB);
+	touch(cache, (size_t)cache_mb * MB);
+	if (write(ready, &c, 1) != 1)
+		die("write");
+	for (;;)
+		pause();
+}
+
+/* tells every app to drop its cache once the level reaches trim_level */
+static void listener(pid_t *apps)
+{
+	struct pollfd pfd;
+	char buf[16];
+	unsigned i;
+	int level;
+
+	pfd.fd = open("/dev/lowmemorykiller", O_RDONLY);
+	if (pfd.fd < 0)
+		die("/dev/lowmemorykiller");
+	pfd.events = POLLIN;
+	for (;;) {
+		ssize_t n;
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			die("poll");
+		n = read(pfd.fd, buf, sizeof(buf) - 1);
+		if (n <= 0)
+			die("read");
+		buf[n - 1] = '\0';
+		for (level = 0; level < 4; level++)
+			if (!strcmp(buf, levels[level]))
+				break;
+		if (level < trim_level || level == 4)
+			continue;
+		for (i = 0; i < nr_apps; i++)
+			kill(apps[i], SIGUSR1);
+	}
+}
+
+static void storm(unsigned mb)
+{
+	unsigned i;
+
+	set_oom_adj(-17);
+	for (i = 0; i < mb; i++) {
+		/* no overcommit check, reclaim has to find the memory */
+		char *p = mmap(NULL, MB, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			       -1, 0);
+
+		if (p == MAP_FAILED)
+			die("mmap");
+		touch(p, MB);
+		if (delay_us)
+			usleep(delay_us);
+	}
+	/* hold it for a moment, so late kills are counted */
+	sleep(1);
+	exit(0);
+}
+
+/* returns the number of apps killed */
+static unsigned run(int trim)
+{
+	pid_t apps[nr_apps], lpid = 0, spid;
+	struct stats before, after;
+	unsigned i, killed = 0, mb;
+	int ready[2], status;
+	char c;
+
+	if (pipe(ready))
+		die("pipe");
+	*trimmed_mb = 0;
+	for (i = 0; i < nr_apps; i++) {
+		apps[i] = fork();
+		if (apps[i] < 0)
+			die("fork");
+		if (!apps[i])
+			/* spread over the adj levels the killer looks at */
+			app(15 - i % 4, ready[1]);
+	}
+	for (i = 0; i < nr_apps; i++)
+		if (read(ready[0], &c, 1) != 1)
+			die("read");
+	close(ready[0]);
+	close(ready[1]);
+
+	if (trim) {
+		lpid = fork();
+		if (lpid < 0)
+			die("fork");
+		if (!lpid)
+			listener(apps);
+	}
+
+	mb = available_mb() + nr_apps * cache_mb / 2;
+	read_stats(&before);
+	spid = fork();
+	if (spid < 0)
+		die("fork");
+	if (!spid)
+		storm(mb);
+	if (waitpid(spid, &status, 0) < 0 || !WIFEXITED(status)) {
+		fprintf(stderr, "storm process failed\n");
+		exit(1);
+	}
+	read_stats(&after);
+
+	for (i = 0; i < nr_apps; i++) {
+		if (waitpid(apps[i], &status, WNOHANG) == apps[i] &&
+		    WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+			killed++;
+		else {
+			kill(apps[i], SIGKILL);
+			waitpid(apps[i], NULL, 0);
+		}
+	}
+	if (lpid) {
+		kill(lpid, SIGKILL);
+		waitpid(lpid, NULL, 0);
+	}
+
+	printf("%-7s  %5u MB  %6u  %5u  %3u %3u %3u %3u  %7u MB\n",
+	       trim ? levels[trim_level] : "-", mb, killed,
+	       after.kills - before.kills,
+	       after.events[0] - before.events[0],
+	       after.events[1] - before.events[1],
+	       after.events[2] - before.events[2],
+	       after.events[3] - before.events[3], *trimmed_mb);
+	fflush(stdout);
+
+	/* let the memory settle before the next run */
+	sleep(2);
+	return killed;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-a apps] [-w working_set_mb] "
+		"[-c cache_mb] [-l low|medium|critical] [-d delay_us]\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned without, with;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:w:c:l:d:")) != -1) {
+		switch (opt) {
+		case 'a':
+			nr_apps = atoi(optarg);
+			break;
+		case 'w':
+			ws_mb = atoi(optarg);
+			break;
+		case 'c':
+			cache_mb = atoi(optarg);
+			break;
+		case 'l':
+			for (trim_level = 1; trim_level < 4; trim_level++)
+				if (!strcmp(optarg, levels[trim_level]))
+					break;
+			if (trim_level == 4)
+				usage(argv[0]);
+			break;
+		case 'd':
+			delay_us = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nr_apps || !cache_mb)
+		usage(argv[0]);
+
+	trimmed_mb = mmap(NULL, sizeof(*trimmed_mb), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (trimmed_mb == MAP_FAILED)
+		die("mmap");
+
+	printf("trim at    storm  killed  kills  none/low/med/crit  trimmed\n");
+	fflush(stdout);
+	without = run(0);
+	with = run(1);
+	printf("kills avoided by trimming: %d of %u\n",
+	       (int)without - (int)with, without);
+	return 0;
+}
@@ -0,0 +1,266 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o logger-bench logger-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Measures how the Android logger copes with many concurrent writers.
+ *
+ * Every thread writes entries the way liblog does, a priority byte, a tag
+ * and a message in one writev(), and times each write. At the end the
+ * aggregate throughput and the median, 99th percentile and worst write
+ * latencies are printed. With -c, a reader follows the log in batch mode and
+ * checks that no entry is torn and that each thread's entries come out in
+ * the order they were written.
+ *
+ * Run it once per number of threads, e.g. 1, 2 and 4, to see the write path
+ * scale with the number of cpus:
+ *
+ *	for t in 1 2 4; do logger-bench -t $t -n 100000; done
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* from drivers/staging/android/logger.h */
+struct logger_entry {
+	uint16_t	len;
+	uint16_t	__pad;
+	int32_t		pid;
+	int32_t		tid;
+	int32_t		sec;
+	int32_t		nsec;
+	char		msg[0];
+};
+
+#define LOGGER_ENTRY_MAX_LEN	(4*1024)
+#define __LOGGERIO		0xAE
+#define LOGGER_SET_BATCH_READ	_IO(__LOGGERIO, 5)
+
+#define TAG			"logger-bench"
+
+static const char *path = "/dev/log/main";
+static unsigned threads = 1, entries = 100000, msglen = 64;
+static volatile int writers_done;
+
+struct writer {
+	pthread_t	thread;
+	unsigned	id;
+	uint32_t	*lat;		/* latency of each write, in ns */
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	char prio = 4, msg[LOGGER_ENTRY_MAX_LEN];
+	struct iovec iov[3];
+	unsigned i;
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = TAG;
+	iov[1].iov_len = sizeof(TAG);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = msglen;
+	memset(msg, 'x', msglen);
+
+	for (i = 0; i < entries; i++) {
+		uint64_t start;
+
+		/* thread and sequence number, checked by the reader */
+		snprintf(msg, msglen, "%u %u ", w->id, i);
+
+		start = now_ns();
+		if (writev(fd, iov, 3) < 0) {
+			perror("writev");
+			exit(1);
+		}
+		w->lat[i] = now_ns() - start;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+	static char buf[64 * 1024];
+	long *last, nread = 0, lost = 0;
+	int fd;
+
+	(void)arg;
+	last = calloc(threads, sizeof(*last));
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (!last || fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	ioctl(fd, LOGGER_SET_BATCH_READ, 1);
+	memset(last, 0xff, threads * sizeof(*last));
+
+	for (;;) {
+		ssize_t n = read(fd, buf, sizeof(buf)), off;
+
+		if (n < 0 && errno == EAGAIN) {
+			if (writers_done)
+				break;
+			usleep(1000);
+			continue;
+		}
+		if (n < 0) {
+			perror("read");
+			exit(1);
+		}
+
+		for (off = 0; off < n; ) {
+			struct logger_entry *e = (void *)(buf + off);
+			const char *m = e->msg + 1 + sizeof(TAG);
+			unsigned id, seq;
+
+			off += sizeof(*e) + e->len;
+			if (e->pid != getpid() ||
+			    e->len != 1 + sizeof(TAG) + msglen ||
+			    strcmp(e->msg + 1, TAG))
+				continue;
+			if (sscanf(m, "%u %u", &id, &seq) != 2 ||
+			    id >= threads) {
+				fprintf(stderr, "torn entry\n");
+				exit(1);
+			}
+			if ((long)seq <= last[id]) {
+				fprintf(stderr, "thread %u: entry %u after %ld\n",
+					id, seq, last[id]);
+				exit(1);
+			}
+			lost += seq - last[id] - 1;
+			last[id] = seq;
+			nread++;
+		}
+	}
+
+	printf("reader: %ld entries in order, %ld overwritten before read\n",
+	       nread, lost);
+	close(fd);
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-l log] [-t threads] [-n entries] "
+		"[-s msglen] [-c]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct writer *w;
+	pthread_t reader;
+	uint32_t *lat;
+	uint64_t start, elapsed;
+	unsigned i, total;
+	int check = 0, opt;
+
+	while ((opt = getopt(argc, argv, "l:t:n:s:c")) != -1) {
+		switch (opt) {
+		case 'l':
+			path = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		case 's':
+			msglen = atoi(optarg);
+			break;
+		case 'c':
+			check = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!threads || !entries || msglen < 24 ||
+	    msglen > LOGGER_ENTRY_MAX_LEN - 64)
+		usage(argv[0]);
+
+	total = threads * entries;
+	w = calloc(threads, sizeof(*w));
+	lat = malloc(total * sizeof(*lat));
+	if (!w || !lat) {
+		perror("malloc");
+		return 1;
+	}
+
+	if (check && pthread_create(&reader, NULL, reader_thread, NULL)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < threads; i++) {
+		w[i].id = i;
+		w[i].lat = lat + i * entries;
+		if (pthread_create(&w[i].thread, NULL, writer_thread, &w[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now_ns() - start;
+
+	writers_done = 1;
+	if (check)
+		pthread_join(reader, NULL);
+
+	qsort(lat, total, sizeof(*lat), cmp_u32);
+	printf("%u threads, %u entries of %u bytes: %.0f entries/s, "
+	       "%.2f MB/s\n", threads, total, msglen,
+	       total * 1e9 / elapsed,
+	       (double)total * msglen * 1e3 / elapsed);
+	printf("write latency: p50 %u ns, p99 %u ns, max %u ns\n",
+	       lat[total / 2], lat[total - 1 - total / 100], lat[total - 1]);
+
+	return 0;
+}
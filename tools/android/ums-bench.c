@@ -0,0 +1,153 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o ums-bench ums-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Sequential throughput of the USB mass storage gadget, as seen by the host,
+ * the way "dd oflag=direct" and "dd iflag=direct" would measure it.
+ *
+ * The gadget is connected to its own host through dummy_hcd and the disk
+ * the host sees is written and then read back with O_DIRECT, so that the
+ * host's page cache stays out of the way and every block crosses the bus.
+ * The time of each pass is printed with its throughput. Loading the gadget
+ * again with another num_buffers, or running an older kernel, gives the
+ * numbers to compare against:
+ *
+ *	dd if=/dev/zero of=/data/local/tmp/ums.img bs=1M count=256
+ *	modprobe dummy_hcd
+ *	modprobe g_mass_storage file=/data/local/tmp/ums.img num_buffers=8
+ *	ums-bench -d /dev/sdb -s 128
+ *
+ * The disk's contents are overwritten. The host and device sides share the
+ * cpus, so the numbers are a lower bound on what a real host would see.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+static const char *dev;
+static unsigned size_mb = 64, block_kb = 1024, rounds = 3;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* one sequential pass over the first size_mb of the disk, in ns */
+static uint64_t pass(int write_pass, char *buf)
+{
+	uint64_t start, done, size = (uint64_t)size_mb << 20;
+	size_t len = (size_t)block_kb << 10;
+	int fd;
+
+	fd = open(dev, (write_pass ? O_WRONLY : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		die(dev);
+
+	start = now_ns();
+	for (done = 0; done < size; done += len) {
+		ssize_t n = write_pass ? write(fd, buf, len) :
+					 read(fd, buf, len);
+
+		if (n != (ssize_t)len)
+			die(write_pass ? "write" : "read");
+	}
+	if (write_pass && fsync(fd))
+		die("fsync");
+	done = now_ns() - start;
+
+	close(fd);
+	return done;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -d disk [-s size_mb] [-b block_kb] "
+		"[-n rounds]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t disk_size, w, r;
+	unsigned i;
+	void *buf;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "d:s:b:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 's':
+			size_mb = atoi(optarg);
+			break;
+		case 'b':
+			block_kb = atoi(optarg);
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev || !size_mb || !block_kb || !rounds ||
+	    ((uint64_t)size_mb << 10) % block_kb)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0)
+		die(dev);
+	if (ioctl(fd, BLKGETSIZE64, &disk_size))
+		die("BLKGETSIZE64");
+	close(fd);
+	if (disk_size < (uint64_t)size_mb << 20) {
+		fprintf(stderr, "%s: smaller than %u MB\n", dev, size_mb);
+		return 1;
+	}
+
+	if (posix_memalign(&buf, 4096, (size_t)block_kb << 10))
+		die("posix_memalign");
+	memset(buf, 0x5a, (size_t)block_kb << 10);
+
+	printf("%u MB in %u KB blocks\n\n", size_mb, block_kb);
+	printf("%5s  %10s  %10s  %9s  %9s\n", "round", "write ms", "read ms",
+	       "write MB/s", "read MB/s");
+	for (i = 0; i < rounds; i++) {
+		w = pass(1, buf);
+		r = pass(0, buf);
+		printf("%5u  %10.1f  %10.1f  %9.1f  %9.1f\n", i + 1, w / 1e6,
+		       r / 1e6, size_mb * 1e9 / w, size_mb * 1e9 / r);
+		fflush(stdout);
+	}
+
+	free(buf);
+	return 0;
+}
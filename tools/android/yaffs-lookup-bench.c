@@ -0,0 +1,264 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o yaffs-lookup-bench yaffs-lookup-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Cost of creating and looking up files on yaffs2 as the number of objects
+ * grows.
+ *
+ * For each number of files given with -f, erases an MTD partition, mounts
+ * it and creates that many empty files, a hundred to a directory so that
+ * directory walks stay short and the object hash is what gets measured.
+ * The dentry and inode caches are then dropped and random files are
+ * stat()ed, each of which has yaffs find the object by its number again.
+ * The average time of a create and of a stat is printed with the number of
+ * hash buckets yaffs ended up with, from /proc/yaffs. No real NAND is
+ * needed, nandsim does:
+ *
+ *	modprobe nandsim first_id_byte=0xec second_id_byte=0xda \
+ *		third_id_byte=0x10 fourth_id_byte=0x95
+ *	yaffs-lookup-bench -d /dev/mtd0 -f 1000,10000,50000
+ *
+ * The partition's contents are lost.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <mtd/mtd-user.h>
+
+#define FILES_PER_DIR	100
+
+static const char *dev, *mnt = "/data/local/tmp/yaffs-bench";
+static char blockdev[64], mtd_name[64];
+static unsigned lookups = 10000;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the mtdblock device and the name yaffs knows the partition by */
+static void find_mtd(void)
+{
+	const char *p = dev + strlen(dev);
+	char line[256], want[16];
+	struct stat st;
+	FILE *f;
+	int n;
+
+	while (p > dev && isdigit(p[-1]))
+		p--;
+	if (!*p) {
+		fprintf(stderr, "%s: not an mtd device\n", dev);
+		exit(1);
+	}
+	n = atoi(p);
+
+	snprintf(blockdev, sizeof(blockdev), "/dev/block/mtdblock%d", n);
+	if (stat(blockdev, &st))
+		snprintf(blockdev, sizeof(blockdev), "/dev/mtdblock%d", n);
+
+	f = fopen("/proc/mtd", "r");
+	if (!f)
+		die("/proc/mtd");
+	snprintf(want, sizeof(want), "mtd%d:", n);
+	while (fgets(line, sizeof(line), f)) {
+		char *name = strchr(line, '"'), *end;
+
+		if (strncmp(line, want, strlen(want)) || !name)
+			continue;
+		end = strchr(++name, '"');
+		if (end)
+			*end = '\0';
+		snprintf(mtd_name, sizeof(mtd_name), "%s", name);
+	}
+	fclose(f);
+	if (!mtd_name[0]) {
+		fprintf(stderr, "%s: not in /proc/mtd\n", dev);
+		exit(1);
+	}
+}
+
+static void erase(void)
+{
+	struct mtd_info_user info;
+	struct erase_info_user ei;
+	int fd;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	if (ioctl(fd, MEMGETINFO, &info))
+		die("MEMGETINFO");
+	ei.length = info.erasesize;
+	for (ei.start = 0; ei.start < info.size; ei.start += info.erasesize) {
+		loff_t offs = ei.start;
+
+		if (ioctl(fd, MEMGETBADBLOCK, &offs) > 0)
+			continue;
+		if (ioctl(fd, MEMERASE, &ei))
+			die("MEMERASE");
+	}
+	close(fd);
+}
+
+/* a counter from the partition's entry in /proc/yaffs, or -1 */
+static long yaffs_stat(const char *field)
+{
+	char line[256], want[80];
+	int in_dev = 0;
+	long val = -1;
+	FILE *f;
+
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return -1;
+	snprintf(want, sizeof(want), "\"%s\"", mtd_name);
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Device ", 7))
+			in_dev = strstr(line, want) != NULL;
+		else if (in_dev && !strncmp(line, field, strlen(field)) &&
+			 line[strlen(field)] == '.')
+			val = strtol(strrchr(line, ' ') + 1, NULL, 10);
+	}
+	fclose(f);
+	return val;
+}
+
+static void drop_caches(void)
+{
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+
+	sync();
+	if (fd < 0 || write(fd, "2\n", 2) != 2)
+		die("/proc/sys/vm/drop_caches");
+	close(fd);
+}
+
+static void bench(unsigned files)
+{
+	uint64_t start, create_ns, stat_ns;
+	char path[512];
+	unsigned i, seed = files;
+	struct stat st;
+	int fd;
+
+	erase();
+	if (mount(blockdev, mnt, "yaffs2", 0, NULL))
+		die("mount");
+
+	start = now_ns();
+	for (i = 0; i < files; i++) {
+		if (i % FILES_PER_DIR == 0) {
+			snprintf(path, sizeof(path), "%s/%u", mnt,
+				 i / FILES_PER_DIR);
+			if (mkdir(path, 0755))
+				die(path);
+		}
+		snprintf(path, sizeof(path), "%s/%u/%u", mnt,
+			 i / FILES_PER_DIR, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0)
+			die(path);
+		close(fd);
+	}
+	create_ns = now_ns() - start;
+
+	drop_caches();
+	start = now_ns();
+	for (i = 0; i < lookups; i++) {
+		unsigned n = rand_r(&seed) % files;
+
+		snprintf(path, sizeof(path), "%s/%u/%u", mnt,
+			 n / FILES_PER_DIR, n);
+		if (stat(path, &st))
+			die(path);
+	}
+	stat_ns = now_ns() - start;
+
+	printf("%8u  %8ld  %13.1f  %11.1f\n", files,
+	       yaffs_stat("nObjectBuckets"), create_ns / 1e3 / files,
+	       stat_ns / 1e3 / lookups);
+	fflush(stdout);
+
+	if (umount(mnt))
+		die("umount");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -d mtd_device [-m mountpoint] "
+		"[-f files,...] [-n lookups]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *counts = NULL, *count;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:m:f:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'm':
+			mnt = optarg;
+			break;
+		case 'f':
+			counts = optarg;
+			break;
+		case 'n':
+			lookups = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev || !lookups)
+		usage(argv[0]);
+	if (!counts)
+		counts = strdup("1000,10000,50000");
+	find_mtd();
+	if (mkdir(mnt, 0755) && errno != EEXIST)
+		die(mnt);
+
+	printf("%8s  %8s  %13s  %11s\n", "files", "buckets", "create us/op",
+	       "stat us/op");
+	for (count = strtok(counts, ","); count; count = strtok(NULL, ",")) {
+		unsigned files = atoi(count);
+
+		if (!files)
+			usage(argv[0]);
+		bench(files);
+	}
+	return 0;
+}
@@ -0,0 +1,281 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o yaffs-mount-bench yaffs-mount-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Time of a yaffs2 mount that has to scan the whole partition, the mount
+ * that follows an unclean shutdown.
+ *
+ * Erases an MTD partition, mounts it, fills it with files and unmounts it.
+ * It is then mounted a few times with no-checkpoint, which makes yaffs
+ * ignore the checkpoint and rebuild everything from the tags, and each of
+ * those mounts is timed. The number of blocks whose tags were read with a
+ * single request, and of those that had to be read chunk by chunk, come
+ * from /proc/yaffs. A mount from the checkpoint is timed last, for
+ * comparison. No real NAND is needed, nandsim does:
+ *
+ *	modprobe nandsim first_id_byte=0xec second_id_byte=0xda \
+ *		third_id_byte=0x10 fourth_id_byte=0x95
+ *	yaffs-mount-bench -d /dev/mtd0 -f 4000 -s 32
+ *
+ * The partition's contents are lost.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <mtd/mtd-user.h>
+
+#define FILES_PER_DIR	100
+#define MAX_MOUNTS	64
+
+static const char *dev, *mnt = "/data/local/tmp/yaffs-bench";
+static char blockdev[64], mtd_name[64];
+static unsigned files = 1000, size_kb = 16, mounts = 5;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the mtdblock device and the name yaffs knows the partition by */
+static void find_mtd(void)
+{
+	const char *p = dev + strlen(dev);
+	char line[256], want[16];
+	struct stat st;
+	FILE *f;
+	int n;
+
+	while (p > dev && isdigit(p[-1]))
+		p--;
+	if (!*p) {
+		fprintf(stderr, "%s: not an mtd device\n", dev);
+		exit(1);
+	}
+	n = atoi(p);
+
+	snprintf(blockdev, sizeof(blockdev), "/dev/block/mtdblock%d", n);
+	if (stat(blockdev, &st))
+		snprintf(blockdev, sizeof(blockdev), "/dev/mtdblock%d", n);
+
+	f = fopen("/proc/mtd", "r");
+	if (!f)
+		die("/proc/mtd");
+	snprintf(want, sizeof(want), "mtd%d:", n);
+	while (fgets(line, sizeof(line), f)) {
+		char *name = strchr(line, '"'), *end;
+
+		if (strncmp(line, want, strlen(want)) || !name)
+			continue;
+		end = strchr(++name, '"');
+		if (end)
+			*end = '\0';
+		snprintf(mtd_name, sizeof(mtd_name), "%s", name);
+	}
+	fclose(f);
+	if (!mtd_name[0]) {
+		fprintf(stderr, "%s: not in /proc/mtd\n", dev);
+		exit(1);
+	}
+}
+
+static void erase(void)
+{
+	struct mtd_info_user info;
+	struct erase_info_user ei;
+	unsigned bad = 0;
+	int fd;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	if (ioctl(fd, MEMGETINFO, &info))
+		die("MEMGETINFO");
+	ei.length = info.erasesize;
+	for (ei.start = 0; ei.start < info.size; ei.start += info.erasesize) {
+		loff_t offs = ei.start;
+
+		if (ioctl(fd, MEMGETBADBLOCK, &offs) > 0) {
+			bad++;
+			continue;
+		}
+		if (ioctl(fd, MEMERASE, &ei))
+			die("MEMERASE");
+	}
+	close(fd);
+
+	printf("%s: %u blocks of %u KB, %u byte pages, %u bad\n", mtd_name,
+	       info.size / info.erasesize, info.erasesize / 1024,
+	       info.writesize, bad);
+}
+
+static void populate(void)
+{
+	char path[512], *buf;
+	unsigned i;
+	int fd;
+
+	buf = malloc(size_kb * 1024);
+	if (!buf)
+		die("malloc");
+
+	for (i = 0; i < files; i++) {
+		if (i % FILES_PER_DIR == 0) {
+			snprintf(path, sizeof(path), "%s/%u", mnt,
+				 i / FILES_PER_DIR);
+			if (mkdir(path, 0755))
+				die(path);
+		}
+		snprintf(path, sizeof(path), "%s/%u/%u", mnt,
+			 i / FILES_PER_DIR, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			die(path);
+		memset(buf, i, size_kb * 1024);
+		if (write(fd, buf, size_kb * 1024) != (ssize_t)size_kb * 1024)
+			die("write");
+		close(fd);
+	}
+	free(buf);
+}
+
+/* a counter from the partition's entry in /proc/yaffs, or -1 */
+static long yaffs_stat(const char *field)
+{
+	char line[256], want[80];
+	int in_dev = 0;
+	long val = -1;
+	FILE *f;
+
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return -1;
+	snprintf(want, sizeof(want), "\"%s\"", mtd_name);
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Device ", 7))
+			in_dev = strstr(line, want) != NULL;
+		else if (in_dev && !strncmp(line, field, strlen(field)) &&
+			 line[strlen(field)] == '.')
+			val = strtol(strrchr(line, ' ') + 1, NULL, 10);
+	}
+	fclose(f);
+	return val;
+}
+
+/* mounts and unmounts, returns how long the mount took in ns */
+static uint64_t timed_mount(const char *opts, int report)
+{
+	uint64_t start, elapsed;
+
+	start = now_ns();
+	if (mount(blockdev, mnt, "yaffs2", 0, opts))
+		die("mount");
+	elapsed = now_ns() - start;
+
+	if (report)
+		printf("%-10s  %8.1f  %12ld  %12ld\n",
+		       opts ? "scan" : "checkpoint", elapsed / 1e6,
+		       yaffs_stat("nBlockTagReads"),
+		       yaffs_stat("nBlockTagFallbacks"));
+
+	if (umount(mnt))
+		die("umount");
+	return elapsed;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -d mtd_device [-m mountpoint] [-f files] "
+		"[-s file_kb] [-n mounts]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t scan[MAX_MOUNTS];
+	unsigned i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:m:f:s:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'm':
+			mnt = optarg;
+			break;
+		case 'f':
+			files = atoi(optarg);
+			break;
+		case 's':
+			size_kb = atoi(optarg);
+			break;
+		case 'n':
+			mounts = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev || !size_kb || !mounts || mounts > MAX_MOUNTS)
+		usage(argv[0]);
+	find_mtd();
+	if (mkdir(mnt, 0755) && errno != EEXIST)
+		die(mnt);
+
+	erase();
+	if (mount(blockdev, mnt, "yaffs2", 0, NULL))
+		die("mount");
+	populate();
+	if (umount(mnt))
+		die("umount");
+	printf("%u files of %u KB\n\n", files, size_kb);
+
+	printf("%-10s  %8s  %12s  %12s\n", "mount", "ms", "bulk blocks",
+	       "chunk blocks");
+	for (i = 0; i < mounts; i++)
+		scan[i] = timed_mount("no-checkpoint", 1);
+
+	/* leaves a checkpoint behind for the last mount to use */
+	timed_mount(NULL, 0);
+	timed_mount(NULL, 1);
+
+	qsort(scan, mounts, sizeof(*scan), cmp_u64);
+	printf("\nmedian scan mount %.1f ms\n", scan[mounts / 2] / 1e6);
+	return 0;
+}
@@ -0,0 +1,290 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -I../../drivers/staging/zram -lpthread -o zram-bench zram-bench.c */
+
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Swap storm on a zram device.
+ *
+ * Resets and initializes the device, then has 1, 2, 4, ... threads write
+ * page sized blocks to it with O_DIRECT at the same time, each to its own
+ * slice of the device, the way reclaim on every cpu swaps out at once. The
+ * pages are read back the same way. Write and read throughput are printed
+ * for each number of threads, so the scaling with the number of cpus can be
+ * read off directly:
+ *
+ *	zram-bench -d /dev/block/zram0 -s 64 -t 2
+ *
+ * The pages compress about 2:1, like typical anonymous memory, unless a
+ * page dump is given with -f, for instance anonymous memory saved from
+ * /proc/<pid>/mem. With -c, every run is repeated for each of a list of
+ * compressors, and the space the pages took once compressed is printed
+ * next to the throughput, which is how LZO and LZ4 are compared:
+ *
+ *	zram-bench -f anon.dump -c lzo,lz4 -t 1
+ *
+ * Writes time compression and reads time decompression. The device must not
+ * be in use as swap or mounted.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+#include "zram_ioctl.h"
+
+#define PAGE_SIZE	4096
+
+static const char *dev = "/dev/block/zram0";
+static const char *dump;
+static char *compressors;
+static unsigned size_mb = 64, max_threads = 2;
+static unsigned char *pages;		/* the data written to the device */
+static size_t nr_pages;
+
+struct worker {
+	pthread_t	thread;
+	int		fd;
+	int		write;
+	size_t		first, count;	/* slice of the device, in pages */
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_dump(void)
+{
+	FILE *f = fopen(dump, "r");
+
+	if (!f) {
+		perror(dump);
+		exit(1);
+	}
+	nr_pages = fread(pages, PAGE_SIZE, nr_pages, f);
+	if (!nr_pages) {
+		fprintf(stderr, "%s: no whole page\n", dump);
+		exit(1);
+	}
+	fclose(f);
+}
+
+static void fill_pages(void)
+{
+	uint64_t x = 88172645463325252ULL;
+	size_t i, j;
+
+	/*
+	 * Random bytes from a small alphabet on half of each page. The low
+	 * bits of rand_r() repeat after a few hundred pages, which zram
+	 * would deduplicate, so use a xorshift generator instead.
+	 */
+	for (i = 0; i < nr_pages; i++) {
+		unsigned char *p = pages + i * PAGE_SIZE;
+
+		memset(p, 0, PAGE_SIZE);
+		for (j = 0; j < PAGE_SIZE / 2; j++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			p[j] = "0123456789abcdef"[x >> 60];
+		}
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char *buf;
+	size_t i;
+
+	if (posix_memalign((void **)&buf, PAGE_SIZE, PAGE_SIZE)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+
+	for (i = w->first; i < w->first + w->count; i++) {
+		off_t off = (off_t)i * PAGE_SIZE;
+		ssize_t ret;
+
+		if (w->write) {
+			memcpy(buf, pages + i * PAGE_SIZE, PAGE_SIZE);
+			ret = pwrite(w->fd, buf, PAGE_SIZE, off);
+		} else
+			ret = pread(w->fd, buf, PAGE_SIZE, off);
+		if (ret != PAGE_SIZE) {
+			perror(w->write ? "pwrite" : "pread");
+			exit(1);
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* runs 'threads' workers over the whole device, returns MB/s */
+static double run(int fd, unsigned threads, int write)
+{
+	struct worker w[threads];
+	double start;
+	unsigned i;
+
+	start = now();
+	for (i = 0; i < threads; i++) {
+		w[i].fd = fd;
+		w[i].write = write;
+		w[i].first = nr_pages * i / threads;
+		w[i].count = nr_pages * (i + 1) / threads - w[i].first;
+		if (pthread_create(&w[i].thread, NULL, worker_thread, &w[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(w[i].thread, NULL);
+
+	return nr_pages * (double)PAGE_SIZE / (now() - start) / (1 << 20);
+}
+
+static int init_device(const char *compressor)
+{
+	size_t disksize_kb = (size_t)size_mb << 10;
+	char name[ZRAM_MAX_COMP_NAME];
+	int fd;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		exit(1);
+	}
+	if (ioctl(fd, ZRAMIO_RESET)) {
+		perror("zram reset");
+		exit(1);
+	}
+	if (compressor) {
+		strncpy(name, compressor, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+		if (ioctl(fd, ZRAMIO_SET_COMPRESSOR, name)) {
+			perror(compressor);
+			exit(1);
+		}
+	}
+	if (ioctl(fd, ZRAMIO_SET_DISKSIZE_KB, &disksize_kb) ||
+	    ioctl(fd, ZRAMIO_INIT)) {
+		perror("zram init");
+		exit(1);
+	}
+	close(fd);
+
+	/* reopen now that the device has its size */
+	fd = open(dev, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		exit(1);
+	}
+	return fd;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-s size_mb] [-t threads] "
+		"[-f page_dump] [-c compressor,...]\n", name);
+	exit(1);
+}
+
+/* one line of results per number of threads */
+static void bench(const char *compressor)
+{
+	unsigned threads;
+
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		struct zram_ioctl_stats stats;
+		int fd = init_device(compressor);
+		double wr, rd;
+
+		wr = run(fd, threads, 1);
+		if (ioctl(fd, ZRAMIO_GET_STATS, &stats)) {
+			perror("zram stats");
+			exit(1);
+		}
+		rd = run(fd, threads, 0);
+		printf("%-10s  %7u  %10.1f  %9.1f  %9.1f  %5.1f%%\n",
+		       compressor ? compressor : "default", threads, wr, rd,
+		       stats.compr_data_size / (double)(1 << 20),
+		       stats.orig_data_size ? 100.0 * stats.compr_data_size /
+		       stats.orig_data_size : 0);
+		close(fd);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char *compressor;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:t:f:c:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 's':
+			size_mb = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'f':
+			dump = optarg;
+			break;
+		case 'c':
+			compressors = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!size_mb || !max_threads)
+		usage(argv[0]);
+
+	nr_pages = ((size_t)size_mb << 20) / PAGE_SIZE;
+	pages = malloc(nr_pages * PAGE_SIZE);
+	if (!pages) {
+		perror("malloc");
+		return 1;
+	}
+	if (dump)
+		read_dump();
+	else
+		fill_pages();
+
+	printf("compressor  threads  write MB/s  read MB/s  stored MB  ratio\n");
+	if (!compressors)
+		bench(NULL);
+	else
+		for (compressor = strtok(compressors, ","); compressor;
+		     compressor = strtok(NULL, ","))
+			bench(compressor);
+
+	return 0;
+}